@@ -22,10 +22,13 @@
 
 #include "starsplatter.h"
 #include "circlesplatpainter.h"
+#include "splatbatch.h"
 
 /* Notes-
  */
 
+const double CircleSplatPainter::lthick= 4.5;
+
 CircleSplatPainter::CircleSplatPainter(StarSplatter* owner_in)
   : SplatPainter(owner_in)
 {
@@ -47,62 +50,95 @@ StarSplatter::SplatType CircleSplatPainter::getSplatType() const
   return StarSplatter::SPLAT_GLYPH_CIRCLE;
 }
 
-void CircleSplatPainter::circlept(double xx,double yy,
-				  const double sep_fac, 
-				  const StarSplatter::Splat* s,
-				  gColor* tmp_image,
-				  double& krnl_integral,
-				  int& pixels_touched) const {
-  int xsize= owner->image_xsize();
-  int ysize= owner->image_ysize();
-  double xadj= s->loc.x()+(xx);
-  double yadj= s->loc.y()+(yy);
-  double csplat_limit= 0.5; // half-width of the point
-  StarSplatter::Splat tmpS= *s;
-  tmpS.loc= gPoint(xadj,yadj,s->loc.z(),s->loc.w());
-  int cimin= (int)(xadj-csplat_limit+1.0);
-  int cimax= (int)(xadj+csplat_limit);
-  int cjmin= (int)(yadj-csplat_limit+1.0);
-  int cjmax= (int)(yadj+csplat_limit);
-  // Use small_splat to draw an antialiased point
-  if (cimin>=0 && cimax<xsize && cjmin>=0 && cjmax<ysize)
-    small_splat( &tmpS, 1.0, sep_fac, 1.0,
-		 s->clr,cimin,cimax,cjmin,cjmax,tmp_image,
-		 krnl_integral, pixels_touched );
+void CircleSplatPainter::footprint( const StarSplatter::Splat* splat,
+				    SplatPixelRect& rect ) const
+{
+  // Outermost ring, plus the 2x2 antialiased point drawn at each step
+  double reach= 1.0/(splat->sep_fac*splat->sqrt_exp_constant) 
+    + 0.5*lthick + 2.0;
+  rect.imin= (int)floor(splat->x-reach);
+  rect.imax= (int)ceil(splat->x+reach);
+  rect.jmin= (int)floor(splat->y-reach);
+  rect.jmax= (int)ceil(splat->y+reach);
+  if (rect.imin<0) rect.imin= 0;
+  if (rect.imax>=owner->image_xsize()) rect.imax= owner->image_xsize()-1;
+  if (rect.jmin<0) rect.jmin= 0;
+  if (rect.jmax>=owner->image_ysize()) rect.jmax= owner->image_ysize()-1;
 }
 
-void CircleSplatPainter::paint( const StarSplatter::Splat* splat,
-				  const double sep_fac,
-				  gColor* tmp_image, 
-				  double& krnl_integral, int& pixels_touched )
-{
-  double lthick=4.5;
-  double radius= 1.0/(sep_fac*splat->sqrt_exp_constant);
+/* The policy for the painting templates in splatbatch.h.  The glyph
+ * is not a kernel, so the policy paints it directly.
+ */
+class CircleGlyph {
+public:
+  enum { stamps= 0 };
+  CircleGlyph( const double lthick_in ) { lthick= lthick_in; }
+  template <int STATS, int FORMAT>
+  void paint( const StarSplatter::Splat* splat, 
+	      const SplatPaintContext& ctx, SplatPaintStats& stats ) const
+  {
+    double sep_fac= splat->sep_fac;
+    double radius= 1.0/(sep_fac*splat->sqrt_exp_constant);
 
-  double crad_min= radius-0.5*lthick;
-  if (crad_min<0.0) crad_min= 0.0;
-  for (double crad_shifted= crad_min;
-       crad_shifted<=radius+0.5*lthick; crad_shifted += 0.5) {
-    double x= 0.0;
-    double y= crad_shifted;
-    circlept(x,y,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-    circlept(x,-y,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-    circlept(y,x,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-    circlept(-y,x,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-    x += 1.0;
-    y= sqrt(crad_shifted*crad_shifted-x*x);
-    while (x<=y+0.5) {
-      circlept(x,y,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-      circlept(x,-y,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-      circlept(y,x,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-      circlept(-y,x,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-      circlept(y,-x,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-      circlept(-x,y,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-      circlept(-x,-y,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
-      circlept(-y,-x,sep_fac,splat,tmp_image,krnl_integral,pixels_touched);
+    double crad_min= radius-0.5*lthick;
+    if (crad_min<0.0) crad_min= 0.0;
+    for (double crad_shifted= crad_min;
+	 crad_shifted<=radius+0.5*lthick; crad_shifted += 0.5) {
+      double x= 0.0;
+      double y= crad_shifted;
+      circlept<STATS,FORMAT>(x,y,splat,ctx,stats);
+      circlept<STATS,FORMAT>(x,-y,splat,ctx,stats);
+      circlept<STATS,FORMAT>(y,x,splat,ctx,stats);
+      circlept<STATS,FORMAT>(-y,x,splat,ctx,stats);
       x += 1.0;
       y= sqrt(crad_shifted*crad_shifted-x*x);
+      while (x<=y+0.5) {
+	circlept<STATS,FORMAT>(x,y,splat,ctx,stats);
+	circlept<STATS,FORMAT>(x,-y,splat,ctx,stats);
+	circlept<STATS,FORMAT>(y,x,splat,ctx,stats);
+	circlept<STATS,FORMAT>(-y,x,splat,ctx,stats);
+	circlept<STATS,FORMAT>(y,-x,splat,ctx,stats);
+	circlept<STATS,FORMAT>(-x,y,splat,ctx,stats);
+	circlept<STATS,FORMAT>(-x,-y,splat,ctx,stats);
+	circlept<STATS,FORMAT>(-y,-x,splat,ctx,stats);
+	x += 1.0;
+	y= sqrt(crad_shifted*crad_shifted-x*x);
+      }
     }
   }
-}
+private:
+  double lthick;
+  template <int STATS, int FORMAT>
+  void circlept( const double xx, const double yy,
+		 const StarSplatter::Splat* s,
+		 const SplatPaintContext& ctx,
+		 SplatPaintStats& stats ) const
+  {
+    double xadj= s->x+(xx);
+    double yadj= s->y+(yy);
+    double csplat_limit= 0.5; // half-width of the point
+    StarSplatter::Splat tmpS= *s;
+    tmpS.x= xadj;
+    tmpS.y= yadj;
+    int cimin= (int)(xadj-csplat_limit+1.0);
+    int cimax= (int)(xadj+csplat_limit);
+    int cjmin= (int)(yadj-csplat_limit+1.0);
+    int cjmax= (int)(yadj+csplat_limit);
+    // Use small_splat to draw an antialiased point
+    if (cimin>=0 && cimax<ctx.xsize && cjmin>=0 && cjmax<ctx.ysize)
+      ssplat_small_splat<STATS,FORMAT>( ctx, &tmpS, 1.0, 1.0, s->clr,
+					cimin, cimax, cjmin, cjmax, stats );
+  }
+};
 
+void CircleSplatPainter::paint_batch( const StarSplatter::Splat* splats,
+				      const long n,
+				      const SplatPixelRect& clip,
+				      const SplatFrame& frame,
+				      double* krnl_integral,
+				      int* pixels_touched )
+{
+  CircleGlyph glyph( lthick );
+  dispatch_batch( glyph, splats, n, clip, frame, 
+		  krnl_integral, pixels_touched );
+}
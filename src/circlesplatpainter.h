@@ -23,15 +23,11 @@ class CircleSplatPainter : public SplatPainter {
   virtual ~CircleSplatPainter();
   virtual const char* typeName() const;
   virtual StarSplatter::SplatType getSplatType() const;
-  virtual void paint( const StarSplatter::Splat* splat,
-		      const double sep_fac,
-		      gColor* tmp_image,
-		      double& krnl_integral, int& pixels_touched );
+  virtual void footprint( const StarSplatter::Splat* splat,
+			  SplatPixelRect& rect ) const;
+  virtual void paint_batch( const StarSplatter::Splat* splats, const long n,
+			    const SplatPixelRect& clip, const SplatFrame& frame,
+			    double* krnl_integral, int* pixels_touched );
  private:
-  inline void circlept(double xx,double yy,
-		       const double sep_fac, 
-		       const StarSplatter::Splat* s,
-		       gColor* tmp_image,
-		       double& krnl_integral,
-		       int& pixels_touched) const;
+  static const double lthick;
 };
@@ -22,8 +22,14 @@
 
 #include "starsplatter.h"
 #include "gaussiansplatpainter.h"
+#include "splatbatch.h"
 
 /* Notes-
+ * The Gaussian is separable, so the kernel policy evaluates one vector
+ * of 1D factors along x for each span of columns and one factor per
+ * row, and forms their outer product.  With pixel integration on, the
+ * factors are differences of erf() across each pixel, which sum to 1.0
+ * without renormalization.
  */
 
 #define InvPi (1.0/M_PI)
@@ -61,106 +67,144 @@ static inline double cutoffGaussian(double cutoffScale,
   return sqrt( -log(cutoffScale) )/ (hInv*sep_fac);
 }
 
-void GaussianSplatPainter::paint( const StarSplatter::Splat* splat,
-				  const double sep_fac,
-				  gColor* tmp_image, 
-				  double& krnl_integral, int& pixels_touched )
+/* Fills f[0..n-1] with the 1D factors of the kernel for pixels first
+ * to first+n-1, given the splat center and k= hInv*sep_fac.  Sampled
+ * factors are exp(-k^2 d^2) at the pixel centers; integrated factors
+ * are the fraction of the unit 1D Gaussian falling in each pixel.
+ */
+static void gaussianFactors( double* f, const int n, const int first,
+			     const double center, const double k,
+			     const int integrate )
 {
-  int xsize= owner->image_xsize();
-  int ysize= owner->image_ysize();
-  int debug_flag= owner->debug();
-  double splat_cutoff= owner->splat_cutoff_frac();
-  gColor scaled_clr= splat->clr;
-  scaled_clr.mult_noclamp( splat->density );
-
-  gColor tmp_clr;
-
-  double splat_limit= cutoffGaussian(splat_cutoff,
-				     splat->sqrt_exp_constant,
-				     sep_fac);
-
-  // fprintf(stderr,"gaussian splat: splat_limit= %f\n",splat_limit);
-
-  int imin= (int)(splat->loc.x()-splat_limit+1.0); // ceil
-  int imax= (int)(splat->loc.x()+splat_limit); // floor
-  int jmin= (int)(splat->loc.y()-splat_limit+1.0); // ceil
-  int jmax= (int)(splat->loc.y()+splat_limit); // floor
-
-  if (imin<0) imin= 0;
-  if (imax>=xsize) imax= xsize-1;
-  if (jmin<0) jmin= 0;
-  if (jmax>=ysize) jmax= ysize-1;    
-
-  int maxNSplats= ((imax-imin)+1)*((jmax-jmin)+1);
-  if (maxNSplats > (double)SPLAT_RENORM_CUTOFF) { 
-    gColor* pixrunner;
-    double y= sep_fac*((double)jmin - splat->loc.y());
-    for (int j=jmin; j<=jmax; j++) {
-      pixrunner= tmp_image + (j*xsize) + imin;
-      double x= sep_fac*((double)imin - splat->loc.x());
-      for (int i=imin; i<=imax; i++) {
-	// Calc and add color here
-	double kval= kernelGaussian(splat->sqrt_exp_constant,x,y);
-	tmp_clr= scaled_clr;
-	tmp_clr.mult_noclamp(kval);
-	tmp_clr.clamp_alpha();
-	tmp_clr.add_under( *pixrunner );
-	*pixrunner++= tmp_clr;
-	if (debug_flag) {
-	  pixels_touched++;
-	  krnl_integral += kval;
-	}
-	x += sep_fac;
-      }
-      y += sep_fac;
+  if (integrate) {
+    double lo= erf(k*((double)first - 0.5 - center));
+    for (int i=0; i<n; i++) {
+      double hi= erf(k*((double)(first+i) + 0.5 - center));
+      f[i]= 0.5*(hi-lo);
+      lo= hi;
     }
   }
   else {
-    if (splat_limit > 1.0) {
-      /* Here we need to renormalize */
-      double samples[SPLAT_RENORM_CUTOFF];
-      double* here= samples;
-      double sum= 0.0;
-      double y= sep_fac*((double)jmin - splat->loc.y());
-      for (int j=jmin; j<=jmax; j++) {
-	double x= sep_fac*((double)imin - splat->loc.x());
-	for (int i=imin; i<=imax; i++) {
-	  double kval= kernelGaussian(splat->sqrt_exp_constant,x,y);
-	  assert(here-samples < SPLAT_RENORM_CUTOFF);
-	  *here++= kval;
-	  sum += kval;
-	  x += sep_fac;
-	}
-	y += sep_fac;
-      }
-      gColor* pixrunner;
-      double invSum= 1.0/(sum*sep_fac*sep_fac); // sum *should* = 1.0/(sep_fac^2)
-      //fprintf(stderr,"invSum= %g\n",invSum);
-      krnl_integral *= invSum;
-      here= samples;
-      for (int j=jmin; j<=jmax; j++) {
-	pixrunner= tmp_image + (j*xsize) + imin;
-	for (int i=imin; i<=imax; i++) {
-	  double kval= invSum*(*here++);
-	  if (debug_flag) {
-	    pixels_touched++;
-	    krnl_integral += kval;
-	  }
-	  tmp_clr= scaled_clr;
-	  tmp_clr.mult_noclamp(kval);
-	  tmp_clr.clamp_alpha();
-	  tmp_clr.add_under( *pixrunner );
-	  *pixrunner++= tmp_clr;
-	}
-      }
-    }
-    else {
-      small_splat( splat, splat_limit, sep_fac, 1.0/(sep_fac*sep_fac),
-		   scaled_clr,
-		   imin, imax, jmin, jmax, tmp_image,
-		   krnl_integral, pixels_touched );
+    for (int i=0; i<n; i++) {
+      double d= k*((double)(first+i) - center);
+      f[i]= exp(-d*d);
     }
   }
+}
+
+int GaussianSplatPainter::stamp_supported() const
+{
+  return 1;
+}
+
+int GaussianSplatPainter::pixel_integrated() const
+{
+  return owner->pixel_integration();
+}
+
+double GaussianSplatPainter::pixel_kernel( const double k, const double dx,
+					   const double dy ) const
+{
+  if (pixel_integrated()) {
+    double fx, fy;
+    gaussianFactors( &fx, 1, 0, -dx, k, 1 );
+    gaussianFactors( &fy, 1, 0, -dy, k, 1 );
+    return fx*fy;
+  }
+  return kernelGaussian(k, dx, dy);
+}
 
+double GaussianSplatPainter::pixel_limit( const double k ) const
+{
+  // Integrated kernels reach every pixel overlapping the cutoff circle
+  return cutoffGaussian(owner->splat_cutoff_frac(), k, 1.0)
+    + (pixel_integrated() ? 0.5 : 0.0);
 }
 
+double GaussianSplatPainter::kernel_slope() const
+{
+  return sqrt(2.0)*exp(-0.5); // at r= 1/(k*sqrt(2))
+}
+
+double GaussianSplatPainter::reach( const StarSplatter::Splat* splat ) const
+{
+  return cutoffGaussian(owner->splat_cutoff_frac(),
+			splat->sqrt_exp_constant, splat->sep_fac);
+}
+
+void GaussianSplatPainter::footprint( const StarSplatter::Splat* splat,
+				      SplatPixelRect& rect ) const
+{
+  int i0, j0;
+  const SplatStamp* stamp= find_stamp( splat, i0, j0 );
+  if (stamp) {
+    stamp_footprint( stamp, i0, j0, rect );
+    return;
+  }
+  double splat_limit= cutoffGaussian(owner->splat_cutoff_frac(),
+				     splat->sqrt_exp_constant, splat->sep_fac);
+  if (pixel_integrated()) clipped_bounds( splat, splat_limit+0.5, rect );
+  else kernel_footprint( splat, splat_limit, rect );
+}
+
+/* The kernel policy for the painting templates in splatbatch.h */
+class GaussianKernel {
+public:
+  enum { stamps= 1 };
+  GaussianKernel( const double cutoff_in, const int integrate_in )
+  { cutoff= cutoff_in; integrate= integrate_in; }
+  template <int STATS, int FORMAT>
+  void paint( const StarSplatter::Splat* splat, 
+	      const SplatPaintContext& ctx, SplatPaintStats& stats )
+  {
+    ssplat_paint_kernel<GaussianKernel,STATS,FORMAT>( *this, splat, ctx,
+						      stats );
+  }
+  double setup( const StarSplatter::Splat* splat )
+  {
+    double sep_fac= splat->sep_fac;
+    k= splat->sqrt_exp_constant*sep_fac;
+    scale= (integrate ? 1.0 : k*k*InvPi)/(sep_fac*sep_fac);
+    return cutoffGaussian(cutoff, splat->sqrt_exp_constant, sep_fac);
+  }
+  int integrated() const { return integrate; }
+  void begin_span( const StarSplatter::Splat* splat, const int i0, 
+		   const int n )
+  {
+    span_start= i0;
+    gaussianFactors( fx, n, i0, splat->x, k, integrate );
+  }
+  void row_span( const StarSplatter::Splat* splat, const int j,
+		 int& ilo, int& ihi ) const
+  {
+    // The whole square is painted
+  }
+  void row( float* weights, const int i0, const int n, const int j,
+	    const StarSplatter::Splat* splat ) const
+  {
+    double fy;
+    gaussianFactors( &fy, 1, j, splat->y, k, integrate );
+    double row_scale= scale*fy;
+    const double* f= fx + (i0-span_start);
+    for (int i=0; i<n; i++) weights[i]= row_scale*f[i];
+  }
+private:
+  double cutoff;
+  int integrate;
+  double k; // hInv*sep_fac
+  double scale;
+  int span_start;
+  double fx[SPLAT_SPAN];
+};
+
+void GaussianSplatPainter::paint_batch( const StarSplatter::Splat* splats,
+					const long n,
+					const SplatPixelRect& clip,
+					const SplatFrame& frame,
+					double* krnl_integral,
+					int* pixels_touched )
+{
+  GaussianKernel kernel( owner->splat_cutoff_frac(), pixel_integrated() );
+  dispatch_batch( kernel, splats, n, clip, frame, 
+		  krnl_integral, pixels_touched );
+}
@@ -23,8 +23,17 @@ class GaussianSplatPainter : public SplatPainter {
   virtual ~GaussianSplatPainter();
   virtual const char* typeName() const;
   virtual StarSplatter::SplatType getSplatType() const;
-  virtual void paint( const StarSplatter::Splat* splat,
-		      const double sep_fac,
-		      gColor* tmp_image,
-		      double& krnl_integral, int& pixels_touched );
+  virtual void footprint( const StarSplatter::Splat* splat,
+			  SplatPixelRect& rect ) const;
+  virtual double reach( const StarSplatter::Splat* splat ) const;
+  virtual void paint_batch( const StarSplatter::Splat* splats, const long n,
+			    const SplatPixelRect& clip, const SplatFrame& frame,
+			    double* krnl_integral, int* pixels_touched );
+ protected:
+  virtual int stamp_supported() const;
+  virtual double pixel_kernel( const double k, const double dx, 
+			       const double dy ) const;
+  virtual double pixel_limit( const double k ) const;
+  virtual double kernel_slope() const;
+  virtual int pixel_integrated() const;
 };
@@ -0,0 +1,163 @@
+/****************************************************************************
+ * radixsort.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "threadteam.h"
+#include "radixsort.h"
+
+/* Notes-
+ * Each pass sorts on one 8 bit digit.  The records are cut into one
+ * contiguous chunk per thread; each chunk is histogrammed, the
+ * histograms are scanned digit-major and chunk-minor, and then each
+ * chunk scatters its records in order.  This keeps every pass stable.
+ * Passes on which all records share the same digit are skipped.
+ */
+
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1<<RADIX_BITS)
+
+struct RadixPassJob {
+  const unsigned long long* src;
+  unsigned long long* dst;
+  long n;
+  int shift;
+  unsigned long long mask;
+  int nchunks;
+  long* counts; // nchunks*RADIX_BUCKETS; counts, then scatter positions
+};
+
+static inline long chunk_start( const RadixPassJob* job, const int chunk )
+{
+  return (chunk*job->n)/job->nchunks;
+}
+
+static void radix_count_task( void* arg, const int chunk, const int thread )
+{
+  RadixPassJob* job= (RadixPassJob*)arg;
+  long* counts= job->counts + chunk*RADIX_BUCKETS;
+  for (int i=0; i<RADIX_BUCKETS; i++) counts[i]= 0;
+  long last= chunk_start(job,chunk+1);
+  for (long i=chunk_start(job,chunk); i<last; i++)
+    counts[(job->src[i]>>job->shift) & job->mask]++;
+}
+
+static void radix_scatter_task( void* arg, const int chunk,
+				const int thread )
+{
+  RadixPassJob* job= (RadixPassJob*)arg;
+  long* offsets= job->counts + chunk*RADIX_BUCKETS;
+  long last= chunk_start(job,chunk+1);
+  for (long i=chunk_start(job,chunk); i<last; i++) {
+    unsigned long long rec= job->src[i];
+    job->dst[offsets[(rec>>job->shift) & job->mask]++]= rec;
+  }
+}
+
+struct RadixCopyJob {
+  const unsigned long long* src;
+  unsigned long long* dst;
+  long n;
+  int nchunks;
+};
+
+static void radix_copy_task( void* arg, const int chunk, const int thread )
+{
+  RadixCopyJob* job= (RadixCopyJob*)arg;
+  long first= (chunk*job->n)/job->nchunks;
+  long last= ((chunk+1)*job->n)/job->nchunks;
+  for (long i=first; i<last; i++) job->dst[i]= job->src[i];
+}
+
+void ssplat_radix_sort( unsigned long long* recs,
+			unsigned long long* scratch, const long n,
+			const int first_bit, const int nbits,
+			ThreadTeam& team )
+{
+  if (n<2) return;
+
+  RadixPassJob job;
+  job.n= n;
+  job.nchunks= team.nthreads();
+  // Small chunks are not worth a thread
+  if (job.nchunks > n/4096) job.nchunks= (int)(n/4096);
+  if (job.nchunks<1) job.nchunks= 1;
+  job.counts= new long[job.nchunks*RADIX_BUCKETS];
+
+  unsigned long long* src= recs;
+  unsigned long long* dst= scratch;
+  for (int bit=first_bit; bit<first_bit+nbits; bit += RADIX_BITS) {
+    int width= first_bit+nbits-bit;
+    if (width>RADIX_BITS) width= RADIX_BITS;
+    job.src= src;
+    job.dst= dst;
+    job.shift= bit;
+    job.mask= (1ULL<<width)-1;
+    team.run( radix_count_task, &job, job.nchunks );
+
+    // Scan the histograms, noting whether this digit sorts anything
+    long running= 0;
+    int trivial= 0;
+    for (int digit=0; digit<RADIX_BUCKETS; digit++) {
+      long digit_total= 0;
+      for (int chunk=0; chunk<job.nchunks; chunk++) {
+	long count= job.counts[chunk*RADIX_BUCKETS + digit];
+	job.counts[chunk*RADIX_BUCKETS + digit]= running;
+	running += count;
+	digit_total += count;
+      }
+      if (digit_total==n) trivial= 1;
+    }
+    if (trivial) continue;
+
+    team.run( radix_scatter_task, &job, job.nchunks );
+    unsigned long long* tmp= src;
+    src= dst;
+    dst= tmp;
+  }
+
+  if (src != recs) {
+    RadixCopyJob copy_job;
+    copy_job.src= src;
+    copy_job.dst= recs;
+    copy_job.n= n;
+    copy_job.nchunks= job.nchunks;
+    team.run( radix_copy_task, &copy_job, copy_job.nchunks );
+  }
+
+  delete [] job.counts;
+}
+
+int ssplat_insertion_sort( unsigned long long* recs, const long n,
+			   const long max_moves )
+{
+  long moves= 0;
+  for (long i=1; i<n; i++) {
+    unsigned long long rec= recs[i];
+    if (recs[i-1] <= rec) continue;
+    long j= i;
+    do {
+      recs[j]= recs[j-1];
+      j--;
+    } while (j>0 && recs[j-1]>rec);
+    recs[j]= rec;
+    moves += i-j;
+    if (moves>max_moves) return 0;
+  }
+  return 1;
+}
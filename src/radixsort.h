@@ -0,0 +1,54 @@
+/****************************************************************************
+ * radixsort.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_RADIXSORT
+#define INCL_RADIXSORT
+
+class ThreadTeam;
+
+/* Stable parallel LSD radix sort of 64 bit records on the bit field
+ * starting at first_bit and nbits long.  The usual arrangement is a
+ * sort key in the high 32 bits and an array index in the low 32 bits.
+ * scratch must hold as many records as recs.  The sorted records end
+ * up back in recs.
+ */
+extern void ssplat_radix_sort( unsigned long long* recs,
+			       unsigned long long* scratch, const long n,
+			       const int first_bit, const int nbits,
+			       ThreadTeam& team );
+
+/* Serial insertion sort of 64 bit records, which takes time linear in
+ * n plus the number of records out of order, for input which is
+ * already nearly sorted.  It gives up once it has moved records
+ * max_moves places in all, returning 0 and leaving recs a partly
+ * sorted permutation of the input; it returns 1 if recs is sorted.
+ */
+extern int ssplat_insertion_sort( unsigned long long* recs, const long n,
+				  const long max_moves );
+
+/* An unsigned key which sorts in the same order as the given float.
+ * Negative zero is folded into positive zero.
+ */
+inline unsigned int ssplat_float_sort_key( const float val )
+{
+  union { float f; unsigned int u; } bits;
+  bits.f= (val==0.0f) ? 0.0f : val;
+  return (bits.u & 0x80000000u) ? ~bits.u : (bits.u | 0x80000000u);
+}
+
+#endif // INCL_RADIXSORT
@@ -1,5 +1,5 @@
-# Finally, add the math library
-LIBS += -lm
+# Finally, add the math and thread libraries
+LIBS += -lm -lpthread
 CFLAGS += -I.
 
 all: ${BUILD_LIBS} ${BUILD_EXES}
@@ -22,7 +22,11 @@ srcFileList= [ "camera.cc", "geometry.cc", "rgbimage.cc",
                "starsplatter.cc", "ssplat_usr_modify.cc",
                "starbunch.cc", "utils.cc", "interpolate.cc", "splatpainter.cc",
                "gaussiansplatpainter.cc", "splinesplatpainter.cc",
-               "circlesplatpainter.cc", "cball.cc",
+               "circlesplatpainter.cc", "cball.cc", "threadteam.cc",
+               "radixsort.cc", "splatbuffer.cc",
+               "splatstamp.cc", "splatpyramid.cc", "splatopacity.cc",
+               "splatorder.cc", "starbunchoctree.cc", "splatbucket.cc",
+               "starbunchlod.cc", "splatcomposite.cc", "splatframebuffer.cc",
                "starsplatter.i", "cball.i" ]
 
 starsplatter_ext = Extension('_starsplatter', srcFileList,
@@ -30,7 +34,7 @@ starsplatter_ext = Extension('_starsplatter', srcFileList,
                              define_macros=[('NDEBUG','1'),
                                             ('AVOID_IMTOOLS',None),
                                             ('INCL_PNG',None)],
-                             libraries=['png','m'],
+                             libraries=['png','m','pthread'],
                              swig_opts=['-c++', '-py3']
                              )
 
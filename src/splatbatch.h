@@ -0,0 +1,536 @@
+/****************************************************************************
+ * splatbatch.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATBATCH
+#define INCL_SPLATBATCH
+
+/* The templates in this file make up the painting loops.  They are
+ * included only by the painters, each of which instantiates them for
+ * a kernel policy class.  The STATS parameter is 1 if per-splat
+ * statistics are wanted; with STATS 0 the statistics code compiles
+ * away.  The FORMAT parameter is the SplatPixelFormat of the frame.
+ * Pixels are addressed by their offset into whichever pixel pointer
+ * the frame has set.  On a density frame only the alpha of the splat
+ * colors is painted; half and planar pixels are loaded as gColors and
+ * stored again around each deposit.
+ *
+ * A kernel policy for a radially symmetric kernel provides:
+ *
+ *   enum { stamps= 1 };  // or 0 if stamps are never used
+ *   template <int STATS, int FORMAT> 
+ *   void paint( const StarSplatter::Splat* splat,
+ *               const SplatPaintContext& ctx, SplatPaintStats& stats );
+ *     which usually just calls ssplat_paint_kernel<Policy,STATS,FORMAT>()
+ *     on itself, using the following methods:
+ *   double setup( const StarSplatter::Splat* splat );
+ *     prepares for the given splat and returns its cutoff in pixels
+ *   int integrated() const;
+ *     non-zero if the weights are pixel integrals, which reach half a
+ *     pixel further and need no renormalization
+ *   void begin_span( const StarSplatter::Splat* splat, const int i0,
+ *                    const int n );
+ *     called before the rows of columns i0 through i0+n-1 are painted
+ *   void row_span( const StarSplatter::Splat* splat, const int j,
+ *                  int& ilo, int& ihi ) const;
+ *     narrows a row's column range to the kernel's support
+ *   void row( float* weights, const int i0, const int n, const int j,
+ *             const StarSplatter::Splat* splat ) const;
+ *     the kernel at pixels (i0,j) through (i0+n-1,j), which lie in the
+ *     current span, per unit area in the splat's coordinates
+ */
+
+#include <assert.h>
+#include "splatstamp.h"
+#include "splatopacity.h"
+#include "splatframebuffer.h"
+
+/* The alpha channel of ssplat_deposit(), on a density frame.  The
+ * arithmetic is that of the gColor operations, so that the density
+ * matches the alpha a color frame would get.
+ */
+static inline void ssplat_deposit_density( const SplatPaintContext& ctx,
+					   const long offset, 
+					   const float alpha_in,
+					   const double kval )
+{
+  float alpha= alpha_in*(float)kval;
+  alpha= (alpha>=0.0f) ? alpha : 0.0f;
+  alpha= (alpha<=1.0f) ? alpha : 1.0f;
+  float* d= ctx.density + offset;
+  if (ctx.additive) *d += alpha;
+  else if (ctx.front_to_back) {
+    if (!ctx.opacity) *d= *d + alpha - (*d * alpha);
+    else if (*d < ctx.opacity->limit()) {
+      *d= *d + alpha - (*d * alpha);
+      if (*d >= ctx.opacity->limit())
+	ctx.opacity->saturate( offset % ctx.stride, offset / ctx.stride );
+    }
+  }
+  else *d= alpha + *d - (alpha * *d);
+}
+
+/* Composites one deposit into a color pixel */
+static inline void ssplat_deposit_color( const SplatPaintContext& ctx,
+					 const long offset, gColor& pixel,
+					 const gColor& clr, const double kval )
+{
+  gColor tmp_clr= clr;
+  tmp_clr.mult_noclamp(kval);
+  tmp_clr.clamp_alpha();
+  if (ctx.additive) pixel.add_noclamp( tmp_clr );
+  else if (ctx.reveal) {
+    float alpha= tmp_clr.a();
+    ctx.reveal[offset] *= 1.0f - alpha;
+    tmp_clr.mult_noclamp( alpha*ctx.blend_weight );
+    pixel.add_noclamp( tmp_clr );
+  }
+  else if (ctx.front_to_back) {
+    // What is already in the pixel lies in front of the new splat
+    if (!ctx.opacity) pixel.add_under( tmp_clr );
+    else if (pixel.a() < ctx.opacity->limit()) {
+      pixel.add_under( tmp_clr );
+      if (pixel.a() >= ctx.opacity->limit())
+	ctx.opacity->saturate( offset % ctx.stride, offset / ctx.stride );
+    }
+  }
+  else {
+    tmp_clr.add_under( pixel );
+    pixel= tmp_clr;
+  }
+}
+
+template <int STATS, int FORMAT>
+inline void ssplat_deposit( const SplatPaintContext& ctx, const long offset,
+			    const gColor& clr, const double kval,
+			    SplatPaintStats& stats )
+{
+  if (FORMAT==SPF_RGBA) 
+    ssplat_deposit_color( ctx, offset, ctx.image[offset], clr, kval );
+  else if (FORMAT==SPF_DENSITY) 
+    ssplat_deposit_density( ctx, offset, clr.a(), kval );
+  else if (FORMAT==SPF_HALF) {
+    unsigned short* h= ctx.half_pixels + 4*offset;
+    gColor pixel= ssplat_half_pixel( h );
+    ssplat_deposit_color( ctx, offset, pixel, clr, kval );
+    ssplat_set_half_pixel( h, pixel );
+  }
+  else {
+    float* plane= ctx.planes + offset;
+    long n= ctx.plane_size;
+    gColor pixel( plane[0], plane[n], plane[2*n], plane[3*n] );
+    ssplat_deposit_color( ctx, offset, pixel, clr, kval );
+    plane[0]= pixel.r();
+    plane[n]= pixel.g();
+    plane[2*n]= pixel.b();
+    plane[3*n]= pixel.a();
+  }
+  if (STATS) {
+    stats.pixels_touched++;
+    stats.krnl_integral += kval;
+  }
+}
+
+/* Deposits a run of n pixels starting at offset, pixel i getting
+ * weight scale*weights[i].  Sums into density and planar frames get
+ * loops without branches, over runs of single floats, which the
+ * compiler can vectorize.
+ */
+template <int STATS, int FORMAT>
+inline void ssplat_deposit_row( const SplatPaintContext& ctx, 
+				const long offset, const gColor& clr,
+				const float* weights, const double scale,
+				const int n, SplatPaintStats& stats )
+{
+  if (FORMAT==SPF_DENSITY && !STATS && ctx.additive) {
+    float* d= ctx.density + offset;
+    float alpha= clr.a();
+    for (int i=0; i<n; i++) {
+      float a= alpha*(float)(scale*weights[i]);
+      a= (a>=0.0f) ? a : 0.0f;
+      a= (a<=1.0f) ? a : 1.0f;
+      d[i] += a;
+    }
+  }
+  else if (FORMAT==SPF_PLANAR && !STATS && ctx.additive) {
+    float* r= ctx.planes + offset;
+    float* g= r + ctx.plane_size;
+    float* b= g + ctx.plane_size;
+    float* d= b + ctx.plane_size;
+    float red= clr.r();
+    float green= clr.g();
+    float blue= clr.b();
+    float alpha= clr.a();
+    for (int i=0; i<n; i++) {
+      float w= (float)(scale*weights[i]);
+      float a= alpha*w;
+      a= (a>=0.0f) ? a : 0.0f;
+      a= (a<=1.0f) ? a : 1.0f;
+      r[i] += red*w;
+      g[i] += green*w;
+      b[i] += blue*w;
+      d[i] += a;
+    }
+  }
+  else {
+    for (int i=0; i<n; i++)
+      ssplat_deposit<STATS,FORMAT>( ctx, offset+i, clr, scale*weights[i],
+				    stats );
+  }
+}
+
+/* Non-zero if row j from ilo to ihi can be skipped because it is
+ * already opaque.  Statistics describe whole kernels, so nothing is
+ * skipped when they are kept; the image is the same either way.
+ */
+template <int STATS>
+inline int ssplat_row_opaque( const SplatPaintContext& ctx, const int j,
+			      const int ilo, const int ihi )
+{
+  return (!STATS && ctx.opacity && ctx.opacity->row_saturated(j, ilo, ihi));
+}
+
+/* The depth weight for weighted blended transparency, following
+ * McGuire and Bavoil (JCGT 2013), with depth measured from the near
+ * clipping plane.  Nearer splats dominate the blended color.
+ */
+static inline float ssplat_blend_weight( const float z )
+{
+  double near= 1.0 - StarSplatter::depth_fraction( z );
+  double w= 3.0e3*near*near*near;
+  if (w<1.0e-2) w= 1.0e-2;
+  return (float)w;
+}
+
+static inline int ssplat_in_clip( const SplatPaintContext& ctx,
+				  const int i, const int j )
+{
+  return ((i>=ctx.clip.imin) && (i<=ctx.clip.imax)
+	  && (j>=ctx.clip.jmin) && (j<=ctx.clip.jmax));
+}
+
+/* Splats which cover only a pixel or two are spread bilinearly over
+ * the pixels around their centers.
+ */
+template <int STATS, int FORMAT>
+void ssplat_small_splat( const SplatPaintContext& ctx,
+			 const StarSplatter::Splat* splat,
+			 const double splat_limit,
+			 const double energy_scale,
+			 const gColor& scaled_clr,
+			 const int imin, const int imax,
+			 const int jmin, const int jmax,
+			 SplatPaintStats& stats )
+{
+  long pixrunner;
+  int xsize= ctx.xsize;
+  int ysize= ctx.ysize;
+
+  if (splat_limit>0.5) {
+    if (imin==imax) {
+      if (jmin==jmax) {
+        // degenerate splat, happens to fall on 1 pixel
+        if ((imin>=0)&&(imin<xsize)&&(jmin>=0)&&(jmin<ysize)
+	    &&ssplat_in_clip(ctx,imin,jmin)) {
+          pixrunner= (long)jmin*ctx.stride + imin;
+	  ssplat_deposit<STATS,FORMAT>( ctx, pixrunner, scaled_clr,
+					energy_scale, stats );
+        }
+      }
+      else {
+        // 1 pixel in x direction, 2 in y
+        if ((imin>=0)&&(imin<xsize)) {
+          double y_offset= splat->y-(double)jmin;
+          pixrunner= (long)jmin*ctx.stride + imin;
+          if ((jmin>=0)&&(jmin<ysize)&&ssplat_in_clip(ctx,imin,jmin))
+	    ssplat_deposit<STATS,FORMAT>( ctx, pixrunner, scaled_clr,
+					  energy_scale*(1.0-y_offset), 
+					  stats );
+          if ((jmax>=0)&&(jmax<ysize)&&ssplat_in_clip(ctx,imin,jmin+1))
+	    ssplat_deposit<STATS,FORMAT>( ctx, pixrunner+ctx.stride, 
+					  scaled_clr, energy_scale*y_offset,
+					  stats );
+        }
+      }
+    }
+    else {
+      double x_offset= splat->x-(double)imin;
+      if (jmin==jmax) {
+        // 2 pixels in x direction, 1 in y
+        if ((jmin>=0)&&(jmin<ysize)) {
+          pixrunner= (long)jmin*ctx.stride + imin;
+          if ((imin>=0)&&(imin<xsize)&&ssplat_in_clip(ctx,imin,jmin))
+	    ssplat_deposit<STATS,FORMAT>( ctx, pixrunner, scaled_clr,
+					  energy_scale*(1.0-x_offset),
+					  stats );
+          if ((imax>=0)&&(imax<xsize)&&ssplat_in_clip(ctx,imin+1,jmin))
+	    ssplat_deposit<STATS,FORMAT>( ctx, pixrunner+1, scaled_clr,
+					  energy_scale*x_offset, stats );
+        }
+      }
+      else {
+        // Hit all 4 pixels
+        double y_offset= splat->y-(double)jmin;
+        pixrunner= (long)jmin*ctx.stride + imin;
+        if ((jmin>=0)&&(jmin<ysize)) {
+          if ((imin>=0)&&(imin<xsize)&&ssplat_in_clip(ctx,imin,jmin))
+	    ssplat_deposit<STATS,FORMAT>( ctx, pixrunner, scaled_clr,
+					  energy_scale*(1.0-x_offset)
+					  *(1.0-y_offset), stats );
+          if ((imax>=0)&&(imax<xsize)&&ssplat_in_clip(ctx,imin+1,jmin))
+	    ssplat_deposit<STATS,FORMAT>( ctx, pixrunner+1, scaled_clr,
+					  energy_scale*x_offset
+					  *(1.0-y_offset), stats );
+        }
+        if ((jmax>=0)&&(jmax<ysize)) {
+          pixrunner = (long)jmax*ctx.stride + imin;
+          if ((imin>=0)&&(imin<xsize)&&ssplat_in_clip(ctx,imin,jmax))
+	    ssplat_deposit<STATS,FORMAT>( ctx, pixrunner, scaled_clr,
+					  energy_scale*(1.0-x_offset)
+					  *y_offset, stats );
+          if ((imax>=0)&&(imax<xsize)&&ssplat_in_clip(ctx,imin+1,jmax))
+	    ssplat_deposit<STATS,FORMAT>( ctx, pixrunner+1, scaled_clr,
+					  energy_scale*x_offset*y_offset,
+					  stats );
+        }
+      }
+    }
+  }
+  else {
+    // degenerate splat, fits in one pixel
+    if (ssplat_in_clip(ctx,imin,jmin)) {
+      pixrunner= (long)jmin*ctx.stride + imin;
+      ssplat_deposit<STATS,FORMAT>( ctx, pixrunner, scaled_clr, 
+				    energy_scale, stats );
+    }
+  }
+}
+
+template <int STATS, int FORMAT>
+void ssplat_paint_stamp( const SplatPaintContext& ctx,
+			 const StarSplatter::Splat* splat,
+			 const SplatStamp* stamp,
+			 const int i0, const int j0,
+			 SplatPaintStats& stats )
+{
+  gColor scaled_clr= splat->clr;
+  scaled_clr.mult_noclamp( splat->density );
+  double inv_sep_sqr= 1.0/((double)splat->sep_fac*(double)splat->sep_fac);
+
+  int imin= i0 + stamp->imin;
+  int jmin= j0 + stamp->jmin;
+  int ilo= (imin>ctx.clip.imin) ? imin : ctx.clip.imin;
+  int ihi= imin + stamp->width - 1;
+  if (ihi>ctx.clip.imax) ihi= ctx.clip.imax;
+  int jlo= (jmin>ctx.clip.jmin) ? jmin : ctx.clip.jmin;
+  int jhi= jmin + stamp->height - 1;
+  if (jhi>ctx.clip.jmax) jhi= ctx.clip.jmax;
+  for (int j=jlo; j<=jhi; j++) {
+    if (ssplat_row_opaque<STATS>( ctx, j, ilo, ihi )) continue;
+    const float* weight= stamp->weights
+      + (j-jmin)*stamp->width + (ilo-imin);
+    ssplat_deposit_row<STATS,FORMAT>( ctx, (long)j*ctx.stride + ilo, 
+				      scaled_clr, weight, inv_sep_sqr,
+				      ihi-ilo+1, stats );
+  }
+}
+
+/* Paints one splat of a radially symmetric kernel.  Splats covering
+ * many pixels are painted a span of columns at a time; footprints of
+ * SPLAT_RENORM_CUTOFF pixels or fewer are renormalized, or handed to
+ * ssplat_small_splat() if they reach less than a pixel.  Offsets are
+ * computed from the pixel index, so that the result at a pixel does
+ * not depend on the clip rectangle.
+ */
+template <class Kernel, int STATS, int FORMAT>
+void ssplat_paint_kernel( Kernel& kernel, const StarSplatter::Splat* splat,
+			  const SplatPaintContext& ctx,
+			  SplatPaintStats& stats )
+{
+  double sep_fac= splat->sep_fac;
+  gColor scaled_clr= splat->clr;
+  scaled_clr.mult_noclamp( splat->density );
+
+  double splat_limit= kernel.setup( splat );
+  int integrated= kernel.integrated();
+  double reach= integrated ? splat_limit+0.5 : splat_limit;
+
+  int imin= (int)(splat->x-reach+1.0); // ceil
+  int imax= (int)(splat->x+reach); // floor
+  int jmin= (int)(splat->y-reach+1.0); // ceil
+  int jmax= (int)(splat->y+reach); // floor
+
+  if (imin<0) imin= 0;
+  if (imax>=ctx.xsize) imax= ctx.xsize-1;
+  if (jmin<0) jmin= 0;
+  if (jmax>=ctx.ysize) jmax= ctx.ysize-1;
+
+  int maxNSplats= ((imax-imin)+1)*((jmax-jmin)+1);
+  if (integrated || maxNSplats > SPLAT_RENORM_CUTOFF) {
+    int ilo= (imin>ctx.clip.imin) ? imin : ctx.clip.imin;
+    int ihi= (imax<ctx.clip.imax) ? imax : ctx.clip.imax;
+    int jlo= (jmin>ctx.clip.jmin) ? jmin : ctx.clip.jmin;
+    int jhi= (jmax<ctx.clip.jmax) ? jmax : ctx.clip.jmax;
+    float weights[SPLAT_SPAN];
+    for (int ispan=ilo; ispan<=ihi; ispan += SPLAT_SPAN) {
+      int span_hi= ispan+SPLAT_SPAN-1;
+      if (span_hi>ihi) span_hi= ihi;
+      kernel.begin_span( splat, ispan, span_hi-ispan+1 );
+      for (int j=jlo; j<=jhi; j++) {
+	int rlo= ispan;
+	int rhi= span_hi;
+	kernel.row_span( splat, j, rlo, rhi );
+	if (rlo>rhi || ssplat_row_opaque<STATS>( ctx, j, rlo, rhi )) continue;
+	kernel.row( weights, rlo, rhi-rlo+1, j, splat );
+	ssplat_deposit_row<STATS,FORMAT>( ctx, (long)j*ctx.stride + rlo,
+					  scaled_clr, weights, 1.0,
+					  rhi-rlo+1, stats );
+      }
+    }
+  }
+  else if (splat_limit > 1.0) {
+    /* Here we need to renormalize */
+    float samples[SPLAT_RENORM_CUTOFF];
+    int nx= imax-imin+1;
+    double sum= 0.0;
+    kernel.begin_span( splat, imin, nx );
+    for (int j=jmin; j<=jmax; j++) {
+      float* here= samples + (j-jmin)*nx;
+      assert((j-jmin+1)*nx <= SPLAT_RENORM_CUTOFF);
+      kernel.row( here, imin, nx, j, splat );
+      for (int i=0; i<nx; i++) sum += here[i];
+    }
+    double invSum= 1.0/(sum*sep_fac*sep_fac); // sum *should* = 1.0/(sep_fac^2)
+    const float* here= samples;
+    for (int j=jmin; j<=jmax; j++) {
+      long pixrunner= (long)j*ctx.stride + imin;
+      for (int i=imin; i<=imax; i++, pixrunner++, here++) {
+	if (ssplat_in_clip(ctx,i,j))
+	  ssplat_deposit<STATS,FORMAT>( ctx, pixrunner, scaled_clr, 
+					invSum*(*here), stats );
+      }
+    }
+  }
+  else {
+    ssplat_small_splat<STATS,FORMAT>( ctx, splat, splat_limit,
+				      1.0/(sep_fac*sep_fac), scaled_clr,
+				      imin, imax, jmin, jmax, stats );
+  }
+}
+
+template <class Kernel, int STATS, int FORMAT>
+void SplatPainter::paint_batch_with( Kernel& kernel,
+				     const StarSplatter::Splat* splats,
+				     const long n,
+				     SplatPaintContext ctx,
+				     double* krnl_integral,
+				     int* pixels_touched ) const
+{
+  // Stamps are built for the owner's image, not for other frames
+  int use_stamps= Kernel::stamps && stamp_tol>0.0 && stamps->nstamps()
+    && ctx.xsize==owner->image_xsize() && ctx.ysize==owner->image_ysize();
+  for (long isplat=0; isplat<n; isplat++) {
+    const StarSplatter::Splat* splat= splats+isplat;
+    SplatPaintStats stats;
+    stats.krnl_integral= 0.0;
+    stats.pixels_touched= 0;
+    if ((!STATS && ctx.opacity) || ctx.buffer) {
+      SplatPixelRect rect;
+      footprint( splat, rect );
+      if (rect.imin<ctx.clip.imin) rect.imin= ctx.clip.imin;
+      if (rect.imax>ctx.clip.imax) rect.imax= ctx.clip.imax;
+      if (rect.jmin<ctx.clip.jmin) rect.jmin= ctx.clip.jmin;
+      if (rect.jmax>ctx.clip.jmax) rect.jmax= ctx.clip.jmax;
+      // Skip splats lying wholly behind opaque pixels
+      if (!STATS && ctx.opacity && ctx.opacity->saturated( rect )) continue;
+      if (ctx.buffer) ctx.buffer->touch( rect );
+    }
+    if (ctx.reveal) ctx.blend_weight= ssplat_blend_weight( splat->z );
+    const SplatStamp* stamp= NULL;
+    int i0, j0;
+    if (use_stamps) stamp= find_stamp( splat, i0, j0 );
+    if (stamp) 
+      ssplat_paint_stamp<STATS,FORMAT>( ctx, splat, stamp, i0, j0, stats );
+    else kernel.template paint<STATS,FORMAT>( splat, ctx, stats );
+    if (STATS) {
+      krnl_integral[isplat]= stats.krnl_integral;
+      pixels_touched[isplat]= stats.pixels_touched;
+    }
+  }
+}
+
+template <class Kernel>
+void SplatPainter::dispatch_batch( Kernel& kernel,
+				   const StarSplatter::Splat* splats,
+				   const long n,
+				   const SplatPixelRect& clip,
+				   const SplatFrame& frame,
+				   double* krnl_integral,
+				   int* pixels_touched ) const
+{
+  SplatPaintContext ctx;
+  ctx.image= frame.pixels;
+  ctx.density= frame.density;
+  ctx.half_pixels= frame.half_pixels;
+  ctx.planes= frame.planes;
+  ctx.plane_size= (long)frame.xsize*frame.ysize;
+  ctx.xsize= frame.xsize;
+  ctx.ysize= frame.ysize;
+  ctx.stride= frame.xsize;
+  ctx.clip= clip;
+  ctx.additive= additive_flag;
+  ctx.front_to_back= front_to_back_flag;
+  ctx.opacity= front_to_back_flag ? frame.opacity : NULL;
+  ctx.reveal= frame.reveal;
+  ctx.buffer= frame.buffer;
+  ctx.blend_weight= 1.0f;
+  int stats= (krnl_integral && pixels_touched);
+  if (frame.density) {
+    if (stats)
+      paint_batch_with<Kernel,1,SPF_DENSITY>( kernel, splats, n, ctx,
+					      krnl_integral, pixels_touched );
+    else
+      paint_batch_with<Kernel,0,SPF_DENSITY>( kernel, splats, n, ctx, 
+					      NULL, NULL );
+  }
+  else if (frame.half_pixels) {
+    if (stats)
+      paint_batch_with<Kernel,1,SPF_HALF>( kernel, splats, n, ctx,
+					   krnl_integral, pixels_touched );
+    else
+      paint_batch_with<Kernel,0,SPF_HALF>( kernel, splats, n, ctx, 
+					   NULL, NULL );
+  }
+  else if (frame.planes) {
+    if (stats)
+      paint_batch_with<Kernel,1,SPF_PLANAR>( kernel, splats, n, ctx,
+					     krnl_integral, pixels_touched );
+    else
+      paint_batch_with<Kernel,0,SPF_PLANAR>( kernel, splats, n, ctx, 
+					     NULL, NULL );
+  }
+  else {
+    if (stats)
+      paint_batch_with<Kernel,1,SPF_RGBA>( kernel, splats, n, ctx,
+					   krnl_integral, pixels_touched );
+    else
+      paint_batch_with<Kernel,0,SPF_RGBA>( kernel, splats, n, ctx, 
+					   NULL, NULL );
+  }
+}
+
+#endif // INCL_SPLATBATCH
@@ -0,0 +1,175 @@
+/****************************************************************************
+ * splatbucket.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+
+#include "starsplatter.h"
+#include "splatbuffer.h"
+#include "splatbucket.h"
+
+/* Notes-
+ * Records are written and read as raw words, so the files are only
+ * meaningful to the process which wrote them; tmpfile() removes them
+ * when they are closed.  Offsets are computed as off_t, since a bucket
+ * of a large snapshot may well exceed 2GB.  A bucket is split by
+ * reading it back in blocks through a small SplatBuffer.
+ */
+
+// Records buffered per bucket before a block is written
+#define BUCKET_BLOCK_RECORDS 1024
+
+SplatBucketSet::SplatBucketSet( const int nbuckets_in, const float zmin_in,
+				const float zmax_in )
+{
+  n_buckets= (nbuckets_in>0) ? nbuckets_in : 1;
+  zmin= zmin_in;
+  zmax= zmax_in;
+  n_total= 0;
+  buckets= new Bucket[n_buckets];
+  for (int b=0; b<n_buckets; b++) {
+    buckets[b].file= NULL;
+    buckets[b].count= 0;
+    buckets[b].buf= NULL;
+    buckets[b].nbuf= 0;
+  }
+}
+
+SplatBucketSet::~SplatBucketSet()
+{
+  for (int b=0; b<n_buckets; b++) discard(b);
+  delete [] buckets;
+}
+
+int SplatBucketSet::bucket_of( const float z ) const
+{
+  if (!(zmax>zmin)) return 0;
+  int b= (int)(n_buckets*((double)z-zmin)/((double)zmax-zmin));
+  if (b<0) return 0;
+  if (b>=n_buckets) return n_buckets-1;
+  return b;
+}
+
+int SplatBucketSet::flush( const int b )
+{
+  Bucket& bucket= buckets[b];
+  if (!bucket.nbuf) return 1;
+  if (!bucket.file) {
+    bucket.file= tmpfile();
+    if (!bucket.file) {
+      perror("SplatBucketSet: cannot create a bucket file");
+      return 0;
+    }
+  }
+  if (fseeko(bucket.file, 0, SEEK_END)
+      || fwrite(bucket.buf, SplatBuffer::RECORD_WORDS*sizeof(unsigned int),
+		bucket.nbuf, bucket.file) != (size_t)bucket.nbuf) {
+    perror("SplatBucketSet: cannot write a bucket file");
+    return 0;
+  }
+  bucket.nbuf= 0;
+  return 1;
+}
+
+int SplatBucketSet::append( const int b, const unsigned int* rec )
+{
+  Bucket& bucket= buckets[b];
+  if (!bucket.buf) 
+    bucket.buf= new unsigned int[BUCKET_BLOCK_RECORDS
+				 *SplatBuffer::RECORD_WORDS];
+  else if (bucket.nbuf==BUCKET_BLOCK_RECORDS && !flush(b)) return 0;
+  unsigned int* here= bucket.buf + bucket.nbuf*SplatBuffer::RECORD_WORDS;
+  for (int w=0; w<SplatBuffer::RECORD_WORDS; w++) here[w]= rec[w];
+  bucket.nbuf++;
+  bucket.count++;
+  n_total++;
+  return 1;
+}
+
+int SplatBucketSet::add( const SplatBuffer* splats, const long n )
+{
+  unsigned int rec[SplatBuffer::RECORD_WORDS];
+  for (long i=0; i<n; i++) {
+    splats->get_record( i, rec );
+    if (!append( bucket_of(splats->z(i)), rec )) return 0;
+  }
+  return 1;
+}
+
+int SplatBucketSet::load( const int b, const long first, const long n, 
+			  SplatBuffer* splats )
+{
+  if (first<0 || first+n>buckets[b].count) {
+    fprintf(stderr,"SplatBucketSet: bucket %d has no splats %ld to %ld!\n",
+	    b, first, first+n-1);
+    return 0;
+  }
+  if (!flush(b)) return 0;
+  if (!n) return 1;
+  size_t rec_bytes= SplatBuffer::RECORD_WORDS*sizeof(unsigned int);
+  if (fseeko(buckets[b].file, (off_t)first*rec_bytes, SEEK_SET)) {
+    perror("SplatBucketSet: cannot seek in a bucket file");
+    return 0;
+  }
+  unsigned int* block= new unsigned int[BUCKET_BLOCK_RECORDS
+					*SplatBuffer::RECORD_WORDS];
+  for (long done=0; done<n; done += BUCKET_BLOCK_RECORDS) {
+    long nblock= (n-done<BUCKET_BLOCK_RECORDS) ? n-done : BUCKET_BLOCK_RECORDS;
+    if (fread(block, rec_bytes, nblock, buckets[b].file) != (size_t)nblock) {
+      perror("SplatBucketSet: cannot read a bucket file");
+      delete [] block;
+      return 0;
+    }
+    for (long i=0; i<nblock; i++)
+      splats->set_record( done+i, block+i*SplatBuffer::RECORD_WORDS );
+  }
+  delete [] block;
+  return 1;
+}
+
+SplatBucketSet* SplatBucketSet::split( const int b, const int nparts )
+{
+  float width= ((double)zmax-zmin)/n_buckets;
+  SplatBucketSet* parts= new SplatBucketSet( nparts, zmin + b*width,
+					     zmin + (b+1)*width );
+  SplatBuffer block;
+  block.reserve(BUCKET_BLOCK_RECORDS);
+  long n= buckets[b].count;
+  for (long first=0; first<n; first += BUCKET_BLOCK_RECORDS) {
+    long nblock= (n-first<BUCKET_BLOCK_RECORDS) ? 
+      n-first : BUCKET_BLOCK_RECORDS;
+    if (!load( b, first, nblock, &block ) || !parts->add( &block, nblock )) {
+      delete parts;
+      return NULL;
+    }
+  }
+  discard(b);
+  return parts;
+}
+
+void SplatBucketSet::discard( const int b )
+{
+  Bucket& bucket= buckets[b];
+  if (bucket.file) fclose(bucket.file);
+  bucket.file= NULL;
+  delete [] bucket.buf;
+  bucket.buf= NULL;
+  n_total -= bucket.count;
+  bucket.count= 0;
+  bucket.nbuf= 0;
+}
@@ -0,0 +1,66 @@
+/****************************************************************************
+ * splatbucket.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATBUCKET
+#define INCL_SPLATBUCKET
+
+class SplatBuffer;
+
+/* A SplatBucketSet spills splats to temporary files, partitioned by
+ * screen depth into buckets of equal depth range.  Each bucket buffers
+ * a few records in memory and writes them out in blocks.  The files
+ * are removed when the set is deleted or the bucket discarded.  Buckets
+ * are numbered from the far end of the depth range.
+ */
+class SplatBucketSet {
+ public:
+  SplatBucketSet( const int nbuckets_in, const float zmin_in, 
+		  const float zmax_in );
+  ~SplatBucketSet();
+  int nbuckets() const { return n_buckets; }
+  long size() const { return n_total; }
+  long bucket_size( const int b ) const { return buckets[b].count; }
+  // Appends the n splats in splats to their buckets; returns 0 on failure
+  int add( const SplatBuffer* splats, const long n );
+  // Loads n splats of bucket b, starting with splat first, into the
+  // first n places of splats; returns 0 on failure
+  int load( const int b, const long first, const long n, 
+	    SplatBuffer* splats );
+  // Spills bucket b into a new set over its depth range, discarding
+  // it here; returns NULL on failure
+  SplatBucketSet* split( const int b, const int nparts );
+  // Closes bucket b, freeing its file
+  void discard( const int b );
+ private:
+  struct Bucket {
+    FILE* file; // NULL until the first block is written
+    long count; // records, both written and buffered
+    unsigned int* buf;
+    int nbuf; // records buffered
+  };
+  int n_buckets;
+  float zmin;
+  float zmax;
+  long n_total;
+  Bucket* buckets;
+  int bucket_of( const float z ) const;
+  int append( const int b, const unsigned int* rec );
+  int flush( const int b );
+};
+
+#endif // INCL_SPLATBUCKET
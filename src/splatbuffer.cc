@@ -0,0 +1,87 @@
+/****************************************************************************
+ * splatbuffer.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "starsplatter.h"
+#include "splatbuffer.h"
+#include "threadteam.h"
+
+/* Notes-
+ */
+
+SplatBuffer::SplatBuffer()
+{
+  for (int f=0; f<F_NFIELDS; f++) field[f]= NULL;
+  scratch= NULL;
+  n_splats= 0;
+  n_alloc= 0;
+}
+
+SplatBuffer::~SplatBuffer()
+{
+  for (int f=0; f<F_NFIELDS; f++) delete [] field[f];
+  delete [] scratch;
+}
+
+void SplatBuffer::reserve( const long n )
+{
+  if (n<=n_alloc) return;
+  for (int f=0; f<F_NFIELDS; f++) {
+    delete [] field[f];
+    field[f]= new unsigned int[n];
+  }
+  delete [] scratch;
+  scratch= new unsigned int[n];
+  n_alloc= n;
+  n_splats= 0;
+}
+
+struct SplatPermuteJob {
+  const unsigned long long* recs;
+  const unsigned int* src;
+  unsigned int* dst;
+  long n;
+  int nchunks;
+};
+
+static void splat_permute_task( void* arg, const int chunk,
+				const int thread )
+{
+  SplatPermuteJob* job= (SplatPermuteJob*)arg;
+  long first= (chunk*job->n)/job->nchunks;
+  long last= ((chunk+1)*job->n)/job->nchunks;
+  for (long i=first; i<last; i++)
+    job->dst[i]= job->src[job->recs[i] & 0xFFFFFFFFULL];
+}
+
+void SplatBuffer::permute( const unsigned long long* recs, ThreadTeam& team )
+{
+  SplatPermuteJob job;
+  job.recs= recs;
+  job.n= n_splats;
+  job.nchunks= team.nthreads();
+  for (int f=0; f<F_NFIELDS; f++) {
+    job.src= field[f];
+    job.dst= scratch;
+    team.run( splat_permute_task, &job, job.nchunks );
+    // The permuted copy becomes the field, and the old field the scratch
+    scratch= field[f];
+    field[f]= job.dst;
+  }
+}
@@ -0,0 +1,141 @@
+/****************************************************************************
+ * splatbuffer.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATBUFFER
+#define INCL_SPLATBUFFER
+
+class ThreadTeam;
+
+/* Conversions between float and IEEE half precision.  Halves are used
+ * to store splat colors, which are well within their range.
+ */
+inline unsigned short ssplat_float_to_half( const float val )
+{
+  union { float f; unsigned int u; } f, f16max, denorm_magic;
+  f.f= val;
+  f16max.u= (127+16)<<23;
+  denorm_magic.u= ((127-15)+(23-10)+1)<<23;
+  unsigned int sign= f.u & 0x80000000u;
+  unsigned int result;
+  f.u ^= sign;
+  if (f.u >= f16max.u) // Inf or NaN
+    result= (f.u > 0x7f800000u) ? 0x7e00 : 0x7c00;
+  else if (f.u < (113u<<23)) { // zero or subnormal
+    f.f += denorm_magic.f;
+    result= f.u - denorm_magic.u;
+  }
+  else { // round to nearest even
+    unsigned int mant_odd= (f.u>>13) & 1;
+    f.u += (((unsigned int)(15-127))<<23) + 0xfff + mant_odd;
+    result= f.u>>13;
+  }
+  return (unsigned short)(result | (sign>>16));
+}
+
+inline float ssplat_half_to_float( const unsigned short h )
+{
+  union { float f; unsigned int u; } o, magic;
+  magic.u= 113<<23;
+  o.u= (h & 0x7fffu)<<13;
+  unsigned int exp= o.u & 0x0f800000u;
+  o.u += (127-15)<<23;
+  if (exp==0x0f800000u) o.u += (128-16)<<23; // Inf or NaN
+  else if (exp==0) { // zero or subnormal
+    o.u += 1<<23;
+    o.f -= magic.f;
+  }
+  o.u |= (h & 0x8000u)<<16;
+  return o.f;
+}
+
+/* A SplatBuffer holds the transformed splats of one frame as a
+ * structure of arrays, 32 bytes per splat.  Every field is a 32 bit
+ * word, so the depth sort can permute the fields one at a time through
+ * a single scratch array.  The color is stored as four halves in two
+ * words.  get() unpacks a splat into a StarSplatter::Splat for the
+ * painters.
+ */
+class SplatBuffer {
+ public:
+  SplatBuffer();
+  ~SplatBuffer();
+  long size() const { return n_splats; }
+  long capacity() const { return n_alloc; }
+  void reserve( const long n ); // contents are lost if the buffer grows
+  void set_size( const long n ) { n_splats= n; }
+  void set( const long i, const float x, const float y, const float z,
+	    const float sqrt_exp_constant, const float sep_fac,
+	    const float density, const gColor& clr )
+  {
+    field[F_X][i]= word(x);
+    field[F_Y][i]= word(y);
+    field[F_Z][i]= word(z);
+    field[F_SQRT_EXP_CONSTANT][i]= word(sqrt_exp_constant);
+    field[F_SEP_FAC][i]= word(sep_fac);
+    field[F_DENSITY][i]= word(density);
+    field[F_CLR_RG][i]= ssplat_float_to_half(clr.r())
+      | (((unsigned int)ssplat_float_to_half(clr.g()))<<16);
+    field[F_CLR_BA][i]= ssplat_float_to_half(clr.b())
+      | (((unsigned int)ssplat_float_to_half(clr.a()))<<16);
+  }
+  float x( const long i ) const { return real(field[F_X][i]); }
+  float y( const long i ) const { return real(field[F_Y][i]); }
+  float z( const long i ) const { return real(field[F_Z][i]); }
+  gColor clr( const long i ) const
+  {
+    unsigned int rg= field[F_CLR_RG][i];
+    unsigned int ba= field[F_CLR_BA][i];
+    return gColor( ssplat_half_to_float(rg & 0xffff),
+		   ssplat_half_to_float(rg>>16),
+		   ssplat_half_to_float(ba & 0xffff),
+		   ssplat_half_to_float(ba>>16) );
+  }
+  void get( const long i, StarSplatter::Splat& s ) const
+  {
+    s.x= real(field[F_X][i]);
+    s.y= real(field[F_Y][i]);
+    s.z= real(field[F_Z][i]);
+    s.sqrt_exp_constant= real(field[F_SQRT_EXP_CONSTANT][i]);
+    s.sep_fac= real(field[F_SEP_FAC][i]);
+    s.density= real(field[F_DENSITY][i]);
+    s.clr= clr(i);
+  }
+  // Reorders the splats so that splat i comes from the splat indexed
+  // by the low 32 bits of recs[i].
+  void permute( const unsigned long long* recs, ThreadTeam& team );
+  // A splat packed as RECORD_WORDS words, one per field, as for 
+  // spilling splats to a file
+  enum { RECORD_WORDS= 8 };
+  void get_record( const long i, unsigned int* rec ) const
+  { for (int f=0; f<F_NFIELDS; f++) rec[f]= field[f][i]; }
+  void set_record( const long i, const unsigned int* rec )
+  { for (int f=0; f<F_NFIELDS; f++) field[f][i]= rec[f]; }
+ private:
+  enum Field { F_X, F_Y, F_Z, F_SQRT_EXP_CONSTANT, F_SEP_FAC, F_DENSITY,
+	       F_CLR_RG, F_CLR_BA, F_NFIELDS };
+  static unsigned int word( const float val )
+  { union { float f; unsigned int u; } v; v.f= val; return v.u; }
+  static float real( const unsigned int val )
+  { union { float f; unsigned int u; } v; v.u= val; return v.f; }
+  unsigned int* field[F_NFIELDS];
+  unsigned int* scratch;
+  long n_splats;
+  long n_alloc;
+};
+
+#endif // INCL_SPLATBUFFER
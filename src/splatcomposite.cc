@@ -0,0 +1,207 @@
+/****************************************************************************
+ * splatcomposite.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "geometry.h"
+#include "splatcomposite.h"
+
+/* Notes-
+ * The shared block is the control structure, padded to a multiple of
+ * 64 bytes, followed by the images and then the revealage buffers.
+ * Anonymous shared mappings are zero filled, which is transparent black
+ * for the images.  Rank r keeps the lower half of each split if bit s
+ * of r is clear in round s, so the piece a rank holds after some
+ * rounds depends only on its rank, and the gathering process can find
+ * the pieces without asking.
+ */
+
+void ssplat_composite( gColor* dst, float* dst_reveal, 
+		       const gColor* src, const float* src_reveal,
+		       const long n, const SplatCompositeOp op,
+		       const int src_on_top )
+{
+  switch (op) {
+  case SC_ADD:
+    for (long p=0; p<n; p++) dst[p].add_noclamp( src[p] );
+    break;
+  case SC_OVER:
+    if (src_on_top) {
+      for (long p=0; p<n; p++) {
+	gColor tmp= src[p];
+	tmp.add_under( dst[p] );
+	dst[p]= tmp;
+      }
+    }
+    else for (long p=0; p<n; p++) dst[p].add_under( src[p] );
+    break;
+  case SC_BLEND:
+    for (long p=0; p<n; p++) dst[p].add_noclamp( src[p] );
+    if (dst_reveal && src_reveal)
+      for (long p=0; p<n; p++) dst_reveal[p] *= src_reveal[p];
+    break;
+  }
+}
+
+void ssplat_composite_density( float* dst, const float* src, const long n,
+			       const SplatCompositeOp op, 
+			       const int src_on_top )
+{
+  // These follow the alpha channel of the gColor operations
+  if (op==SC_OVER) {
+    if (src_on_top) 
+      for (long p=0; p<n; p++) dst[p]= src[p] + dst[p] - (src[p]*dst[p]);
+    else for (long p=0; p<n; p++) dst[p]= dst[p] + src[p] - (dst[p]*src[p]);
+  }
+  else for (long p=0; p<n; p++) dst[p] += src[p];
+}
+
+SplatSwapCompositor::SplatSwapCompositor( const int nranks_in, 
+					  const long npix_in,
+					  const SplatCompositeOp op_in, 
+					  const int later_on_top,
+					  const int with_reveal )
+{
+  n_ranks= nranks_in;
+  npix= npix_in;
+  op= op_in;
+  later_top= later_on_top;
+  map= NULL;
+  shared= NULL;
+  frames= NULL;
+  reveals= NULL;
+
+  long header_size= sizeof(Shared) + (n_ranks-1)*sizeof(int);
+  header_size= 64*((header_size+63)/64);
+  map_size= header_size + (long)n_ranks*npix*sizeof(gColor);
+  if (with_reveal) map_size += (long)n_ranks*npix*sizeof(float);
+  void* addr= mmap(NULL, map_size, PROT_READ|PROT_WRITE, 
+		   MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+  if (addr==MAP_FAILED) {
+    fprintf(stderr,
+	    "SplatSwapCompositor: cannot map %ld bytes of shared memory!\n",
+	    map_size);
+    return;
+  }
+  map= addr;
+  frames= (gColor*)((char*)map + header_size);
+  if (with_reveal) {
+    reveals= (float*)(frames + (long)n_ranks*npix);
+    for (long p=0; p<(long)n_ranks*npix; p++) reveals[p]= 1.0f;
+  }
+
+  Shared* s= (Shared*)map;
+  pthread_mutexattr_t mattr;
+  pthread_mutexattr_init(&mattr);
+  pthread_mutexattr_setpshared(&mattr, PTHREAD_PROCESS_SHARED);
+  pthread_condattr_t cattr;
+  pthread_condattr_init(&cattr);
+  pthread_condattr_setpshared(&cattr, PTHREAD_PROCESS_SHARED);
+  if (pthread_mutex_init(&(s->lock), &mattr)) {
+    fprintf(stderr,"SplatSwapCompositor: cannot share a mutex!\n");
+  }
+  else if (pthread_cond_init(&(s->cond), &cattr)) {
+    fprintf(stderr,"SplatSwapCompositor: cannot share a condition!\n");
+    pthread_mutex_destroy(&(s->lock));
+  }
+  else shared= s; // the map is zero filled, so nothing is done yet
+  pthread_mutexattr_destroy(&mattr);
+  pthread_condattr_destroy(&cattr);
+}
+
+SplatSwapCompositor::~SplatSwapCompositor()
+{
+  if (shared) {
+    pthread_cond_destroy(&(shared->cond));
+    pthread_mutex_destroy(&(shared->lock));
+  }
+  if (map) munmap(map, map_size);
+}
+
+void SplatSwapCompositor::piece( const int rank, const int rounds,
+				 long& first, long& count ) const
+{
+  first= 0;
+  count= npix;
+  for (int s=0; s<rounds; s++) {
+    long half= count/2;
+    if (rank & (1<<s)) {
+      first += half;
+      count -= half;
+    }
+    else count= half;
+  }
+}
+
+int SplatSwapCompositor::exchange( const int rank )
+{
+  pthread_mutex_lock(&(shared->lock));
+  shared->progress[rank]= 1;
+  pthread_cond_broadcast(&(shared->cond));
+  pthread_mutex_unlock(&(shared->lock));
+
+  for (int s=0; (1<<s)<n_ranks; s++) {
+    int partner= rank ^ (1<<s);
+    pthread_mutex_lock(&(shared->lock));
+    while (shared->progress[partner]<s+1 && !shared->failed)
+      pthread_cond_wait(&(shared->cond), &(shared->lock));
+    int failed= shared->failed;
+    pthread_mutex_unlock(&(shared->lock));
+    if (failed) return 0;
+
+    long first;
+    long count;
+    piece( rank, s+1, first, count );
+    ssplat_composite( pixels(rank)+first, 
+		      (reveals) ? reveal(rank)+first : NULL,
+		      pixels(partner)+first, 
+		      (reveals) ? reveal(partner)+first : NULL,
+		      count, op, ((partner>rank)==later_top) );
+
+    pthread_mutex_lock(&(shared->lock));
+    shared->progress[rank]= s+2;
+    pthread_cond_broadcast(&(shared->cond));
+    pthread_mutex_unlock(&(shared->lock));
+  }
+  return 1;
+}
+
+void SplatSwapCompositor::fail()
+{
+  pthread_mutex_lock(&(shared->lock));
+  shared->failed= 1;
+  pthread_cond_broadcast(&(shared->cond));
+  pthread_mutex_unlock(&(shared->lock));
+}
+
+void SplatSwapCompositor::gather( gColor* image, float* image_reveal ) const
+{
+  int rounds= 0;
+  while ((1<<rounds)<n_ranks) rounds++;
+  for (int rank=0; rank<n_ranks; rank++) {
+    long first;
+    long count;
+    piece( rank, rounds, first, count );
+    ssplat_composite( image+first, (image_reveal) ? image_reveal+first : NULL,
+		      pixels(rank)+first, 
+		      (reveals) ? reveal(rank)+first : NULL,
+		      count, op, 1 );
+  }
+}
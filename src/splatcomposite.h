@@ -0,0 +1,97 @@
+/****************************************************************************
+ * splatcomposite.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATCOMPOSITE
+#define INCL_SPLATCOMPOSITE
+
+#include <pthread.h>
+
+/* Images painted from consecutive depth ranges of the sorted splats
+ * combine into the image of all of them by the operator of the
+ * compositing mode.  Additive images are summed.  Premultiplied colors
+ * combine by the over operator, which is associative, so the images
+ * may be combined in any grouping as long as the nearer of each pair
+ * goes on top.  Weighted blended images sum their colors and weights
+ * and multiply their revealage.
+ */
+enum SplatCompositeOp { SC_ADD, SC_OVER, SC_BLEND };
+
+// Combines n pixels of src into dst, which may both carry revealage
+// for SC_BLEND.  If src_on_top, src is nearer than dst.
+extern void ssplat_composite( gColor* dst, float* dst_reveal, 
+			      const gColor* src, const float* src_reveal,
+			      const long n, const SplatCompositeOp op,
+			      const int src_on_top );
+// The same for density images, which have no revealage
+extern void ssplat_composite_density( float* dst, const float* src,
+				      const long n, const SplatCompositeOp op,
+				      const int src_on_top );
+
+/* A SplatSwapCompositor holds one float image per rank in memory shared
+ * between processes, so that ranks forked after it is built can paint
+ * their depth ranges in parallel and combine the results by binary
+ * swap.  In each round every rank pairs with the rank whose number
+ * differs in one bit, and each of the pair combines half of the pixels
+ * the two still share, so after log2(nranks) rounds each rank holds the
+ * finished image for 1/nranks of the pixels.  Rank r paints the r'th
+ * depth range in painting order; if later_on_top, later ranges are
+ * nearer, as for back to front painting.
+ */
+class SplatSwapCompositor {
+ public:
+  // nranks must be a power of two
+  SplatSwapCompositor( const int nranks_in, const long npix_in,
+		       const SplatCompositeOp op_in, const int later_on_top,
+		       const int with_reveal );
+  ~SplatSwapCompositor();
+  int valid() const { return (shared!=NULL); }
+  int nranks() const { return n_ranks; }
+  // A rank's image starts transparent black, with revealage 1.0
+  gColor* pixels( const int rank ) const 
+  { return frames + (long)rank*npix; }
+  float* reveal( const int rank ) const
+  { return (reveals) ? reveals + (long)rank*npix : NULL; }
+  // Called by each rank once its image is painted, to combine it with
+  // the others.  Returns 0 if some rank failed.
+  int exchange( const int rank );
+  // Releases ranks waiting on one which will never arrive
+  void fail();
+  // Combines the finished pixels of every rank over image and reveal,
+  // which may be NULL
+  void gather( gColor* image, float* image_reveal ) const;
+ private:
+  struct Shared {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int failed;
+    int progress[1]; // really nranks; rounds done, plus 1 once painted
+  };
+  void piece( const int rank, const int rounds, long& first, 
+	      long& count ) const;
+  int n_ranks;
+  long npix;
+  SplatCompositeOp op;
+  int later_top;
+  void* map;
+  long map_size;
+  Shared* shared;
+  gColor* frames;
+  float* reveals;
+};
+
+#endif // INCL_SPLATCOMPOSITE
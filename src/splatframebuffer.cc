@@ -0,0 +1,175 @@
+/****************************************************************************
+ * splatframebuffer.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <sys/mman.h>
+
+#include "starsplatter.h"
+#include "splatpainter.h"
+#include "splatframebuffer.h"
+
+/* Notes-
+ * The pixels are a private anonymous mapping, which the system fills
+ * with zeros a page at a time as the pages are first written; all-zero
+ * bytes are a transparent black gColor.  The painters address pixels
+ * by row, so a page is a run of one row rather than a whole tile, but
+ * rows of the empty parts of an image are never written, and so never
+ * take memory.  MAP_NORESERVE keeps a large image from being refused
+ * for memory it will never use.  All-zero bytes are also zero in the
+ * other formats, so they are mapped the same way.  Planar pixels are
+ * four planes of xsize*ysize floats, one per channel, so a row of a
+ * planar tile is four runs of memory, each a quarter as long.
+ */
+
+#ifndef MAP_NORESERVE
+#define MAP_NORESERVE 0
+#endif
+
+long SplatFramebuffer::bytes_per_pixel( const int format )
+{
+  switch (format) {
+  case SPF_DENSITY: return sizeof(float);
+  case SPF_HALF: return 4*sizeof(unsigned short);
+  case SPF_PLANAR: return 4*sizeof(float);
+  default: return sizeof(gColor);
+  }
+}
+
+SplatFramebuffer::SplatFramebuffer( const int xsize_in, const int ysize_in,
+				    const int format_in )
+{
+  x_size= xsize_in;
+  y_size= ysize_in;
+  n_tiles_x= (x_size+FRAMEBUFFER_TILE_SIZE-1)/FRAMEBUFFER_TILE_SIZE;
+  n_tiles_y= (y_size+FRAMEBUFFER_TILE_SIZE-1)/FRAMEBUFFER_TILE_SIZE;
+  tile_flags= new unsigned char[n_tiles_x*n_tiles_y];
+  for (int tile=0; tile<n_tiles_x*n_tiles_y; tile++) tile_flags[tile]= 0;
+  fmt= format_in;
+  buf= NULL;
+  map_size= (long)x_size*y_size*bytes_per_pixel(fmt);
+  if (map_size<=0) map_size= 1;
+  void* addr= mmap(NULL, map_size, PROT_READ|PROT_WRITE,
+		   MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+  if (addr==MAP_FAILED) {
+    fprintf(stderr,"SplatFramebuffer: cannot map %ld bytes!\n",map_size);
+    map_size= 0;
+    return;
+  }
+  buf= addr;
+}
+
+SplatFramebuffer::SplatFramebuffer( const int xsize_in, const int ysize_in,
+				    gColor* pixels_in )
+{
+  x_size= xsize_in;
+  y_size= ysize_in;
+  n_tiles_x= (x_size+FRAMEBUFFER_TILE_SIZE-1)/FRAMEBUFFER_TILE_SIZE;
+  n_tiles_y= (y_size+FRAMEBUFFER_TILE_SIZE-1)/FRAMEBUFFER_TILE_SIZE;
+  tile_flags= new unsigned char[n_tiles_x*n_tiles_y];
+  fmt= SPF_RGBA;
+  buf= pixels_in;
+  map_size= 0;
+  touch_all();
+}
+
+SplatFramebuffer::~SplatFramebuffer()
+{
+  if (map_size) munmap(buf, map_size);
+  delete [] tile_flags;
+}
+
+void SplatFramebuffer::composite( const SplatFramebuffer* src, 
+				  const long first, const long n, 
+				  const SplatCompositeOp op, 
+				  const int src_on_top )
+{
+  if (fmt==SPF_RGBA && src->fmt==SPF_RGBA)
+    ssplat_composite( pixels()+first, NULL, src->pixels()+first, NULL, n,
+		      op, src_on_top );
+  else if (fmt==SPF_DENSITY && src->fmt==SPF_DENSITY)
+    ssplat_composite_density( density()+first, src->density()+first, n,
+			      op, src_on_top );
+  else if (fmt==SPF_PLANAR && src->fmt==SPF_PLANAR && op!=SC_OVER) {
+    // Sums go plane by plane
+    long npix= (long)x_size*y_size;
+    for (int c=0; c<4; c++) {
+      float* dst_plane= planes() + c*npix + first;
+      const float* src_plane= src->planes() + c*npix + first;
+      for (long p=0; p<n; p++) dst_plane[p] += src_plane[p];
+    }
+  }
+  else {
+    for (long p=first; p<first+n; p++) {
+      gColor dst_clr= pixel(p);
+      gColor src_clr= src->pixel(p);
+      ssplat_composite( &dst_clr, NULL, &src_clr, NULL, 1, op, src_on_top );
+      set_pixel( p, dst_clr );
+    }
+  }
+}
+
+void SplatFramebuffer::get_frame( SplatFrame& frame )
+{
+  frame.pixels= pixels();
+  frame.density= density();
+  frame.half_pixels= half_pixels();
+  frame.planes= planes();
+  frame.xsize= x_size;
+  frame.ysize= y_size;
+  frame.opacity= NULL;
+  frame.reveal= NULL;
+  frame.buffer= this;
+}
+
+void SplatFramebuffer::touch( const SplatPixelRect& rect )
+{
+  if (rect.imin>rect.imax || rect.jmin>rect.jmax) return;
+  int txmin= rect.imin/FRAMEBUFFER_TILE_SIZE;
+  int txmax= rect.imax/FRAMEBUFFER_TILE_SIZE;
+  int tymin= rect.jmin/FRAMEBUFFER_TILE_SIZE;
+  int tymax= rect.jmax/FRAMEBUFFER_TILE_SIZE;
+  for (int ty=tymin; ty<=tymax; ty++) {
+    unsigned char* flags= tile_flags + ty*n_tiles_x;
+    // Reading first keeps threads from contending for set flags
+    for (int tx=txmin; tx<=txmax; tx++) if (!flags[tx]) flags[tx]= 1;
+  }
+}
+
+void SplatFramebuffer::touch_all()
+{
+  for (int tile=0; tile<n_tiles_x*n_tiles_y; tile++) tile_flags[tile]= 1;
+}
+
+void SplatFramebuffer::tile_rect( const int tile, SplatPixelRect& rect ) const
+{
+  rect.imin= (tile % n_tiles_x)*FRAMEBUFFER_TILE_SIZE;
+  rect.imax= rect.imin + FRAMEBUFFER_TILE_SIZE - 1;
+  if (rect.imax>=x_size) rect.imax= x_size-1;
+  rect.jmin= (tile / n_tiles_x)*FRAMEBUFFER_TILE_SIZE;
+  rect.jmax= rect.jmin + FRAMEBUFFER_TILE_SIZE - 1;
+  if (rect.jmax>=y_size) rect.jmax= y_size-1;
+}
+
+int SplatFramebuffer::ntouched() const
+{
+  int count= 0;
+  for (int tile=0; tile<n_tiles_x*n_tiles_y; tile++) 
+    if (tile_flags[tile]) count++;
+  return count;
+}
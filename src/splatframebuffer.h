@@ -0,0 +1,174 @@
+/****************************************************************************
+ * splatframebuffer.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATFRAMEBUFFER
+#define INCL_SPLATFRAMEBUFFER
+
+#include "splatpainter.h"
+#include "splatbuffer.h"
+#include "splatcomposite.h"
+
+/* Tiles of the framebuffer are square, this many pixels across */
+#define FRAMEBUFFER_TILE_SIZE 64
+
+/* Half precision pixels are four halves, in the order r, g, b, a */
+// Pixels saturate at the largest finite half rather than becoming Inf,
+// which would blacken every auto-scaled exposure
+inline unsigned short ssplat_float_to_half_sat( const float val )
+{
+  if (val>65504.0f) return 0x7bff;
+  if (val<-65504.0f) return 0xfbff;
+  return ssplat_float_to_half( val );
+}
+
+inline gColor ssplat_half_pixel( const unsigned short* h )
+{
+  return gColor( ssplat_half_to_float(h[0]), ssplat_half_to_float(h[1]),
+		 ssplat_half_to_float(h[2]), ssplat_half_to_float(h[3]) );
+}
+
+inline void ssplat_set_half_pixel( unsigned short* h, const gColor& clr )
+{
+  h[0]= ssplat_float_to_half_sat(clr.r());
+  h[1]= ssplat_float_to_half_sat(clr.g());
+  h[2]= ssplat_float_to_half_sat(clr.b());
+  h[3]= ssplat_float_to_half_sat(clr.a());
+}
+
+/* A SplatFramebuffer is the floating point image splats are painted 
+ * into.  Its pixels are laid out like any other frame's, but memory
+ * for them is only committed as they are first written, and a flag
+ * per tile records which tiles may have been written.  Tiles which
+ * have not are transparent black, so that reductions and exposure
+ * conversion can skip them without reading them.  Flags are only ever
+ * set, so threads painting separate parts of the image may share a
+ * framebuffer.  The pixels may be stored in any SplatPixelFormat; 
+ * a density framebuffer holds the alpha the pixel would have in
+ * color, for exposure types which look only at alpha.
+ */
+class SplatFramebuffer {
+ public:
+  // Creates a transparent black framebuffer
+  SplatFramebuffer( const int xsize_in, const int ysize_in,
+		    const int format_in=SPF_RGBA );
+  // Wraps pixels belonging to the caller, all of which count as touched
+  SplatFramebuffer( const int xsize_in, const int ysize_in, 
+		    gColor* pixels_in );
+  ~SplatFramebuffer();
+  static long bytes_per_pixel( const int format );
+  int valid() const { return (buf!=NULL); }
+  int format() const { return fmt; }
+  // The pixels, for the given format, or NULL
+  gColor* pixels() const 
+  { return (fmt==SPF_RGBA) ? (gColor*)buf : NULL; }
+  float* density() const 
+  { return (fmt==SPF_DENSITY) ? (float*)buf : NULL; }
+  unsigned short* half_pixels() const 
+  { return (fmt==SPF_HALF) ? (unsigned short*)buf : NULL; }
+  float* planes() const 
+  { return (fmt==SPF_PLANAR) ? (float*)buf : NULL; }
+  // Pixel p as a color, whatever the format; densities are returned
+  // in alpha
+  gColor pixel( const long p ) const
+  {
+    switch (fmt) {
+    case SPF_DENSITY: return gColor(0.0,0.0,0.0,((float*)buf)[p]);
+    case SPF_HALF: return ssplat_half_pixel( (unsigned short*)buf + 4*p );
+    case SPF_PLANAR: 
+      {
+	const float* plane= (float*)buf + p;
+	long n= (long)x_size*y_size;
+	return gColor( plane[0], plane[n], plane[2*n], plane[3*n] );
+      }
+    default: return ((gColor*)buf)[p];
+    }
+  }
+  // Sets pixel p, which should be in a touched tile; a density
+  // framebuffer keeps only alpha
+  void set_pixel( const long p, const gColor& clr )
+  {
+    switch (fmt) {
+    case SPF_DENSITY: ((float*)buf)[p]= clr.a(); break;
+    case SPF_HALF: ssplat_set_half_pixel( (unsigned short*)buf + 4*p, clr );
+      break;
+    case SPF_PLANAR:
+      {
+	float* plane= (float*)buf + p;
+	long n= (long)x_size*y_size;
+	plane[0]= clr.r();
+	plane[n]= clr.g();
+	plane[2*n]= clr.b();
+	plane[3*n]= clr.a();
+      }
+      break;
+    default: ((gColor*)buf)[p]= clr;
+    }
+  }
+  void add_pixel( const long p, const gColor& clr )
+  {
+    if (fmt==SPF_RGBA) ((gColor*)buf)[p].add_noclamp( clr );
+    else if (fmt==SPF_DENSITY) ((float*)buf)[p] += clr.a();
+    else {
+      gColor sum= pixel(p);
+      sum.add_noclamp( clr );
+      set_pixel( p, sum );
+    }
+  }
+  // Combines n pixels of src, starting at pixel first, into the same
+  // pixels of this framebuffer, as ssplat_composite() does.  The
+  // formats need not match.
+  void composite( const SplatFramebuffer* src, const long first, 
+		  const long n, const SplatCompositeOp op, 
+		  const int src_on_top );
+  // Sets up a frame to paint the whole framebuffer, with no opacity 
+  // map or revealage
+  void get_frame( SplatFrame& frame );
+  int xsize() const { return x_size; }
+  int ysize() const { return y_size; }
+  int ntiles_x() const { return n_tiles_x; }
+  int ntiles_y() const { return n_tiles_y; }
+  int ntiles() const { return n_tiles_x*n_tiles_y; }
+  // The tile holding pixel (i,j)
+  int tile_of( const int i, const int j ) const
+  { return (j/FRAMEBUFFER_TILE_SIZE)*n_tiles_x + i/FRAMEBUFFER_TILE_SIZE; }
+  // Non-zero if the tile may hold pixels other than transparent black
+  int touched( const int tile ) const { return tile_flags[tile]; }
+  // Records that pixels in the rectangle, which may be empty, are
+  // about to be written
+  void touch( const SplatPixelRect& rect );
+  void touch_pixel( const int i, const int j )
+  { 
+    int tile= tile_of(i,j);
+    if (!tile_flags[tile]) tile_flags[tile]= 1; 
+  }
+  void touch_all();
+  // The pixels of a tile, clipped to the image
+  void tile_rect( const int tile, SplatPixelRect& rect ) const;
+  int ntouched() const;
+ private:
+  int x_size;
+  int y_size;
+  int n_tiles_x;
+  int n_tiles_y;
+  int fmt;
+  void* buf;
+  long map_size; // or 0 if the pixels belong to the caller
+  unsigned char* tile_flags;
+};
+
+#endif // INCL_SPLATFRAMEBUFFER
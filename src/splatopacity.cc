@@ -0,0 +1,110 @@
+/****************************************************************************
+ * splatopacity.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "starsplatter.h"
+#include "splatpainter.h"
+#include "splatopacity.h"
+
+/* Notes-
+ * A pixel is saturated once its opacity reaches the limit; since the
+ * painters never add to a saturated pixel, skipping a saturated region
+ * gives exactly the same image as painting it.  The counts may be read
+ * while other threads are lowering them, but a stale count is only
+ * ever too high, which costs some culling and never correctness.
+ */
+
+SplatOpacityMap::SplatOpacityMap( const int xsize_in, const int ysize_in,
+				  const float limit_in )
+{
+  xsize= xsize_in;
+  ysize= ysize_in;
+  opac_limit= limit_in;
+  ncells_x= (xsize+OPACITY_CELL_SIZE-1)/OPACITY_CELL_SIZE;
+  ncells_y= (ysize+OPACITY_CELL_SIZE-1)/OPACITY_CELL_SIZE;
+  nblocks_x= (ncells_x+OPACITY_BLOCK_CELLS-1)/OPACITY_BLOCK_CELLS;
+  nblocks_y= (ncells_y+OPACITY_BLOCK_CELLS-1)/OPACITY_BLOCK_CELLS;
+  cell_open= new int[ncells_x*ncells_y];
+  block_open= new int[nblocks_x*nblocks_y];
+  for (int i=0; i<nblocks_x*nblocks_y; i++) block_open[i]= 0;
+  for (int cj=0; cj<ncells_y; cj++) {
+    int height= ysize - cj*OPACITY_CELL_SIZE;
+    if (height>OPACITY_CELL_SIZE) height= OPACITY_CELL_SIZE;
+    for (int ci=0; ci<ncells_x; ci++) {
+      int width= xsize - ci*OPACITY_CELL_SIZE;
+      if (width>OPACITY_CELL_SIZE) width= OPACITY_CELL_SIZE;
+      cell_open[cj*ncells_x + ci]= width*height;
+      block_open[(cj/OPACITY_BLOCK_CELLS)*nblocks_x 
+		 + ci/OPACITY_BLOCK_CELLS]++;
+    }
+  }
+}
+
+SplatOpacityMap::~SplatOpacityMap()
+{
+  delete [] cell_open;
+  delete [] block_open;
+}
+
+void SplatOpacityMap::saturate( const int i, const int j )
+{
+  int ci= i/OPACITY_CELL_SIZE;
+  int cj= j/OPACITY_CELL_SIZE;
+  if (!__sync_sub_and_fetch(cell_open + cj*ncells_x + ci, 1))
+    __sync_sub_and_fetch(block_open + (cj/OPACITY_BLOCK_CELLS)*nblocks_x
+			 + ci/OPACITY_BLOCK_CELLS, 1);
+}
+
+int SplatOpacityMap::saturated( const SplatPixelRect& rect ) const
+{
+  if (rect.imin>rect.imax || rect.jmin>rect.jmax) return 0;
+  int cimin= rect.imin/OPACITY_CELL_SIZE;
+  int cimax= rect.imax/OPACITY_CELL_SIZE;
+  int cjmin= rect.jmin/OPACITY_CELL_SIZE;
+  int cjmax= rect.jmax/OPACITY_CELL_SIZE;
+  for (int bj=cjmin/OPACITY_BLOCK_CELLS; bj<=cjmax/OPACITY_BLOCK_CELLS; 
+       bj++) {
+    int cjlo= bj*OPACITY_BLOCK_CELLS;
+    int cjhi= cjlo + OPACITY_BLOCK_CELLS - 1;
+    if (cjlo<cjmin) cjlo= cjmin;
+    if (cjhi>cjmax) cjhi= cjmax;
+    for (int bi=cimin/OPACITY_BLOCK_CELLS; bi<=cimax/OPACITY_BLOCK_CELLS; 
+	 bi++) {
+      if (!block_open[bj*nblocks_x + bi]) continue;
+      int cilo= bi*OPACITY_BLOCK_CELLS;
+      int cihi= cilo + OPACITY_BLOCK_CELLS - 1;
+      if (cilo<cimin) cilo= cimin;
+      if (cihi>cimax) cihi= cimax;
+      for (int cj=cjlo; cj<=cjhi; cj++)
+	for (int ci=cilo; ci<=cihi; ci++)
+	  if (cell_open[cj*ncells_x + ci]) return 0;
+    }
+  }
+  return 1;
+}
+
+int SplatOpacityMap::row_saturated( const int j, const int imin, 
+				    const int imax ) const
+{
+  if (imin>imax) return 0;
+  const int* row= cell_open + (j/OPACITY_CELL_SIZE)*ncells_x;
+  for (int ci=imin/OPACITY_CELL_SIZE; ci<=imax/OPACITY_CELL_SIZE; ci++)
+    if (row[ci]) return 0;
+  return 1;
+}
@@ -0,0 +1,59 @@
+/****************************************************************************
+ * splatopacity.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATOPACITY
+#define INCL_SPLATOPACITY
+
+/* Pixels are grouped into square cells this many pixels across, and
+ * cells into square blocks this many cells across.
+ */
+#define OPACITY_CELL_SIZE 8
+#define OPACITY_BLOCK_CELLS 8
+
+/* A SplatOpacityMap records which pixels of a frame have reached the
+ * opacity limit during front-to-back compositing, so that painting
+ * behind them can be skipped.  Each cell keeps a count of its pixels
+ * which are still below the limit, and each block a count of its cells
+ * which are.  Counts only go down, and they are changed atomically, so
+ * threads painting separate parts of the frame may share a map.
+ */
+class SplatOpacityMap {
+ public:
+  SplatOpacityMap( const int xsize_in, const int ysize_in, 
+		   const float limit_in );
+  ~SplatOpacityMap();
+  float limit() const { return opac_limit; }
+  // Records that pixel (i,j) has just reached the limit
+  void saturate( const int i, const int j );
+  // Non-zero if every pixel in the rectangle has reached the limit
+  int saturated( const SplatPixelRect& rect ) const;
+  // Non-zero if pixels imin through imax of row j have all reached it
+  int row_saturated( const int j, const int imin, const int imax ) const;
+ private:
+  int xsize;
+  int ysize;
+  float opac_limit;
+  int ncells_x;
+  int ncells_y;
+  int nblocks_x;
+  int nblocks_y;
+  int* cell_open; // pixels below the limit, per cell
+  int* block_open; // cells with pixels below the limit, per block
+};
+
+#endif // INCL_SPLATOPACITY
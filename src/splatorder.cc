@@ -0,0 +1,137 @@
+/****************************************************************************
+ * splatorder.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "starsplatter.h"
+#include "splatbuffer.h"
+#include "radixsort.h"
+#include "splatorder.h"
+
+/* Notes-
+ * The records written by seed() are exactly those the full sort would
+ * start from, only in a different order, so sorting them on all 64 bits
+ * gives exactly the full sort's result.  The history is only ever a
+ * hint; a stale one costs time but never correctness.  Every slot is
+ * -1 between calls, and seed() puts each one it uses back to -1 as the
+ * splat is written out.
+ */
+
+// The most frames seed() will decline after a run of failures
+#define ORDER_MAX_BACKOFF 16
+
+SplatOrderHistory::SplatOrderHistory()
+{
+  splat_ids= NULL;
+  n_ids_alloc= 0;
+  prev_ids= NULL;
+  n_prev= 0;
+  n_prev_alloc= 0;
+  n_particles= 0;
+  slots= NULL;
+  n_slots_alloc= 0;
+  backoff= 1;
+  n_declines= 0;
+}
+
+SplatOrderHistory::~SplatOrderHistory()
+{
+  delete [] splat_ids;
+  delete [] prev_ids;
+  delete [] slots;
+}
+
+unsigned int* SplatOrderHistory::ids( const long n )
+{
+  if (n>n_ids_alloc) {
+    delete [] splat_ids;
+    n_ids_alloc= n;
+    splat_ids= new unsigned int[n_ids_alloc];
+    if (!splat_ids) {
+      fprintf(stderr,
+	      "SplatOrderHistory: Out of memory allocating particle ids!\n");
+      exit(-1);
+    }
+  }
+  return splat_ids;
+}
+
+int SplatOrderHistory::seed( const SplatBuffer* splats, const long n,
+			     const long nparticles, unsigned long long* recs )
+{
+  if (n_prev==0 || nparticles!=n_particles) return 0;
+  if (n_declines>0) {
+    n_declines--;
+    return 0;
+  }
+  if (nparticles>n_slots_alloc) {
+    delete [] slots;
+    n_slots_alloc= nparticles;
+    slots= new int[n_slots_alloc];
+    if (!slots) {
+      fprintf(stderr,
+	      "SplatOrderHistory: Out of memory allocating particle slots!\n");
+      exit(-1);
+    }
+    for (long i=0; i<n_slots_alloc; i++) slots[i]= -1;
+  }
+
+  for (long i=0; i<n; i++) slots[splat_ids[i]]= (int)i;
+  long m= 0;
+  for (long k=0; k<n_prev; k++) {
+    int i= slots[prev_ids[k]];
+    if (i<0) continue; // not drawn this frame
+    recs[m++]= (((unsigned long long)ssplat_float_sort_key(splats->z(i)))<<32)
+      | (unsigned long long)i;
+    slots[prev_ids[k]]= -1;
+  }
+  for (long i=0; i<n; i++) {
+    if (slots[splat_ids[i]]<0) continue; // already written
+    recs[m++]= (((unsigned long long)ssplat_float_sort_key(splats->z(i)))<<32)
+      | (unsigned long long)i;
+    slots[splat_ids[i]]= -1;
+  }
+  return 1;
+}
+
+void SplatOrderHistory::remember( const unsigned long long* recs, 
+				  const long n, const long nparticles )
+{
+  if (n>n_prev_alloc) {
+    delete [] prev_ids;
+    n_prev_alloc= n;
+    prev_ids= new unsigned int[n_prev_alloc];
+    if (!prev_ids) {
+      fprintf(stderr,
+	      "SplatOrderHistory: Out of memory allocating particle order!\n");
+      exit(-1);
+    }
+  }
+  for (long k=0; k<n; k++) prev_ids[k]= splat_ids[recs[k] & 0xffffffffULL];
+  n_prev= n;
+  n_particles= nparticles;
+}
+
+void SplatOrderHistory::report( const int success )
+{
+  if (success) backoff= 1;
+  else {
+    n_declines= backoff;
+    if (backoff<ORDER_MAX_BACKOFF) backoff *= 2;
+  }
+}
@@ -0,0 +1,63 @@
+/****************************************************************************
+ * splatorder.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATORDER
+#define INCL_SPLATORDER
+
+class SplatBuffer;
+
+/* A SplatOrderHistory remembers the depth order of the particles in
+ * the last frame sorted, so that the next frame of an animation can
+ * start its sort from nearly sorted records.  Particles are identified
+ * by their position in the renderer's list of all particles, and the
+ * transform records the particle behind each splat in ids().
+ */
+class SplatOrderHistory {
+ public:
+  SplatOrderHistory();
+  ~SplatOrderHistory();
+  // The particle ids of up to n splats, in splat buffer order; 
+  // contents are lost if the array grows
+  unsigned int* ids( const long n );
+  // Writes sort records for the n splats into recs, with the splats in
+  // the previous frame's order and those not drawn then at the end.
+  // Returns 0 if the previous frame did not have nparticles particles,
+  // or if recent seeds have not paid off.
+  int seed( const SplatBuffer* splats, const long n, const long nparticles,
+	    unsigned long long* recs );
+  // Remembers the particle order given by n sorted records
+  void remember( const unsigned long long* recs, const long n,
+		 const long nparticles );
+  // Reports whether the seeded records could be sorted quickly.  After
+  // a failure seed() declines for a while, for longer each time.
+  void report( const int success );
+  void forget() { n_prev= 0; }
+ private:
+  unsigned int* splat_ids;
+  long n_ids_alloc;
+  unsigned int* prev_ids; // particle ids in the previous frame's order
+  long n_prev;
+  long n_prev_alloc;
+  long n_particles; // particles in the previous frame
+  int* slots; // per particle; splat index, or -1
+  long n_slots_alloc;
+  int backoff; // frames to decline after the next failure
+  int n_declines; // frames still to decline
+};
+
+#endif // INCL_SPLATORDER
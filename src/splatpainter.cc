@@ -22,18 +22,35 @@
 
 #include "starsplatter.h"
 #include "splatpainter.h"
+#include "splatbuffer.h"
+#include "splatstamp.h"
+#include "threadteam.h"
+#include "radixsort.h"
 
 /* Notes-
+ * Stamp keys pack the kernel scale bin in bits 32-51, and the x and y
+ * sub-pixel phase bins in bits 16-31 and 0-15.  The kernel scale is
+ * binned logarithmically with ratio 1+tol, which bounds the relative
+ * error from scale quantization by tol.  The phase bin count grows 
+ * with the kernel scale so that the phase error is also about tol
+ * relative to the kernel peak.
  */
 
+#define STAMP_K_BITS 20
+#define STAMP_K_OFFSET (1<<(STAMP_K_BITS-1))
+
 SplatPainter::SplatPainter(StarSplatter* owner_in)
 {
   owner= owner_in;
+  additive_flag= 0;
+  front_to_back_flag= 0;
+  stamps= new SplatStampCache;
+  stamp_tol= 0.0;
 }
 
 SplatPainter::~SplatPainter()
 {
-  // Nothing to clean up;
+  delete stamps;
 }
 
 const char* SplatPainter::typeName() const
@@ -49,187 +66,365 @@ StarSplatter::SplatType SplatPainter::getSplatType() const
   return (StarSplatter::SplatType)0; // to satisfy compiler
 }
 
+void SplatPainter::footprint( const StarSplatter::Splat* splat,
+			      SplatPixelRect& rect ) const
+{
+  fprintf(stderr,"Internal error: Base SplatPainter::footprint() called!\n");
+  exit(-1);
+}
+
+void SplatPainter::paint_batch( const StarSplatter::Splat* splats,
+				const long n, const SplatPixelRect& clip,
+				const SplatFrame& frame, double* krnl_integral,
+				int* pixels_touched )
+{
+  fprintf(stderr,
+	  "Internal error: Base SplatPainter::paint_batch() called!\n");
+  exit(-1);
+}
+
 void SplatPainter::paint( const StarSplatter::Splat* splat,
-			  const double sep_fac,
+			  const SplatPixelRect& clip,
 			  gColor* tmp_image,
 			  double& krnl_integral, int& pixels_touched )
 {
-  fprintf(stderr,"Internal error: Base SplatPainter::paint() called!\n");
-  exit(-1);
+  SplatFrame frame;
+  frame.pixels= tmp_image;
+  frame.density= NULL;
+  frame.half_pixels= NULL;
+  frame.planes= NULL;
+  frame.xsize= owner->image_xsize();
+  frame.ysize= owner->image_ysize();
+  frame.opacity= NULL;
+  frame.reveal= NULL;
+  frame.buffer= NULL;
+  double splat_integral;
+  int splat_pixels;
+  paint_batch( splat, 1, clip, frame, &splat_integral, &splat_pixels );
+  krnl_integral += splat_integral;
+  pixels_touched += splat_pixels;
+}
+
+void SplatPainter::clipped_bounds( const StarSplatter::Splat* splat,
+				   const double splat_limit,
+				   SplatPixelRect& rect ) const
+{
+  rect.imin= (int)(splat->x-splat_limit+1.0); // ceil
+  rect.imax= (int)(splat->x+splat_limit); // floor
+  rect.jmin= (int)(splat->y-splat_limit+1.0); // ceil
+  rect.jmax= (int)(splat->y+splat_limit); // floor
+
+  if (rect.imin<0) rect.imin= 0;
+  if (rect.imax>=owner->image_xsize()) rect.imax= owner->image_xsize()-1;
+  if (rect.jmin<0) rect.jmin= 0;
+  if (rect.jmax>=owner->image_ysize()) rect.jmax= owner->image_ysize()-1;
 }
 
-void SplatPainter::small_splat( const StarSplatter::Splat* splat,
-				const double splat_limit,
-				const double sep_fac,
-				const double energy_scale,
-				gColor scaled_clr,
-				const int imin, const int imax,
-				const int jmin, const int jmax,
-				gColor* tmp_image, 
-				double& krnl_integral, 
-				int& pixels_touched ) const
+void SplatPainter::kernel_footprint( const StarSplatter::Splat* splat,
+				     const double splat_limit,
+				     SplatPixelRect& rect ) const
 {
-  gColor* pixrunner;
-  gColor tmp_clr;
-  int xsize= owner->image_xsize();
-  int ysize= owner->image_ysize();
-  int debug_flag= owner->debug();
+  // This follows the choice of method made by the kernel painters
+  clipped_bounds( splat, splat_limit, rect );
+  int maxNSplats= ((rect.imax-rect.imin)+1)*((rect.jmax-rect.jmin)+1);
+  if (maxNSplats <= (double)SPLAT_RENORM_CUTOFF && splat_limit <= 1.0)
+    small_splat_footprint( splat_limit, rect.imin, rect.imax, 
+			   rect.jmin, rect.jmax, rect );
+}
 
+void SplatPainter::small_splat_footprint( const double splat_limit,
+					  const int imin, const int imax,
+					  const int jmin, const int jmax,
+					  SplatPixelRect& rect ) const
+{
+  // This must cover every pixel small_splat() can write
+  rect.imin= imin;
+  rect.jmin= jmin;
   if (splat_limit>0.5) {
-    // fprintf(stderr,"Strange splat; %d %d to %d %d ",imin,jmin,imax,jmax);
-    if (imin==imax) {
-      if (jmin==jmax) {
-        // degenerate splat, happens to fall on 1 pixel
-        if ((imin>=0)&&(imin<xsize)&&(jmin>=0)&&(jmin<ysize)) {
-          tmp_clr= scaled_clr;
-          tmp_clr.mult_noclamp(energy_scale);
-          tmp_clr.clamp_alpha();
-          pixrunner= tmp_image + (jmin*xsize) + imin;
-          tmp_clr.add_under( *pixrunner );
-          *pixrunner= tmp_clr;
-          if (debug_flag) {
-            krnl_integral += energy_scale;
-            pixels_touched++;
-          }
-        }
-      }
-      else {
-        // 1 pixel in x direction, 2 in y
-        if ((imin>=0)&&(imin<xsize)) {
-          double y_offset= splat->loc.y()-(double)jmin;
-          pixrunner= tmp_image + (jmin*xsize) + imin;
-          if ((jmin>=0)&&(jmin<ysize)) {
-            tmp_clr= scaled_clr;
-            tmp_clr.mult_noclamp( energy_scale*(1.0-y_offset) );
-            tmp_clr.clamp_alpha();
-            tmp_clr.add_under( *pixrunner );
-            *pixrunner= tmp_clr;
-            if (debug_flag) {
-              krnl_integral += energy_scale*(1.0-y_offset);
-              pixels_touched++;
-            }
-          }
-          if ((jmax>=0)&&(jmax<ysize)) {
-            pixrunner += xsize;
-            tmp_clr= scaled_clr;
-            tmp_clr.mult_noclamp( energy_scale*y_offset );
-            tmp_clr.clamp_alpha();
-            tmp_clr.add_under( *pixrunner );
-            *pixrunner= tmp_clr;
-            if (debug_flag) {
-              krnl_integral += energy_scale*y_offset;
-              pixels_touched++;
-            }
-          }
-        }
-      }
-    }
-    else {
-      double x_offset= splat->loc.x()-(double)imin;
-      if (jmin==jmax) {
-        // 2 pixels in x direction, 1 in y
-        if ((jmin>=0)&&(jmin<ysize)) {
-          pixrunner= tmp_image + (jmin*xsize) + imin;
-          if ((imin>=0)&&(imin<xsize)) {
-            tmp_clr= scaled_clr;
-            tmp_clr.mult_noclamp( energy_scale*(1.0-x_offset) );
-            tmp_clr.clamp_alpha();
-            tmp_clr.add_under( *pixrunner );
-            *pixrunner= tmp_clr;
-            if (debug_flag) {
-              krnl_integral += energy_scale*(1.0-x_offset);
-              pixels_touched++;
-            }
-          }
-          if ((imax>=0)&&(imax<xsize)) {
-            pixrunner++;
-            tmp_clr= scaled_clr;
-            tmp_clr.mult_noclamp( energy_scale*x_offset );
-            tmp_clr.clamp_alpha();
-            tmp_clr.add_under( *pixrunner );
-            *pixrunner= tmp_clr;
-            if (debug_flag) {
-              krnl_integral += energy_scale*x_offset;
-              pixels_touched++;
-            }
-          }
-        }
-      }
-      else {
-        // Hit all 4 pixels
-        double y_offset= splat->loc.y()-(double)jmin;
-        pixrunner= tmp_image + (jmin*xsize) + imin;
-        if ((jmin>=0)&&(jmin<ysize)) {
-          if ((imin>=0)&&(imin<xsize)) {
-            tmp_clr= scaled_clr;
-            tmp_clr.mult_noclamp( energy_scale
-				  *(1.0-x_offset)*(1.0-y_offset) );
-            tmp_clr.clamp_alpha();
-            tmp_clr.add_under( *pixrunner );
-            *pixrunner= tmp_clr;
-            if (debug_flag) {
-              krnl_integral += energy_scale*(1.0-x_offset)*(1.0-y_offset);
-              pixels_touched++;
-            }
-          }
-          if ((imax>=0)&&(imax<xsize)) {
-            pixrunner++;
-            tmp_clr= scaled_clr;
-            tmp_clr.mult_noclamp( energy_scale
-				  *x_offset*(1.0-y_offset) );
-            tmp_clr.clamp_alpha();
-            tmp_clr.add_under( *pixrunner );
-            *pixrunner= tmp_clr;
-            if (debug_flag) {
-              krnl_integral += energy_scale*x_offset*(1.0-y_offset);
-              pixels_touched++;
-            }
-          }
-        }
-        if ((jmax>=0)&&(jmax<ysize)) {
-          pixrunner = tmp_image + (jmax*xsize) +imin;
-          if ((imin>=0)&&(imin<xsize)) {
-            tmp_clr= scaled_clr;
-            tmp_clr.mult_noclamp( energy_scale
-				  *(1.0-x_offset)*y_offset );
-            tmp_clr.clamp_alpha();
-            tmp_clr.add_under( *pixrunner );
-            *pixrunner= tmp_clr;
-            if (debug_flag) {
-              krnl_integral += energy_scale*(1.0-x_offset)*y_offset;
-              pixels_touched++;
-            }
-          }
-          if ((imax>=0)&&(imax<xsize)) {
-            pixrunner++;
-            tmp_clr= scaled_clr;
-            tmp_clr.mult_noclamp( energy_scale
-				  *x_offset*y_offset );
-            tmp_clr.clamp_alpha();
-            tmp_clr.add_under( *pixrunner );
-            *pixrunner= tmp_clr;
-            if (debug_flag) {
-              krnl_integral += energy_scale*x_offset*y_offset;
-              pixels_touched++;
-            }
-          }
-        }
-      }
-    }
+    rect.imax= (imax>imin) ? ((imax>imin+1) ? imax : imin+1) : imin;
+    rect.jmax= (jmax>jmin) ? ((jmax>jmin+1) ? jmax : jmin+1) : jmin;
   }
   else {
-    // degenerate splat, fits in one pixel
-    // fprintf(stderr,"Degenerate splat: ");
-    tmp_clr= scaled_clr;
-    tmp_clr.mult_noclamp(energy_scale);
-    tmp_clr.clamp_alpha();
-    pixrunner= tmp_image + (jmin*xsize) + imin;
-    tmp_clr.add_under( *pixrunner );
-    *pixrunner= tmp_clr;
-    if (debug_flag) {
-      krnl_integral += energy_scale;
-      pixels_touched++;
+    rect.imax= imin;
+    rect.jmax= jmin;
+  }
+  if (rect.imin<0) rect.imin= 0;
+  if (rect.imax>=owner->image_xsize()) rect.imax= owner->image_xsize()-1;
+  if (rect.jmin<0) rect.jmin= 0;
+  if (rect.jmax>=owner->image_ysize()) rect.jmax= owner->image_ysize()-1;
+}
+
+int SplatPainter::stamp_supported() const
+{
+  return 0;
+}
+
+double SplatPainter::pixel_kernel( const double k, const double dx,
+				   const double dy ) const
+{
+  fprintf(stderr,
+	  "Internal error: Base SplatPainter::pixel_kernel() called!\n");
+  exit(-1);
+  return 0.0; // to satisfy compiler
+}
+
+double SplatPainter::pixel_limit( const double k ) const
+{
+  fprintf(stderr,
+	  "Internal error: Base SplatPainter::pixel_limit() called!\n");
+  exit(-1);
+  return 0.0; // to satisfy compiler
+}
+
+double SplatPainter::kernel_slope() const
+{
+  fprintf(stderr,
+	  "Internal error: Base SplatPainter::kernel_slope() called!\n");
+  exit(-1);
+  return 0.0; // to satisfy compiler
+}
+
+int SplatPainter::pixel_integrated() const
+{
+  return 0;
+}
+
+double SplatPainter::reach( const StarSplatter::Splat* splat ) const
+{
+  return 0.0;
+}
+
+double SplatPainter::peak_weight( const StarSplatter::Splat* splat ) const
+{
+  // The bound comes from the same pixel-unit kernel the stamps use
+  if (!stamp_supported()) return HUGE_VAL;
+
+  // Weights sum to the inverse square of sep_fac, so no pixel gets more
+  // than that.  Renormalized footprints can approach the bound; others
+  // never exceed the kernel's central value, allowing for the scale
+  // error of a stamp.
+  double sep_fac= splat->sep_fac;
+  double total= 1.0/(sep_fac*sep_fac);
+  SplatPixelRect rect;
+  footprint( splat, rect );
+  if (rect.imin>rect.imax || rect.jmin>rect.jmax) return 0.0;
+  long npix= (long)(rect.imax-rect.imin+1)*(long)(rect.jmax-rect.jmin+1);
+  if (!pixel_integrated() && npix <= SPLAT_RENORM_CUTOFF) return total;
+  double k= splat->sqrt_exp_constant*sep_fac;
+  double tol= owner->stamp_tolerance();
+  double peak= (1.0+tol)*(1.0+tol)*pixel_kernel(k, 0.0, 0.0);
+  return (peak<1.0) ? peak*total : total;
+}
+
+static inline int stamp_phase_bins( const double kq, const double slope,
+				    const double tol )
+{
+  double nph= ceil(slope*kq/tol);
+  if (nph<1.0) return 1;
+  if (nph>SPLAT_STAMP_MAX_PHASES) return 0;
+  return (int)nph;
+}
+
+/* Decodes the quantized kernel scale and sub-pixel center of a key, and
+ * the footprint which goes with them.  The footprint is relative to the
+ * pixel containing the splat center.
+ */
+static void stamp_geometry( const unsigned long long key, const double tol,
+			    const double slope, double& kq, 
+			    double& cx, double& cy, int& nph )
+{
+  int kb= (int)((key>>32) & ((1ULL<<STAMP_K_BITS)-1)) - STAMP_K_OFFSET;
+  kq= exp(kb*log(1.0+tol));
+  nph= stamp_phase_bins(kq, slope, tol);
+  cx= ((double)((key>>16) & 0xFFFF) + 0.5)/nph;
+  cy= ((double)(key & 0xFFFF) + 0.5)/nph;
+}
+
+int SplatPainter::stamp_key( const StarSplatter::Splat* splat, 
+			     const double tol, unsigned long long& key, 
+			     int& i0, int& j0 ) const
+{
+  double k= (double)splat->sqrt_exp_constant*(double)splat->sep_fac;
+  if (!(k>0.0)) return 0;
+  double log_step= log(1.0+tol);
+  double kb_real= floor(log(k)/log_step + 0.5);
+  if (kb_real < -STAMP_K_OFFSET || kb_real >= STAMP_K_OFFSET) return 0;
+  int kb= (int)kb_real;
+  double kq= exp(kb*log_step);
+  int nph= stamp_phase_bins(kq, kernel_slope(), tol);
+  if (!nph) return 0;
+
+  double fx= floor(splat->x);
+  double fy= floor(splat->y);
+  int bx= (int)((splat->x - fx)*nph);
+  if (bx>=nph) bx= nph-1;
+  int by= (int)((splat->y - fy)*nph);
+  if (by>=nph) by= nph-1;
+  double cx= (bx+0.5)/nph;
+  double cy= (by+0.5)/nph;
+
+  // Stamps are only used for splats wholly inside the image, since the
+  // renormalized kernels depend on clipping to the image edge.
+  double limit= pixel_limit(kq);
+  i0= (int)fx;
+  j0= (int)fy;
+  int imin= i0 + (int)floor(cx-limit+1.0);
+  int imax= i0 + (int)floor(cx+limit);
+  int jmin= j0 + (int)floor(cy-limit+1.0);
+  int jmax= j0 + (int)floor(cy+limit);
+  if (imin<0 || imax>=owner->image_xsize() 
+      || jmin<0 || jmax>=owner->image_ysize()) return 0;
+  int maxNSplats= ((imax-imin)+1)*((jmax-jmin)+1);
+  if (maxNSplats <= SPLAT_RENORM_CUTOFF && limit <= 1.0 
+      && !pixel_integrated()) return 0;
+
+  key= (((unsigned long long)(kb+STAMP_K_OFFSET))<<32)
+    | (((unsigned long long)bx)<<16) | (unsigned long long)by;
+  return 1;
+}
+
+void SplatPainter::fill_stamp( const unsigned long long key, 
+			       const double tol, SplatStamp* stamp ) const
+{
+  double kq, cx, cy;
+  int nph;
+  stamp_geometry( key, tol, kernel_slope(), kq, cx, cy, nph );
+  double limit= pixel_limit(kq);
+  stamp->imin= (int)floor(cx-limit+1.0);
+  stamp->jmin= (int)floor(cy-limit+1.0);
+  stamp->width= (int)floor(cx+limit) - stamp->imin + 1;
+  stamp->height= (int)floor(cy+limit) - stamp->jmin + 1;
+  int npix= stamp->width*stamp->height;
+  stamp->weights= new float[npix];
+
+  float* here= stamp->weights;
+  double sum= 0.0;
+  for (int j=0; j<stamp->height; j++) {
+    double dy= (double)(stamp->jmin+j) - cy;
+    for (int i=0; i<stamp->width; i++) {
+      double kval= pixel_kernel(kq, (double)(stamp->imin+i) - cx, dy);
+      *here++= kval;
+      sum += kval;
     }
   }
-  
+
+  // Small footprints are renormalized, as the exact painters do
+  if (npix <= SPLAT_RENORM_CUTOFF && sum>0.0 && !pixel_integrated()) {
+    double invSum= 1.0/sum;
+    for (int i=0; i<npix; i++) stamp->weights[i] *= invSum;
+  }
+}
+
+const SplatStamp* SplatPainter::find_stamp( const StarSplatter::Splat* splat,
+					    int& i0, int& j0 ) const
+{
+  if (stamp_tol<=0.0 || !stamps->nstamps()) return NULL;
+  unsigned long long key;
+  if (!stamp_key( splat, stamp_tol, key, i0, j0 )) return NULL;
+  return stamps->find(key);
+}
+
+void SplatPainter::stamp_footprint( const SplatStamp* stamp, 
+				    const int i0, const int j0,
+				    SplatPixelRect& rect ) const
+{
+  rect.imin= i0 + stamp->imin;
+  rect.imax= rect.imin + stamp->width - 1;
+  rect.jmin= j0 + stamp->jmin;
+  rect.jmax= rect.jmin + stamp->height - 1;
+}
+
+/* Stamp keys are gathered for every splat in parallel, sorted, and
+ * counted; each key used often enough gets a stamp, and the stamps are
+ * then filled in parallel.
+ */
+struct SplatStampJob {
+  const SplatPainter* painter;
+  const SplatBuffer* splats;
+  long nsplats;
+  int nchunks;
+  double tol;
+  unsigned long long* keys; // each chunk's keys start at its first splat
+  long* nkeys; // per chunk
+  SplatStampCache* stamps;
+};
+
+void SplatPainter::prepare( const SplatBuffer* splats, ThreadTeam& team )
+{
+  double tol= owner->stamp_tolerance();
+  if (tol<=0.0 || !stamp_supported()) {
+    stamps->clear();
+    stamp_tol= 0.0;
+    return;
+  }
+  stamp_tol= tol;
+
+  long n= splats->size();
+  int nchunks= team.nthreads();
+  unsigned long long* keys= new unsigned long long[2*n+1];
+  long* nkeys= new long[nchunks];
+
+  // Gather keys in parallel
+  SplatStampJob job;
+  job.painter= this;
+  job.splats= splats;
+  job.nsplats= n;
+  job.nchunks= nchunks;
+  job.tol= tol;
+  job.keys= keys;
+  job.nkeys= nkeys;
+  job.stamps= stamps;
+  team.run( gather_stamp_keys_task, &job, nchunks );
+
+  // Pack the chunks together and sort
+  long nkeys_total= 0;
+  for (int chunk=0; chunk<nchunks; chunk++) {
+    long first= (chunk*n)/nchunks;
+    for (long i=0; i<nkeys[chunk]; i++) keys[nkeys_total++]= keys[first+i];
+  }
+  ssplat_radix_sort( keys, keys+n, nkeys_total, 0, 32+STAMP_K_BITS, team );
+
+  // Keep keys which are used often enough
+  long nunique= 0;
+  for (long i=0; i<nkeys_total; ) {
+    long run= i+1;
+    while (run<nkeys_total && keys[run]==keys[i]) run++;
+    if (run-i >= SPLAT_STAMP_MIN_USES) keys[nunique++]= keys[i];
+    i= run;
+  }
+  stamps->set_keys( keys, nunique );
+  team.run( fill_stamps_task, &job, (int)nunique );
+
+  if (owner->debug())
+    fprintf(stderr,"%ld of %ld splats map to %ld stamps\n",
+	    nkeys_total, n, nunique);
+
+  delete [] nkeys;
+  delete [] keys;
+}
+
+void SplatPainter::gather_stamp_keys_task( void* arg, const int chunk,
+					   const int thread )
+{
+  SplatStampJob* job= (SplatStampJob*)arg;
+  long first= (chunk*job->nsplats)/job->nchunks;
+  long last= ((chunk+1)*job->nsplats)/job->nchunks;
+  long count= 0;
+  for (long i=first; i<last; i++) {
+    StarSplatter::Splat splat;
+    job->splats->get( i, splat );
+    unsigned long long key;
+    int i0, j0;
+    if (job->painter->stamp_key( &splat, job->tol, key, i0, j0 ))
+      job->keys[first + count++]= key;
+  }
+  job->nkeys[chunk]= count;
+}
+
+void SplatPainter::fill_stamps_task( void* arg, const int istamp,
+				     const int thread )
+{
+  SplatStampJob* job= (SplatStampJob*)arg;
+  job->painter->fill_stamp( job->stamps->key(istamp), job->tol,
+			    job->stamps->stamp(istamp) );
 }
@@ -27,27 +27,193 @@
  */
 #define SPLAT_RENORM_CUTOFF 25
 
+/* Stamps are built only for footprint classes used by at least this
+ * many splats in a frame; otherwise building the stamp costs as much 
+ * as painting the splats exactly.
+ */
+#define SPLAT_STAMP_MIN_USES 2
+
+/* Phase bins per pixel beyond which stamps are not used.  Small splats
+ * need fine phase steps, and the cheap small_splat() path anyway.
+ */
+#define SPLAT_STAMP_MAX_PHASES 64
+
+/* Callers hand splats to paint_batch() in groups of up to this many,
+ * so that the per-call work is spread over many splats.
+ */
+#define SPLAT_BATCH_SIZE 64
+
+/* Columns whose kernel weights are computed at one time */
+#define SPLAT_SPAN 256
+
+class SplatBuffer;
+class ThreadTeam;
+class SplatStampCache;
+class SplatOpacityMap;
+class SplatFramebuffer;
+struct SplatStamp;
+
+/* An inclusive rectangle of pixel indices.  Painters write only those
+ * pixels which fall inside the clip rectangle they are handed, so that
+ * separate threads can paint separate parts of the image.  The value
+ * written to any given pixel does not depend on the clip rectangle.
+ */
+struct SplatPixelRect {
+  int imin;
+  int imax;
+  int jmin;
+  int jmax;
+};
+
+/* The ways a frame may store its pixels: gColors; one density per
+ * pixel; four half precision floats per pixel, r, g, b and a; or four
+ * planes of floats, one per channel.  The painters do their arithmetic
+ * in single precision whatever the storage.
+ */
+enum SplatPixelFormat { SPF_RGBA, SPF_DENSITY, SPF_HALF, SPF_PLANAR };
+
+/* An image to paint into.  Pixel (i,j) is pixels[j*xsize + i].  For
+ * front-to-back compositing the frame may carry an opacity map, which
+ * lets the painters skip pixels which are already opaque.  A frame
+ * with a revealage buffer is painted by weighted blending: pixels get
+ * the weighted sum of the splat colors, and reveal the product of the
+ * splat transparencies, so that splats may be painted in any order.
+ * If the pixels belong to a framebuffer, the painters record in it the
+ * tiles they paint.  Frames of the other formats have NULL pixels,
+ * and the pointer of their format set instead.  Painters composite
+ * only splat alphas into a density frame.
+ */
+struct SplatFrame {
+  gColor* pixels; // or NULL
+  float* density; // or NULL
+  unsigned short* half_pixels; // or NULL
+  float* planes; // or NULL
+  int xsize;
+  int ysize;
+  SplatOpacityMap* opacity; // or NULL
+  float* reveal; // or NULL
+  SplatFramebuffer* buffer; // or NULL
+};
+
+/* Everything the painting loops need to know about the image, read
+ * once per batch.  Pixel (i,j) is at offset j*stride + i in whichever
+ * of the pixel pointers is set; planes lie plane_size floats apart.
+ */
+struct SplatPaintContext {
+  gColor* image;
+  float* density;
+  unsigned short* half_pixels;
+  float* planes;
+  long plane_size;
+  int stride;
+  int xsize;
+  int ysize;
+  SplatPixelRect clip;
+  int additive;
+  int front_to_back;
+  SplatOpacityMap* opacity;
+  float* reveal;
+  SplatFramebuffer* buffer;
+  float blend_weight; // depth weight of the current splat
+};
+
+/* Per-splat statistics, kept only when the caller asks for them */
+struct SplatPaintStats {
+  double krnl_integral;
+  int pixels_touched;
+};
+
 class SplatPainter {
  public:
   SplatPainter(StarSplatter* owner_in);
   virtual ~SplatPainter();
   virtual const char* typeName() const;
-  virtual void paint( const StarSplatter::Splat* splat,
-		      const double sep_fac,
-		      gColor* tmp_image, 
-		      double& krnl_integral, int& pixels_touched );
+  // Sets the bounds of the pixels paint() might touch, clipped to the
+  // image.  The rectangle may be conservative, or empty (imin>imax).
+  virtual void footprint( const StarSplatter::Splat* splat,
+			  SplatPixelRect& rect ) const;
+  // Paints n splats in order into the frame, writing only pixels 
+  // inside clip.  If
+  // krnl_integral and pixels_touched are not NULL, they receive the
+  // statistics of each splat.
+  virtual void paint_batch( const StarSplatter::Splat* splats, const long n,
+			    const SplatPixelRect& clip, const SplatFrame& frame,
+			    double* krnl_integral, int* pixels_touched );
+  // Paints one splat, adding its statistics to those given
+  void paint( const StarSplatter::Splat* splat,
+	      const SplatPixelRect& clip,
+	      gColor* tmp_image, 
+	      double& krnl_integral, int& pixels_touched );
   virtual StarSplatter::SplatType getSplatType() const;
+  // How many pixels the splat's kernel reaches from its center, or 0.0
+  // if this painter's splats must not be painted at lower resolution
+  virtual double reach( const StarSplatter::Splat* splat ) const;
+  // An upper bound on the kernel weight paint() gives any one pixel,
+  // or HUGE_VAL if the painter cannot bound it
+  virtual double peak_weight( const StarSplatter::Splat* splat ) const;
+  // Called before each frame is painted.  If the owner's stamp 
+  // tolerance is non-zero and the painter supports stamps, this
+  // builds the stamps the frame's splats will use.
+  virtual void prepare( const SplatBuffer* splats, ThreadTeam& team );
+  // In additive mode splat colors are summed into the image, rather
+  // than composited over it, so splat order does not matter.
+  void set_additive( const int flag ) { additive_flag= flag; }
+  int additive() const { return additive_flag; }
+  // In front-to-back mode each splat is composited under the image,
+  // so splats must arrive nearest first.
+  void set_front_to_back( const int flag ) { front_to_back_flag= flag; }
+  int front_to_back() const { return front_to_back_flag; }
  protected:
   StarSplatter* owner;
-  void small_splat( const StarSplatter::Splat* splat,
-		    const double splat_limit,
-		    const double sep_fac,
-		    const double energy_scale,
-		    gColor scaled_clr,
-		    const int imin, const int imax,
-		    const int jmin, const int jmax,
-		    gColor* tmp_image,
-		    double& krnl_integral, int& pixels_touched ) const;
+  int additive_flag;
+  int front_to_back_flag;
+  SplatStampCache* stamps;
+  double stamp_tol; // tolerance the stamps were built for, or 0.0
+  // Painters which support stamps provide their kernel in pixel units,
+  // for a kernel scale k = sqrt_exp_constant*sep_fac
+  virtual int stamp_supported() const;
+  virtual double pixel_kernel( const double k, const double dx, 
+			       const double dy ) const;
+  virtual double pixel_limit( const double k ) const;
+  // Bound on the kernel gradient relative to its peak, per unit k
+  virtual double kernel_slope() const;
+  // Non-zero if pixel_kernel() is integrated over the pixel area, in
+  // which case small footprints need no renormalization
+  virtual int pixel_integrated() const;
+  int stamp_key( const StarSplatter::Splat* splat, const double tol,
+		 unsigned long long& key, int& i0, int& j0 ) const;
+  void fill_stamp( const unsigned long long key, const double tol,
+		   SplatStamp* stamp ) const;
+  const SplatStamp* find_stamp( const StarSplatter::Splat* splat, 
+				int& i0, int& j0 ) const;
+  void stamp_footprint( const SplatStamp* stamp, const int i0, const int j0,
+			SplatPixelRect& rect ) const;
+  // The painters' paint_batch() methods instantiate these templates,
+  // which are defined in splatbatch.h, for their kernel policies.
+  template <class Kernel>
+  void dispatch_batch( Kernel& kernel, 
+		       const StarSplatter::Splat* splats, const long n,
+		       const SplatPixelRect& clip, const SplatFrame& frame,
+		       double* krnl_integral, int* pixels_touched ) const;
+  template <class Kernel, int STATS, int FORMAT>
+  void paint_batch_with( Kernel& kernel,
+			 const StarSplatter::Splat* splats, const long n,
+			 SplatPaintContext ctx,
+			 double* krnl_integral, int* pixels_touched ) const;
+  void clipped_bounds( const StarSplatter::Splat* splat,
+		       const double splat_limit,
+		       SplatPixelRect& rect ) const;
+  void kernel_footprint( const StarSplatter::Splat* splat,
+			 const double splat_limit,
+			 SplatPixelRect& rect ) const;
+  void small_splat_footprint( const double splat_limit,
+			      const int imin, const int imax,
+			      const int jmin, const int jmax,
+			      SplatPixelRect& rect ) const;
+  static void gather_stamp_keys_task( void* arg, const int chunk,
+				      const int thread );
+  static void fill_stamps_task( void* arg, const int istamp,
+				const int thread );
 };
 
 #endif // INCL_SPLATPAINTER
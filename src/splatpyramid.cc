@@ -0,0 +1,226 @@
+/****************************************************************************
+ * splatpyramid.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "starsplatter.h"
+#include "splatpyramid.h"
+#include "splatframebuffer.h"
+
+/* Notes-
+ * Pixel I of level L covers pixels I*2^L through I*2^L+2^L-1 of level
+ * 0, so its center lies at I*2^L + (2^L-1)/2 in level 0 coordinates.
+ * Upsampling by two places fine pixel i at (i-0.5)/2 in the coarse
+ * pixel coordinates.  Clamping at the edges keeps the sum of each
+ * coarse pixel's contributions at four fine pixels, so the bilinear
+ * upsampling conserves energy exactly, even at the image edges.
+ */
+
+// Levels stop when the image would get smaller than this in either axis
+#define PYRAMID_MIN_DIM 4
+
+SplatPyramid::SplatPyramid( const int xsize_in, const int ysize_in,
+			    const double radius_in, const int format_in )
+{
+  xsize= xsize_in;
+  ysize= ysize_in;
+  radius= radius_in;
+  density= (format_in==SPF_DENSITY);
+  n_levels= 1;
+  if (radius>0.0) {
+    while ((xsize>>n_levels) >= PYRAMID_MIN_DIM
+	   && (ysize>>n_levels) >= PYRAMID_MIN_DIM) n_levels++;
+  }
+  frames= new SplatFrame[n_levels];
+  int xs= xsize;
+  int ys= ysize;
+  for (int level=0; level<n_levels; level++) {
+    frames[level].pixels= NULL;
+    frames[level].density= NULL;
+    frames[level].half_pixels= NULL;
+    frames[level].planes= NULL;
+    frames[level].xsize= xs;
+    frames[level].ysize= ys;
+    frames[level].opacity= NULL;
+    frames[level].reveal= NULL;
+    frames[level].buffer= NULL;
+    xs= (xs+1)/2;
+    ys= (ys+1)/2;
+  }
+}
+
+SplatPyramid::~SplatPyramid()
+{
+  // Level 0 belongs to the caller
+  for (int level=1; level<n_levels; level++) {
+    delete [] frames[level].pixels;
+    delete [] frames[level].density;
+  }
+  delete [] frames;
+}
+
+int SplatPyramid::level_for( const StarSplatter::Splat& splat,
+			     const double splat_limit ) const
+{
+  if (radius<=0.0 || !(splat_limit > 2.0*radius)) return 0;
+  int level= (int)floor(log(splat_limit/radius)/log(2.0));
+  if (level>=n_levels) level= n_levels-1;
+  // The painters renormalize footprints of SPLAT_RENORM_CUTOFF pixels
+  // or fewer after clipping, which would put all of the energy of a
+  // splat into the few pixels of it lying inside a level.  Such
+  // splats go to a finer level.
+  for ( ; level>0; level--) {
+    StarSplatter::Splat coarse;
+    coarsen( splat, level, coarse );
+    double limit= splat_limit/(double)(1<<level);
+    int imin= (int)(coarse.x-limit+1.0); // ceil
+    int imax= (int)(coarse.x+limit); // floor
+    int jmin= (int)(coarse.y-limit+1.0); // ceil
+    int jmax= (int)(coarse.y+limit); // floor
+    if (imin<0) imin= 0;
+    if (imax>=frames[level].xsize) imax= frames[level].xsize-1;
+    if (jmin<0) jmin= 0;
+    if (jmax>=frames[level].ysize) jmax= frames[level].ysize-1;
+    if (imin<=imax && jmin<=jmax
+	&& (imax-imin+1)*(jmax-jmin+1) > SPLAT_RENORM_CUTOFF) break;
+  }
+  return level;
+}
+
+void SplatPyramid::coarsen( const StarSplatter::Splat& in, const int level,
+			    StarSplatter::Splat& out ) const
+{
+  // in and out may be the same splat
+  double scale= (double)(1<<level);
+  float x= (in.x - 0.5*(scale-1.0))/scale;
+  float y= (in.y - 0.5*(scale-1.0))/scale;
+  float sep_fac= in.sep_fac*scale;
+  out= in;
+  out.x= x;
+  out.y= y;
+  out.sep_fac= sep_fac;
+}
+
+const SplatFrame& SplatPyramid::frame( const int level )
+{
+  long npix= (long)frames[level].xsize*frames[level].ysize;
+  if (density) {
+    if (!frames[level].density) {
+      frames[level].density= new float[npix];
+      for (long p=0; p<npix; p++) frames[level].density[p]= 0.0f;
+    }
+  }
+  else if (!frames[level].pixels) // default constructor is transparent black
+    frames[level].pixels= new gColor[npix];
+  return frames[level];
+}
+
+static void upsample_add_density( const SplatFrame& coarse, 
+				  SplatFrame& fine )
+{
+  for (int j=0; j<fine.ysize; j++) {
+    double cy= 0.5*((double)j - 0.5);
+    int j0= (int)floor(cy);
+    double fy= cy - j0;
+    int j1= j0+1;
+    if (j0<0) j0= 0;
+    if (j1>=coarse.ysize) j1= coarse.ysize-1;
+    const float* row0= coarse.density + j0*coarse.xsize;
+    const float* row1= coarse.density + j1*coarse.xsize;
+    float* out= fine.density + j*fine.xsize;
+    for (int i=0; i<fine.xsize; i++) {
+      double cx= 0.5*((double)i - 0.5);
+      int i0= (int)floor(cx);
+      double fx= cx - i0;
+      int i1= i0+1;
+      if (i0<0) i0= 0;
+      if (i1>=coarse.xsize) i1= coarse.xsize-1;
+      float w00= (float)((1.0-fx)*(1.0-fy));
+      float w10= (float)(fx*(1.0-fy));
+      float w01= (float)((1.0-fx)*fy);
+      float w11= (float)(fx*fy);
+      float sum= w00*row0[i0] + w10*row0[i1] + w01*row1[i0] + w11*row1[i1];
+      if (sum==0.0f) continue;
+      if (fine.buffer) fine.buffer->touch_pixel( i, j );
+      out[i] += sum;
+    }
+  }
+}
+
+static void upsample_add( const SplatFrame& coarse, SplatFrame& fine )
+{
+  for (int j=0; j<fine.ysize; j++) {
+    double cy= 0.5*((double)j - 0.5);
+    int j0= (int)floor(cy);
+    double fy= cy - j0;
+    int j1= j0+1;
+    if (j0<0) j0= 0;
+    if (j1>=coarse.ysize) j1= coarse.ysize-1;
+    const gColor* row0= coarse.pixels + j0*coarse.xsize;
+    const gColor* row1= coarse.pixels + j1*coarse.xsize;
+    long out= (long)j*fine.xsize;
+    for (int i=0; i<fine.xsize; i++) {
+      double cx= 0.5*((double)i - 0.5);
+      int i0= (int)floor(cx);
+      double fx= cx - i0;
+      int i1= i0+1;
+      if (i0<0) i0= 0;
+      if (i1>=coarse.xsize) i1= coarse.xsize-1;
+      float w00= (float)((1.0-fx)*(1.0-fy));
+      float w10= (float)(fx*(1.0-fy));
+      float w01= (float)((1.0-fx)*fy);
+      float w11= (float)(fx*fy);
+      gColor sum( w00*row0[i0].r() + w10*row0[i1].r()
+		  + w01*row1[i0].r() + w11*row1[i1].r(),
+		  w00*row0[i0].g() + w10*row0[i1].g()
+		  + w01*row1[i0].g() + w11*row1[i1].g(),
+		  w00*row0[i0].b() + w10*row0[i1].b()
+		  + w01*row1[i0].b() + w11*row1[i1].b(),
+		  w00*row0[i0].a() + w10*row0[i1].a()
+		  + w01*row1[i0].a() + w11*row1[i1].a() );
+      // Empty parts of a framebuffer are left untouched
+      if (sum.r()==0.0f && sum.g()==0.0f && sum.b()==0.0f && sum.a()==0.0f)
+	continue;
+      if (fine.buffer) fine.buffer->touch_pixel( i, j );
+      // Level 0 may be a framebuffer of any format
+      if (fine.pixels) fine.pixels[out+i].add_noclamp( sum );
+      else fine.buffer->add_pixel( out+i, sum );
+    }
+  }
+}
+
+void SplatPyramid::collapse( SplatFramebuffer* image )
+{
+  frames[0].pixels= image->pixels();
+  frames[0].density= image->density();
+  frames[0].buffer= image;
+  for (int level=n_levels-1; level>0; level--) {
+    if (!frames[level].pixels && !frames[level].density) continue;
+    if (level>1) frame(level-1);
+    if (density) upsample_add_density( frames[level], frames[level-1] );
+    else upsample_add( frames[level], frames[level-1] );
+    delete [] frames[level].pixels;
+    frames[level].pixels= NULL;
+    delete [] frames[level].density;
+    frames[level].density= NULL;
+  }
+  frames[0].pixels= NULL;
+  frames[0].density= NULL;
+  frames[0].buffer= NULL;
+}
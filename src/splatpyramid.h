@@ -0,0 +1,65 @@
+/****************************************************************************
+ * splatpyramid.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATPYRAMID
+#define INCL_SPLATPYRAMID
+
+#include "splatpainter.h"
+
+/* A SplatPyramid holds coarser copies of an image, each level having
+ * half the resolution of the one before.  Level 0 is the image itself,
+ * which the pyramid does not own.  Splats reaching more than twice the
+ * pyramid's radius are painted on the level at which they reach
+ * between one and two radii, and collapse() then upsamples each level
+ * bilinearly and adds it into the level below.  Pixel values are
+ * densities per unit area, and the upsampling conserves energy, so
+ * only the coarser sampling of the kernel changes it.  A splat sampled
+ * out to r pixels keeps its energy to within about 6/r percent; the
+ * worst cases are splats cut by the image edge.  Splats whose clipped
+ * footprint on their level would be small enough to be renormalized
+ * go to a finer level instead.  Since levels are summed, a pyramid
+ * is only correct for additive compositing.  The levels above 0 are
+ * density frames if the image is, and gColor frames otherwise.
+ */
+class SplatPyramid {
+ public:
+  SplatPyramid( const int xsize_in, const int ysize_in,
+		const double radius_in, const int format_in=SPF_RGBA );
+  ~SplatPyramid();
+  int nlevels() const { return n_levels; }
+  // The level on which a splat reaching splat_limit pixels is painted
+  int level_for( const StarSplatter::Splat& splat, 
+		 const double splat_limit ) const;
+  // Maps a splat into the pixel coordinates of the given level; in and
+  // out may be the same
+  void coarsen( const StarSplatter::Splat& in, const int level,
+		StarSplatter::Splat& out ) const;
+  // The frame for a level above 0, created and cleared on first use
+  const SplatFrame& frame( const int level );
+  // Adds all the levels into image, which is level 0
+  void collapse( SplatFramebuffer* image );
+ private:
+  int xsize;
+  int ysize;
+  double radius;
+  int density;
+  int n_levels;
+  SplatFrame* frames;
+};
+
+#endif // INCL_SPLATPYRAMID
@@ -0,0 +1,76 @@
+/****************************************************************************
+ * splatstamp.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "splatstamp.h"
+
+/* Notes-
+ */
+
+SplatStampCache::SplatStampCache()
+{
+  keys= NULL;
+  stamps= NULL;
+  n_stamps= 0;
+}
+
+SplatStampCache::~SplatStampCache()
+{
+  clear();
+}
+
+void SplatStampCache::clear()
+{
+  for (long i=0; i<n_stamps; i++) delete [] stamps[i].weights;
+  delete [] stamps;
+  delete [] keys;
+  keys= NULL;
+  stamps= NULL;
+  n_stamps= 0;
+}
+
+void SplatStampCache::set_keys( const unsigned long long* keys_in,
+				const long n )
+{
+  clear();
+  if (n<=0) return;
+  keys= new unsigned long long[n];
+  stamps= new SplatStamp[n];
+  for (long i=0; i<n; i++) {
+    keys[i]= keys_in[i];
+    stamps[i].imin= stamps[i].jmin= 0;
+    stamps[i].width= stamps[i].height= 0;
+    stamps[i].weights= NULL;
+  }
+  n_stamps= n;
+}
+
+const SplatStamp* SplatStampCache::find( const unsigned long long key_in )
+  const
+{
+  long lo= 0;
+  long hi= n_stamps-1;
+  while (lo<=hi) {
+    long mid= (lo+hi)/2;
+    if (keys[mid]<key_in) lo= mid+1;
+    else if (keys[mid]>key_in) hi= mid-1;
+    else return stamps+mid;
+  }
+  return NULL;
+}
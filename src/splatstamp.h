@@ -0,0 +1,56 @@
+/****************************************************************************
+ * splatstamp.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_SPLATSTAMP
+#define INCL_SPLATSTAMP
+
+/* A stamp is a pre-rasterized splat footprint.  The weights are kernel
+ * values in pixel units; the painter divides them by sep_fac^2 to get
+ * the values the exact kernel code would produce.  imin and jmin are
+ * relative to the pixel containing the splat center.
+ */
+struct SplatStamp {
+  int imin;
+  int jmin;
+  int width;
+  int height;
+  float* weights; // width*height, row major
+};
+
+/* A SplatStampCache holds stamps sorted by key, for lookup by binary
+ * search.  The cache is filled before painting starts, and is only
+ * read while painting is under way, so no locking is needed.
+ */
+class SplatStampCache {
+ public:
+  SplatStampCache();
+  ~SplatStampCache();
+  void clear();
+  // keys_in must be sorted and unique; the stamps are left empty
+  void set_keys( const unsigned long long* keys_in, const long n );
+  long nstamps() const { return n_stamps; }
+  unsigned long long key( const long i ) const { return keys[i]; }
+  SplatStamp* stamp( const long i ) { return stamps+i; }
+  const SplatStamp* find( const unsigned long long key_in ) const;
+ private:
+  unsigned long long* keys;
+  SplatStamp* stamps;
+  long n_stamps;
+};
+
+#endif // INCL_SPLATSTAMP
@@ -19,11 +19,21 @@
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#if (defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)))
+#define SPLINE_AVX2
+#include <immintrin.h>
+#endif
 
 #include "starsplatter.h"
 #include "splinesplatpainter.h"
+#include "splatbatch.h"
 
 /* Notes-
+ * The Catmull-Rom table below is resampled at construction into a
+ * finer table which is interpolated linearly, without clamping.  Each
+ * row of a splat is painted only across the span inside the kernel's
+ * support, and the weights of a span are computed eight at a time with
+ * AVX2 when the processor has it.
  */
 
 ////////////////
@@ -117,16 +127,84 @@ static inline float table_lookup(const float x_in,
   }
 }
 
-static inline double projectedSplineKernel(double hInv, double x, double y)
+/* Fills weights[0..n-1] with scale times the kernel at pixel offsets
+ * (dx0+i, dy) from the splat center, for k= hInv*sep_fac.  The scalar
+ * and AVX2 versions do the same float arithmetic.
+ */
+static void spline_row_weights_scalar( float* weights, const int n,
+				       const float dx0, const float rho2_y,
+				       const float k2, const float scale,
+				       const float* tbl )
+{
+  for (int i=0; i<n; i++) {
+    float dx= dx0 + (float)i;
+    float t= (k2*(dx*dx) + rho2_y)*(float)SPLINE_DIRECT_SIZE;
+    if (t>(float)SPLINE_DIRECT_SIZE) t= (float)SPLINE_DIRECT_SIZE;
+    int it= (int)t;
+    float u= t - (float)it;
+    weights[i]= scale*(tbl[it] + u*(tbl[it+1]-tbl[it]));
+  }
+}
+
+#ifdef SPLINE_AVX2
+__attribute__((target("avx2")))
+static void spline_row_weights_avx2( float* weights, const int n,
+				     const float dx0, const float rho2_y,
+				     const float k2, const float scale,
+				     const float* tbl )
 {
-  return (double)hInv*hInv*(8.0/M_PI)*
-    table_lookup(hInv*hInv*(x*x+y*y), 0.0, 1.0,
-		 K_PROJ_SPLINE, tbl_proj_spline);
+  const __m256 steps= _mm256_setr_ps(0.0f, 1.0f, 2.0f, 3.0f,
+				      4.0f, 5.0f, 6.0f, 7.0f);
+  const __m256 vk2= _mm256_set1_ps(k2);
+  const __m256 vrho2_y= _mm256_set1_ps(rho2_y);
+  const __m256 vsize= _mm256_set1_ps((float)SPLINE_DIRECT_SIZE);
+  const __m256 vscale= _mm256_set1_ps(scale);
+  const __m256i one= _mm256_set1_epi32(1);
+  int i= 0;
+  for (; i+8<=n; i += 8) {
+    __m256 dx= _mm256_add_ps(_mm256_set1_ps(dx0 + (float)i), steps);
+    __m256 t= _mm256_mul_ps(_mm256_add_ps(_mm256_mul_ps(vk2,
+							_mm256_mul_ps(dx,dx)),
+					  vrho2_y), vsize);
+    t= _mm256_min_ps(t, vsize);
+    __m256i it= _mm256_cvttps_epi32(t);
+    __m256 u= _mm256_sub_ps(t, _mm256_cvtepi32_ps(it));
+    __m256 lo= _mm256_i32gather_ps(tbl, it, 4);
+    __m256 hi= _mm256_i32gather_ps(tbl, _mm256_add_epi32(it, one), 4);
+    __m256 v= _mm256_add_ps(lo, _mm256_mul_ps(u, _mm256_sub_ps(hi, lo)));
+    _mm256_storeu_ps(weights+i, _mm256_mul_ps(vscale, v));
+  }
+  // Clear the upper halves before calling the SSE code for the rest,
+  // which would otherwise pay for a state transition on every row
+  _mm256_zeroupper();
+  if (i<n) 
+    spline_row_weights_scalar( weights+i, n-i, dx0+(float)i, rho2_y, 
+			       k2, scale, tbl );
 }
+
+static int have_avx2()
+{
+  static int result= -1;
+  if (result<0) {
+    __builtin_cpu_init();
+    result= __builtin_cpu_supports("avx2") ? 1 : 0;
+  }
+  return result;
+}
+#endif
+
 SplineSplatPainter::SplineSplatPainter(StarSplatter* owner_in)
   : SplatPainter(owner_in)
 {
-  // Nothing to initialize
+  for (int i=0; i<=SPLINE_DIRECT_SIZE; i++)
+    direct_tbl[i]= table_lookup((float)i/(float)SPLINE_DIRECT_SIZE, 
+				0.0, 1.0, K_PROJ_SPLINE, tbl_proj_spline);
+  // The kernel is zero at the edge of its support and beyond
+  direct_tbl[SPLINE_DIRECT_SIZE]= 0.0;
+  direct_tbl[SPLINE_DIRECT_SIZE+1]= 0.0;
+#ifdef SPLINE_AVX2
+  (void)have_avx2(); // so that later calls from threads only read
+#endif
 }
 
 SplineSplatPainter::~SplineSplatPainter()
@@ -134,6 +212,16 @@ SplineSplatPainter::~SplineSplatPainter()
   // Nothing to clean up;
 }
 
+double SplineSplatPainter::kernel( const double hInv, const double x,
+				   const double y ) const
+{
+  float weight;
+  spline_row_weights_scalar( &weight, 1, (float)(hInv*x), 
+			     (float)(hInv*hInv*y*y), 1.0f,
+			     (float)(hInv*hInv*(8.0/M_PI)), direct_tbl );
+  return weight;
+}
+
 const char* SplineSplatPainter::typeName() const
 {
   return "projected spline";
@@ -144,103 +232,127 @@ StarSplatter::SplatType SplineSplatPainter::getSplatType() const
   return StarSplatter::SPLAT_SPLINE;
 }
 
-void SplineSplatPainter::paint( const StarSplatter::Splat* splat,
-				  const double sep_fac,
-				  gColor* tmp_image, 
-				  double& krnl_integral, int& pixels_touched )
-{
-  int xsize= owner->image_xsize();
-  int ysize= owner->image_ysize();
-  int debug_flag= owner->debug();
-  gColor scaled_clr= splat->clr;
-  scaled_clr.mult_noclamp( splat->density );
-
-  gColor tmp_clr;
-
-  double splat_limit= 1.0/(splat->sqrt_exp_constant*sep_fac);
-
-  // fprintf(stderr,"spline splat: splat_limit= %f\n",splat_limit);
-
-  int imin= (int)(splat->loc.x()-splat_limit+1.0); // ceil
-  int imax= (int)(splat->loc.x()+splat_limit); // floor
-  int jmin= (int)(splat->loc.y()-splat_limit+1.0); // ceil
-  int jmax= (int)(splat->loc.y()+splat_limit); // floor
-
-  if (imin<0) imin= 0;
-  if (imax>=xsize) imax= xsize-1;
-  if (jmin<0) jmin= 0;
-  if (jmax>=ysize) jmax= ysize-1;    
-
-  int maxNSplats= ((imax-imin)+1)*((jmax-jmin)+1);
-  if (maxNSplats > (double)SPLAT_RENORM_CUTOFF) { 
-    gColor* pixrunner;
-    double y= sep_fac*((double)jmin - splat->loc.y());
-    for (int j=jmin; j<=jmax; j++) {
-      pixrunner= tmp_image + (j*xsize) + imin;
-      double x= sep_fac*((double)imin - splat->loc.x());
-      for (int i=imin; i<=imax; i++) {
-	// Calc and add color here
-	double kval= projectedSplineKernel(splat->sqrt_exp_constant,x,y);
-	tmp_clr= scaled_clr;
-	tmp_clr.mult_noclamp(kval);
-	tmp_clr.clamp_alpha();
-	tmp_clr.add_under( *pixrunner );
-	*pixrunner++= tmp_clr;
-	if (debug_flag) {
-	  pixels_touched++;
-	  krnl_integral += kval;
-	}
-	x += sep_fac;
-      }
-      y += sep_fac;
-    }
+int SplineSplatPainter::stamp_supported() const
+{
+  return 1;
+}
+
+double SplineSplatPainter::pixel_kernel( const double k, const double dx,
+					 const double dy ) const
+{
+  return kernel(k, dx, dy);
+}
+
+double SplineSplatPainter::pixel_limit( const double k ) const
+{
+  return 1.0/k;
+}
+
+double SplineSplatPainter::kernel_slope() const
+{
+  return 2.1; // measured from the lookup table
+}
+
+double SplineSplatPainter::reach( const StarSplatter::Splat* splat ) const
+{
+  return 1.0/(splat->sqrt_exp_constant*splat->sep_fac);
+}
+
+void SplineSplatPainter::footprint( const StarSplatter::Splat* splat,
+				    SplatPixelRect& rect ) const
+{
+  int i0, j0;
+  const SplatStamp* stamp= find_stamp( splat, i0, j0 );
+  if (stamp) {
+    stamp_footprint( stamp, i0, j0, rect );
+    return;
   }
-  else {
-    if (splat_limit > 1.0) {
-      /* Here we need to renormalize */
-      double samples[SPLAT_RENORM_CUTOFF];
-      double* here= samples;
-      double sum= 0.0;
-      double y= sep_fac*((double)jmin - splat->loc.y());
-      for (int j=jmin; j<=jmax; j++) {
-	double x= sep_fac*((double)imin - splat->loc.x());
-	for (int i=imin; i<=imax; i++) {
-	  double kval= projectedSplineKernel(splat->sqrt_exp_constant,x,y);
-	  assert(here-samples < SPLAT_RENORM_CUTOFF);
-	  *here++= kval;
-	  sum += kval;
-	  x += sep_fac;
-	}
-	y += sep_fac;
-      }
-      gColor* pixrunner;
-      double invSum= 1.0/(sum*sep_fac*sep_fac); // sum *should* = 1.0/(sep_fac^2)
-      //fprintf(stderr,"invSum= %g\n",invSum);
-      krnl_integral *= invSum;
-      here= samples;
-      for (int j=jmin; j<=jmax; j++) {
-	pixrunner= tmp_image + (j*xsize) + imin;
-	for (int i=imin; i<=imax; i++) {
-	  double kval= invSum*(*here++);
-	  if (debug_flag) {
-	    pixels_touched++;
-	    krnl_integral += kval;
-	  }
-	  tmp_clr= scaled_clr;
-	  tmp_clr.mult_noclamp(kval);
-	  tmp_clr.clamp_alpha();
-	  tmp_clr.add_under( *pixrunner );
-	  *pixrunner++= tmp_clr;
-	}
-      }
+  kernel_footprint( splat, 1.0/(splat->sqrt_exp_constant*splat->sep_fac),
+		    rect );
+}
+
+/* The kernel policy for the painting templates in splatbatch.h */
+class SplineKernel {
+public:
+  enum { stamps= 1 };
+  SplineKernel( const float* tbl_in )
+  {
+    tbl= tbl_in;
+#ifdef SPLINE_AVX2
+    avx2= have_avx2();
+#endif
+  }
+  template <int STATS, int FORMAT>
+  void paint( const StarSplatter::Splat* splat, 
+	      const SplatPaintContext& ctx, SplatPaintStats& stats )
+  {
+    ssplat_paint_kernel<SplineKernel,STATS,FORMAT>( *this, splat, ctx,
+						    stats );
+  }
+  double setup( const StarSplatter::Splat* splat )
+  {
+    double hInv= splat->sqrt_exp_constant;
+    k= hInv*splat->sep_fac;
+    scale= hInv*hInv*(8.0/M_PI);
+    limit= 1.0/k;
+    return limit;
+  }
+  int integrated() const { return 0; }
+  void begin_span( const StarSplatter::Splat* splat, const int i0, 
+		   const int n )
+  {
+    // Nothing to precompute
+  }
+  void row_span( const StarSplatter::Splat* splat, const int j,
+		 int& ilo, int& ihi ) const
+  {
+    // Only the columns inside the circle of support are painted
+    double dy= (double)j - splat->y;
+    double half_sqr= limit*limit - dy*dy;
+    if (half_sqr<0.0) {
+      ihi= ilo-1;
+      return;
     }
-    else {
-      small_splat( splat, splat_limit, sep_fac, 1.0/(sep_fac*sep_fac),
-		   scaled_clr,
-		   imin, imax, jmin, jmax, tmp_image,
-		   krnl_integral, pixels_touched );
+    double half= sqrt(half_sqr);
+    int rlo= (int)floor(splat->x - half) + 1;
+    int rhi= (int)floor(splat->x + half);
+    if (rlo>ilo) ilo= rlo;
+    if (rhi<ihi) ihi= rhi;
+  }
+  void row( float* weights, const int i0, const int n, const int j,
+	    const StarSplatter::Splat* splat ) const
+  {
+    double dy= (double)j - splat->y;
+    float dx0= (float)((double)i0 - splat->x);
+    float rho2_y= (float)(k*k*dy*dy);
+#ifdef SPLINE_AVX2
+    if (avx2) {
+      spline_row_weights_avx2( weights, n, dx0, rho2_y, (float)(k*k),
+			       (float)scale, tbl );
+      return;
     }
+#endif
+    spline_row_weights_scalar( weights, n, dx0, rho2_y, (float)(k*k),
+			       (float)scale, tbl );
   }
+private:
+  const float* tbl;
+#ifdef SPLINE_AVX2
+  int avx2;
+#endif
+  double k; // hInv*sep_fac
+  double scale;
+  double limit;
+};
 
+void SplineSplatPainter::paint_batch( const StarSplatter::Splat* splats,
+				      const long n,
+				      const SplatPixelRect& clip,
+				      const SplatFrame& frame,
+				      double* krnl_integral,
+				      int* pixels_touched )
+{
+  SplineKernel kernel( direct_tbl );
+  dispatch_batch( kernel, splats, n, clip, frame, 
+		  krnl_integral, pixels_touched );
 }
-
@@ -17,14 +17,30 @@
 
 #include "splatpainter.h"
 
+/* The projected spline kernel is tabulated directly against rho^2 at
+ * this many points across its support, for linear interpolation.
+ */
+#define SPLINE_DIRECT_SIZE 4096
+
 class SplineSplatPainter : public SplatPainter {
  public:
   SplineSplatPainter(StarSplatter* owner_in);
   virtual ~SplineSplatPainter();
   virtual const char* typeName() const;
   virtual StarSplatter::SplatType getSplatType() const;
-  virtual void paint( const StarSplatter::Splat* splat,
-		      const double sep_fac,
-		      gColor* tmp_image,
-		      double& krnl_integral, int& pixels_touched );
+  virtual void footprint( const StarSplatter::Splat* splat,
+			  SplatPixelRect& rect ) const;
+  virtual double reach( const StarSplatter::Splat* splat ) const;
+  virtual void paint_batch( const StarSplatter::Splat* splats, const long n,
+			    const SplatPixelRect& clip, const SplatFrame& frame,
+			    double* krnl_integral, int* pixels_touched );
+ protected:
+  virtual int stamp_supported() const;
+  virtual double pixel_kernel( const double k, const double dx, 
+			       const double dy ) const;
+  virtual double pixel_limit( const double k ) const;
+  virtual double kernel_slope() const;
+ private:
+  float direct_tbl[SPLINE_DIRECT_SIZE+2];
+  double kernel( const double hInv, const double x, const double y ) const;
 };
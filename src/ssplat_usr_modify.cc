@@ -15,648 +15,695 @@
  * implied warranty.
  *****************************************************************************/
 
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <math.h>
 
 #include "starsplatter.h"
+#include "splatpainter.h"
+#include "splatframebuffer.h"
+
+/* Notes-
+ * Each exposure type is a conversion of one raw pixel, written as a
+ * functor class.  ssplat_convert_tiles() applies a conversion to the
+ * tiles of the framebuffer which were painted, and fills the rest with
+ * its conversion of transparent black, found once.  The automatic
+ * types first find their bounds with ssplat_scan_tiles(), which also
+ * visits only painted tiles; every scan ignores black pixels, so the
+ * others could not change the bounds.  Some bounds depend on which
+ * pixel is found first, so scans go in row order as they always have.
+ * Conversions must depend only on the pixel, since they are not.
+ * Density framebuffers are read as colors with only alpha set, which
+ * is all the late colormap types reading alpha look at.
+ */
 
 double StarSplatter::default_log_rescale_min= 0.001;
 double StarSplatter::default_log_rescale_max= 1.0;
 
-int StarSplatter::convert_image_linear(rgbImage* image, 
-				       const gColor* raw_image)
+template <class Convert>
+static void ssplat_convert_tiles( rgbImage* image, 
+				  const SplatFramebuffer* raw_image,
+				  const Convert& convert )
 {
-  const gColor* pixrunner= raw_image;
-  // Linear exposure calculation
+  int xsize= raw_image->xsize();
+  int ysize= raw_image->ysize();
+  gBColor empty= convert( gColor(0.0,0.0,0.0,0.0) );
+  for (int tile=0; tile<raw_image->ntiles(); tile++) {
+    SplatPixelRect rect;
+    raw_image->tile_rect( tile, rect );
+    if (raw_image->touched(tile)) {
+      for (int jloop=rect.jmin; jloop<=rect.jmax; jloop++) {
+	long p= (long)jloop*xsize + rect.imin;
+	for (int iloop=rect.imin; iloop<=rect.imax; iloop++) 
+	  image->setpix( iloop, ysize-(jloop+1), 
+			 convert(raw_image->pixel(p++)) );
+      }
+    }
+    else {
+      for (int jloop=rect.jmin; jloop<=rect.jmax; jloop++)
+	for (int iloop=rect.imin; iloop<=rect.imax; iloop++)
+	  image->setpix( iloop, ysize-(jloop+1), empty );
+    }
+  }
+}
+
+template <class Scan>
+static void ssplat_scan_tiles( const SplatFramebuffer* raw_image, 
+			       Scan& scan )
+{
+  int xsize= raw_image->xsize();
+  int ysize= raw_image->ysize();
   for (int jloop=0; jloop<ysize; jloop++) {
-    image->setpix( 0, ysize-(jloop+1), (*pixrunner++)*exp_scale );
-    for ( ; pixrunner < raw_image + (xsize*(jloop+1)); pixrunner++) {
-      image->setnextpix( (*pixrunner)*exp_scale );
+    for (int imin=0; imin<xsize; imin += FRAMEBUFFER_TILE_SIZE) {
+      if (!raw_image->touched( raw_image->tile_of(imin,jloop) )) continue;
+      int imax= imin + FRAMEBUFFER_TILE_SIZE;
+      if (imax>xsize) imax= xsize;
+      long p= (long)jloop*xsize + imin;
+      for (int iloop=imin; iloop<imax; iloop++) scan( raw_image->pixel(p++) );
     }
   }
-  return 1;
 }
 
-int StarSplatter::convert_image_log(rgbImage* image, const gColor* raw_image)
+struct SplatLinearConvert {
+  double exp_scale;
+  gColor operator()( const gColor& raw ) const
+  { return raw*exp_scale; }
+};
+
+int StarSplatter::convert_image_linear(rgbImage* image, 
+				       const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
+  // Linear exposure calculation
+  SplatLinearConvert convert;
+  convert.exp_scale= exp_scale;
+  ssplat_convert_tiles( image, raw_image, convert );
+  return 1;
+}
 
-  fprintf(stdout,"Bounds are min %g, max %g\n",log_rescale_min,log_rescale_max);
-  double inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
-  double log_minmass= log(log_rescale_min);
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      gColor tmp_clr= gColor(pixrunner->r()*exp_scale,
-			     pixrunner->g()*exp_scale,
-			     pixrunner->b()*exp_scale,
-			     pixrunner->a()*exp_scale);
-      pixrunner++;
-      if (tmp_clr.a() != 0.0) {
-#ifdef never
-	double alpha= tmp_clr.a();
-	tmp_clr *= (1.0/alpha);
-	double scale_r= (tmp_clr.r()>0.0) ?
-	  inv_range*(log(tmp_clr.r())-log_minmass) : 0.0;
-	double scale_g= (tmp_clr.g()>0.0) ?
-	  inv_range*(log(tmp_clr.g())-log_minmass) : 0.0;
-	double scale_b= (tmp_clr.b()>0.0) ?
-	  inv_range*(log(tmp_clr.b())-log_minmass) : 0.0;
-	double scale_a= 
-	  inv_range*(log(tmp_clr.a())-log_minmass);
-#endif
-	double scale_r= (tmp_clr.r()>0.0) ?
-	  inv_range*(log(tmp_clr.r())-log_minmass) : 0.0;
-	double scale_g= (tmp_clr.g()>0.0) ?
-	  inv_range*(log(tmp_clr.g())-log_minmass) : 0.0;
-	double scale_b= (tmp_clr.b()>0.0) ?
-	  inv_range*(log(tmp_clr.b())-log_minmass) : 0.0;
-	double scale_a= 
-	  inv_range*(log(tmp_clr.a())-log_minmass);
-	gColor oclr= gColor(scale_r,scale_g,scale_b,scale_a).clamp();
-	image->setpix(iloop, ysize-(jloop+1), oclr);
+struct SplatLogConvert {
+  double exp_scale;
+  double inv_range;
+  double log_minmass;
+  gColor operator()( const gColor& raw ) const
+  {
+    gColor tmp_clr= gColor(raw.r()*exp_scale,
+			   raw.g()*exp_scale,
+			   raw.b()*exp_scale,
+			   raw.a()*exp_scale);
+    if (tmp_clr.a() == 0.0) return gColor(0.0,0.0,0.0,0.0);
+    double scale_r= (tmp_clr.r()>0.0) ?
+      inv_range*(log(tmp_clr.r())-log_minmass) : 0.0;
+    double scale_g= (tmp_clr.g()>0.0) ?
+      inv_range*(log(tmp_clr.g())-log_minmass) : 0.0;
+    double scale_b= (tmp_clr.b()>0.0) ?
+      inv_range*(log(tmp_clr.b())-log_minmass) : 0.0;
+    double scale_a= 
+      inv_range*(log(tmp_clr.a())-log_minmass);
+    return gColor(scale_r,scale_g,scale_b,scale_a).clamp();
+  }
+};
+
+struct SplatLogScan {
+  double exp_scale;
+  double minmass;
+  double maxmass;
+  int foundSome;
+  void operator()( const gColor& raw )
+  {
+    gColor tmp_clr= gColor(raw.r()*exp_scale,
+			   raw.g()*exp_scale,
+			   raw.b()*exp_scale,
+			   raw.a()*exp_scale);
+    if (tmp_clr.a() != 0.0) {
+      if (!foundSome) {
+	minmass= maxmass= tmp_clr.a();
+	foundSome= 1;
       }
-      else
-	image->setpix(iloop, ysize-(jloop+1),
-		      gColor(0.0,0.0,0.0,0.0));
+      if (tmp_clr.r()>0.0 && tmp_clr.r()<minmass) minmass= tmp_clr.r();
+      if (tmp_clr.r()>maxmass) maxmass= tmp_clr.r();
+      if (tmp_clr.g()>0.0 && tmp_clr.g()<minmass) minmass= tmp_clr.g();
+      if (tmp_clr.g()>maxmass) maxmass= tmp_clr.g();
+      if (tmp_clr.b()>0.0 && tmp_clr.b()<minmass) minmass= tmp_clr.b();
+      if (tmp_clr.b()>maxmass) maxmass= tmp_clr.b();
+      if (tmp_clr.a()<minmass) minmass= tmp_clr.a();
+      if (tmp_clr.a()>maxmass) maxmass= tmp_clr.a();
     }
+  }
+};
+
+int StarSplatter::convert_image_log(rgbImage* image, 
+				    const SplatFramebuffer* raw_image)
+{
+  fprintf(stdout,"Bounds are min %g, max %g\n",log_rescale_min,log_rescale_max);
+  SplatLogConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
+  convert.log_minmass= log(log_rescale_min);
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
 int StarSplatter::convert_image_log_auto(rgbImage* image, 
-					 const gColor* raw_image)
+					 const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
-  double minmass = 0.0;
-  double maxmass = 0.0;
-  int foundSome= 0;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      gColor tmp_clr= gColor(pixrunner->r()*exp_scale,
-			     pixrunner->g()*exp_scale,
-			     pixrunner->b()*exp_scale,
-			     pixrunner->a()*exp_scale);
-      pixrunner++;
-      if (tmp_clr.a() != 0.0) {
-	if (!foundSome) {
-	  minmass= maxmass= tmp_clr.a();
-	  foundSome= 1;
-	}
-	if (tmp_clr.r()>0.0 && tmp_clr.r()<minmass) minmass= tmp_clr.r();
-	if (tmp_clr.r()>maxmass) maxmass= tmp_clr.r();
-	if (tmp_clr.g()>0.0 && tmp_clr.g()<minmass) minmass= tmp_clr.g();
-	if (tmp_clr.g()>maxmass) maxmass= tmp_clr.g();
-	if (tmp_clr.b()>0.0 && tmp_clr.b()<minmass) minmass= tmp_clr.b();
-	if (tmp_clr.b()>maxmass) maxmass= tmp_clr.b();
-	if (tmp_clr.a()<minmass) minmass= tmp_clr.a();
-	if (tmp_clr.a()>maxmass) maxmass= tmp_clr.a();
-      }
-    }
-  }
-  if (!foundSome) {
+  SplatLogScan scan;
+  scan.exp_scale= exp_scale;
+  scan.minmass = 0.0;
+  scan.maxmass = 0.0;
+  scan.foundSome= 0;
+  ssplat_scan_tiles( raw_image, scan );
+  if (!scan.foundSome) {
     fprintf(stderr,"splat_all_stars: can't rescale black image!\n");
     return 0;
   }
   
-  fprintf(stdout,"log autoscale bounds %g, %g\n", minmass, maxmass);
+  fprintf(stdout,"log autoscale bounds %g, %g\n", scan.minmass, scan.maxmass);
   
-  double log_maxmass= log(maxmass);
-  double log_minmass= log(minmass);
-  double inv_range=1.0/(log_maxmass-log_minmass);
-  pixrunner= raw_image;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      gColor tmp_clr= gColor(pixrunner->r()*exp_scale,
-			     pixrunner->g()*exp_scale,
-			     pixrunner->b()*exp_scale,
-			     pixrunner->a()*exp_scale);
-      pixrunner++;
-      if (tmp_clr.a() != 0.0) {
-	double scale_r= (tmp_clr.r()>0.0) ?
-	  inv_range*(log(tmp_clr.r())-log_minmass) : 0.0;
-	double scale_g= (tmp_clr.g()>0.0) ?
-	  inv_range*(log(tmp_clr.g())-log_minmass) : 0.0;
-	double scale_b= (tmp_clr.b()>0.0) ?
-	  inv_range*(log(tmp_clr.b())-log_minmass) : 0.0;
-	double scale_a= 
-	  inv_range*(log(tmp_clr.a())-log_minmass);
-	gColor oclr= gColor(scale_r,scale_g,scale_b,scale_a).clamp();
-	image->setpix(iloop, ysize-(jloop+1), oclr);
-	
-      }
-      else 
-	image->setpix(iloop, ysize-(jloop+1),
-		      gColor(0.0,0.0,0.0,0.0));
-    }
-  }
+  double log_maxmass= log(scan.maxmass);
+  double log_minmass= log(scan.minmass);
+  SplatLogConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.inv_range=1.0/(log_maxmass-log_minmass);
+  convert.log_minmass= log_minmass;
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
+struct SplatConstantConvert {
+  gColor clr;
+  gColor operator()( const gColor& raw ) const { return clr; }
+};
+
+struct SplatNoopacLinearConvert {
+  float rescale;
+  gColor operator()( const gColor& raw ) const
+  {
+    float r= raw.r()*rescale;
+    float g= raw.g()*rescale;
+    float b= raw.b()*rescale;
+    float lclMax= fmax(r,fmax(g,b));
+    return gColor(r,g,b,lclMax).clamp();
+  }
+};
+
+struct SplatMaxScan {
+  float max;
+  void operator()( const gColor& raw )
+  {
+    if (raw.r()>max) max= raw.r();
+    if (raw.g()>max) max= raw.g();
+    if (raw.b()>max) max= raw.b();
+  }
+};
+
 int StarSplatter::convert_image_noopac_linear(rgbImage* image, 
-					      const gColor* raw_image)
+				  const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
-  float max= 0.0;
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      if (pixrunner->r()>max) max= pixrunner->r();
-      if (pixrunner->g()>max) max= pixrunner->g();
-      if (pixrunner->b()>max) max= pixrunner->b();
-      pixrunner++;
-    }
-  if (max==0.0) {
-    for (int jloop=0; jloop<ysize; jloop++) 
-      for (int iloop=0; iloop<xsize; iloop++) 
-	image->setpix(iloop,ysize-(jloop+1), gColor(0.0,0.0,0.0));
+  SplatMaxScan scan;
+  scan.max= 0.0;
+  ssplat_scan_tiles( raw_image, scan );
+  if (scan.max==0.0) {
+    SplatConstantConvert convert;
+    convert.clr= gColor(0.0,0.0,0.0);
+    ssplat_convert_tiles( image, raw_image, convert );
   }
   else {
-    float rescale= exp_scale/max;
-    pixrunner= raw_image;
-    for (int jloop=0; jloop<ysize; jloop++) 
-      for (int iloop=0; iloop<xsize; iloop++) {
-	float r= pixrunner->r()*rescale;
-	float g= pixrunner->g()*rescale;
-	float b= pixrunner->b()*rescale;
-	float lclMax= fmax(r,fmax(g,b));
-	gColor oclr= gColor(r,g,b,lclMax).clamp();
-	image->setpix(iloop, ysize-(jloop+1), oclr);
-	pixrunner++;
-      }
+    SplatNoopacLinearConvert convert;
+    convert.rescale= exp_scale/scan.max;
+    ssplat_convert_tiles( image, raw_image, convert );
   }
   return 1;
 }
 
+struct SplatNoopacLogConvert {
+  double exp_scale;
+  double inv_range;
+  double log_minmass;
+  gColor operator()( const gColor& raw ) const
+  {
+    float r= raw.r()*exp_scale;
+    float g= raw.g()*exp_scale;
+    float b= raw.b()*exp_scale;
+    float scale_r= (r>0.0) ? inv_range*(log(r)-log_minmass) : 0.0;
+    float scale_g= (g>0.0) ? inv_range*(log(g)-log_minmass) : 0.0;
+    float scale_b= (b>0.0) ? inv_range*(log(b)-log_minmass) : 0.0;
+    float lclMax= fmax(r,fmax(g,b));
+    return gColor(scale_r,scale_g,scale_b,lclMax).clamp();
+  }
+};
+
+struct SplatNoopacLogScan {
+  double exp_scale;
+  float minmass;
+  float maxmass;
+  int foundSome;
+  void operator()( const gColor& raw )
+  {
+    float r= raw.r()*exp_scale;
+    float g= raw.g()*exp_scale;
+    float b= raw.b()*exp_scale;
+    float low= fmin(r,fmin(g,b));
+    float high= fmax(r,fmax(g,b));
+    if (high>0.0) {
+      if (!foundSome) {
+	minmass= maxmass= high;
+	foundSome= 1;
+      }
+    }
+    if (maxmass<high) maxmass= high;
+    if (low>0.0 && minmass>low) minmass= low;
+  }
+};
+
 int StarSplatter::convert_image_noopac_log(rgbImage* image, 
-					   const gColor* raw_image)
+					   const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
-
   fprintf(stdout,"Bounds are min %g, max %g\n",log_rescale_min,log_rescale_max);
-  double inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
-  double log_minmass= log(log_rescale_min);
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      float r= pixrunner->r()*exp_scale;
-      float g= pixrunner->g()*exp_scale;
-      float b= pixrunner->b()*exp_scale;
-      float scale_r= (r>0.0) ? inv_range*(log(r)-log_minmass) : 0.0;
-      float scale_g= (g>0.0) ? inv_range*(log(g)-log_minmass) : 0.0;
-      float scale_b= (b>0.0) ? inv_range*(log(b)-log_minmass) : 0.0;
-      float lclMax= fmax(r,fmax(g,b));
-      gColor oclr= gColor(scale_r,scale_g,scale_b,lclMax).clamp();
-      image->setpix(iloop, ysize-(jloop+1), oclr);
-      pixrunner++;
-    }
+  SplatNoopacLogConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
+  convert.log_minmass= log(log_rescale_min);
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
 int StarSplatter::convert_image_noopac_log_auto(rgbImage* image, 
-						const gColor* raw_image)
+				  const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
-  float minmass = 0.0;
-  float maxmass = 0.0;
-  int foundSome= 0;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      float r= pixrunner->r()*exp_scale;
-      float g= pixrunner->g()*exp_scale;
-      float b= pixrunner->b()*exp_scale;
-      float low= fmin(r,fmin(g,b));
-      float high= fmax(r,fmax(g,b));
-      if (high>0.0) {
-	if (!foundSome) {
-	  minmass= maxmass= high;
-	  foundSome= 1;
-	}
-      }
-      if (maxmass<high) maxmass= high;
-      if (low>0.0 && minmass>low) minmass= low;
-      pixrunner++;
-    }
-  }
-  if (!foundSome) {
+  SplatNoopacLogScan scan;
+  scan.exp_scale= exp_scale;
+  scan.minmass = 0.0;
+  scan.maxmass = 0.0;
+  scan.foundSome= 0;
+  ssplat_scan_tiles( raw_image, scan );
+  if (!scan.foundSome) {
     fprintf(stderr,"splat_all_stars: can't rescale black image!\n");
     return 0;
   }
   
-  fprintf(stdout,"log autoscale bounds %g, %g\n", minmass, maxmass);
+  fprintf(stdout,"log autoscale bounds %g, %g\n", scan.minmass, scan.maxmass);
   
-  double inv_range=1.0/(log(maxmass) - log(minmass));
-  double log_minmass= log(minmass);
-  pixrunner= raw_image;
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      float r= pixrunner->r()*exp_scale;
-      float g= pixrunner->g()*exp_scale;
-      float b= pixrunner->b()*exp_scale;
-      float scale_r= (r>0.0) ? inv_range*(log(r)-log_minmass) : 0.0;
-      float scale_g= (g>0.0) ? inv_range*(log(g)-log_minmass) : 0.0;
-      float scale_b= (b>0.0) ? inv_range*(log(b)-log_minmass) : 0.0;
-      float lclMax= fmax(r,fmax(g,b));
-      gColor oclr= gColor(scale_r,scale_g,scale_b,lclMax).clamp();
-      image->setpix(iloop, ysize-(jloop+1), oclr);
-      pixrunner++;
-    }
-
+  SplatNoopacLogConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.inv_range=1.0/(log(scan.maxmass) - log(scan.minmass));
+  convert.log_minmass= log(scan.minmass);
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
+struct SplatNoopacLogHSVConvert {
+  double exp_scale;
+  double inv_range;
+  double log_minmass;
+  gColor operator()( const gColor& raw ) const
+  {
+    float r= raw.r()*exp_scale;
+    float g= raw.g()*exp_scale;
+    float b= raw.b()*exp_scale;
+    float lclMax= fmax(r,fmax(g,b));
+    if (!(lclMax>0.0)) return gColor(0.0,0.0,0.0,0.0);
+    gColor tmp_clr= gColor(r,g,b,lclMax);
+    gHSVColor tmp_hsv= tmp_clr; // conversion happens in copy
+    double scale_v= (tmp_hsv.v()>0.0) ?
+      inv_range*(log(tmp_hsv.v())-log_minmass) : 0.0;
+    double scale_a= 
+      inv_range*(log(tmp_clr.a())-log_minmass);
+    gHSVColor ohsv= gHSVColor(tmp_hsv.h(),tmp_hsv.s(),scale_v,scale_a);
+    return gColor(ohsv).clamp();
+  }
+};
+
 int StarSplatter::convert_image_noopac_log_hsv(rgbImage* image, 
-					       const gColor* raw_image)
+				  const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
-
   fprintf(stdout,"Bounds are min %g, max %g\n",log_rescale_min,log_rescale_max);
-  double inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
-  double log_minmass= log(log_rescale_min);
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      float r= pixrunner->r()*exp_scale;
-      float g= pixrunner->g()*exp_scale;
-      float b= pixrunner->b()*exp_scale;
-      float lclMax= fmax(r,fmax(g,b));
-      if (lclMax>0.0) {
-	gColor tmp_clr= gColor(r,g,b,lclMax);
-	gHSVColor tmp_hsv= tmp_clr; // conversion happens in copy
-	double scale_v= (tmp_hsv.v()>0.0) ?
-	  inv_range*(log(tmp_hsv.v())-log_minmass) : 0.0;
-	double scale_a= 
-	  inv_range*(log(tmp_clr.a())-log_minmass);
-	gHSVColor ohsv= gHSVColor(tmp_hsv.h(),tmp_hsv.s(),scale_v,scale_a);
-	gColor oclr= gColor(ohsv).clamp();
-	image->setpix(iloop, ysize-(jloop+1), oclr);	
-      }
-      else {
-	image->setpix(iloop, ysize-(jloop+1),
-		      gColor(0.0,0.0,0.0,0.0));
-      }
-      pixrunner++;
-    }
+  SplatNoopacLogHSVConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
+  convert.log_minmass= log(log_rescale_min);
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
-int StarSplatter::convert_image_noopac_log_hsv_auto(rgbImage* image, 
-						    const gColor* raw_image)
+/* The automatic HSV types scale the value of each pixel's HSV color;
+ * without opacity, alpha is the largest color component.
+ */
+static gHSVColor ssplat_scaled_hsv( const gColor& raw, const double exp_scale,
+				    const int noopac )
 {
-  
-  const gColor* pixrunner= raw_image;
-  gHSVColor* hsvImage= new gHSVColor[xsize*ysize];
-  gHSVColor* hsvrunner= hsvImage;
-  for (pixrunner= raw_image; pixrunner<raw_image+(xsize*ysize);
-       pixrunner++) {
-    float r= pixrunner->r();
-    float g= pixrunner->g();
-    float b= pixrunner->b();
+  gHSVColor hsv;
+  if (noopac) {
+    float r= raw.r();
+    float g= raw.g();
+    float b= raw.b();
     float lclMax= fmax(r,fmax(g,b));
-    *hsvrunner= gColor(r,g,b,lclMax); // conversion happens during assignment
-    hsvrunner->scale_value(exp_scale);
-    hsvrunner++;
+    hsv= gColor(r,g,b,lclMax); // conversion happens during assignment
   }
-  
-  double minmass = 0.0;
-  double maxmass = 0.0;
-  int foundSome= 0;
-  hsvrunner= hsvImage;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      gHSVColor tmp_hsv= *hsvrunner++;
-      if (tmp_hsv.a() != 0.0) {
-	if (!foundSome) {
-	  minmass= maxmass= tmp_hsv.a(); // set from lclMax and exp_scale above
-	  foundSome= 1;
-	}
-	if (tmp_hsv.v()>0.0 && tmp_hsv.v()<minmass) minmass= tmp_hsv.v();
-	if (tmp_hsv.v()>maxmass) maxmass= tmp_hsv.v();
+  else hsv= raw; // conversion happens during assignment
+  hsv.scale_value(exp_scale);
+  return hsv;
+}
+
+struct SplatHSVScan {
+  double exp_scale;
+  int noopac;
+  double minmass;
+  double maxmass;
+  int foundSome;
+  void operator()( const gColor& raw )
+  {
+    gHSVColor tmp_hsv= ssplat_scaled_hsv( raw, exp_scale, noopac );
+    if (tmp_hsv.a() != 0.0) {
+      if (!foundSome) {
+	minmass= maxmass= tmp_hsv.a();
+	foundSome= 1;
       }
+      if (tmp_hsv.v()>0.0 && tmp_hsv.v()<minmass) minmass= tmp_hsv.v();
+      if (tmp_hsv.v()>maxmass) maxmass= tmp_hsv.v();
     }
   }
-  if (!foundSome) {
+};
+
+struct SplatHSVAutoConvert {
+  double exp_scale;
+  int noopac;
+  double inv_range;
+  double log_minmass;
+  gColor operator()( const gColor& raw ) const
+  {
+    gHSVColor tmp_hsv= ssplat_scaled_hsv( raw, exp_scale, noopac );
+    if (tmp_hsv.a() == 0.0) return gColor(0.0,0.0,0.0,0.0);
+    double scale_v= (tmp_hsv.v()>0.0) ?
+      inv_range*(log(tmp_hsv.v())-log_minmass) : 0.0;
+    double scale_a= 
+      inv_range*(log(tmp_hsv.a())-log_minmass);
+    gHSVColor ohsv= gHSVColor(tmp_hsv.h(),tmp_hsv.s(),
+			      scale_v,scale_a);
+    return gColor(ohsv);
+  }
+};
+
+int StarSplatter::convert_image_noopac_log_hsv_auto(rgbImage* image, 
+					    const SplatFramebuffer* raw_image)
+{
+  SplatHSVScan scan;
+  scan.exp_scale= exp_scale;
+  scan.noopac= 1;
+  scan.minmass = 0.0;
+  scan.maxmass = 0.0;
+  scan.foundSome= 0;
+  ssplat_scan_tiles( raw_image, scan );
+  if (!scan.foundSome) {
     fprintf(stderr,"splat_all_stars: can't rescale black image!\n");
     return 0;
   }
   
-  fprintf(stdout,"hsv log autoscale bounds %g, %g\n", minmass, maxmass);
+  fprintf(stdout,"hsv log autoscale bounds %g, %g\n", 
+	  scan.minmass, scan.maxmass);
   
-  double log_maxmass= log(maxmass);
-  double log_minmass= log(minmass);
-  double inv_range=1.0/(log_maxmass-log_minmass);
-  hsvrunner= hsvImage;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      gHSVColor tmp_hsv= *hsvrunner++;
-      if (tmp_hsv.a() != 0.0) {
-	double scale_v= (tmp_hsv.v()>0.0) ?
-	  inv_range*(log(tmp_hsv.v())-log_minmass) : 0.0;
-	double scale_a= 
-	  inv_range*(log(tmp_hsv.a())-log_minmass);
-	gHSVColor ohsv= gHSVColor(tmp_hsv.h(),tmp_hsv.s(),
-				  scale_v,scale_a);
-	gColor oclr= gColor(ohsv);
-	image->setpix(iloop, ysize-(jloop+1), oclr);
-      }
-      else 
-	image->setpix(iloop, ysize-(jloop+1),
-		      gColor(0.0,0.0,0.0,0.0));
-    }
-  }
-
-  delete [] hsvImage;
-
+  double log_maxmass= log(scan.maxmass);
+  double log_minmass= log(scan.minmass);
+  SplatHSVAutoConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.noopac= 1;
+  convert.inv_range=1.0/(log_maxmass-log_minmass);
+  convert.log_minmass= log_minmass;
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
+struct SplatLuptonConvert {
+  double exp_scale;
+  double log_rescale_min;
+  gColor operator()( const gColor& raw ) const
+  {
+    float r= raw.r()*exp_scale;
+    float g= raw.g()*exp_scale;
+    float b= raw.b()*exp_scale;
+    float intens= r+g+b;
+    float scale= asinh(intens/log_rescale_min)/intens;
+    r *= scale;
+    g *= scale;
+    b *= scale;
+    return gColor(r,g,b,scale).clamp();
+  }
+};
+
 int StarSplatter::convert_image_lupton(rgbImage* image, 
-				       const gColor* raw_image)
+				       const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
-  pixrunner= raw_image;
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      float r= pixrunner->r()*exp_scale;
-      float g= pixrunner->g()*exp_scale;
-      float b= pixrunner->b()*exp_scale;
-      float intens= r+g+b;
-      float scale= asinh(intens/log_rescale_min)/intens;
-      r *= scale;
-      g *= scale;
-      b *= scale;
-      gColor oclr= gColor(r,g,b,scale).clamp();
-      image->setpix(iloop, ysize-(jloop+1), oclr);
-      pixrunner++;
-    }
+  SplatLuptonConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.log_rescale_min= log_rescale_min;
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
+struct SplatLogHSVConvert {
+  double exp_scale;
+  double inv_range;
+  double log_minmass;
+  gColor operator()( const gColor& raw ) const
+  {
+    gColor tmp_clr= gColor(raw.r()*exp_scale,
+			   raw.g()*exp_scale,
+			   raw.b()*exp_scale,
+			   raw.a()*exp_scale);
+    if (tmp_clr.a() == 0.0) return gColor(0.0,0.0,0.0,0.0);
+    gHSVColor tmp_hsv= tmp_clr; // conversion happens in copy
+    double scale_v= (tmp_hsv.v()>0.0) ?
+      inv_range*(log(tmp_hsv.v())-log_minmass) : 0.0;
+    double scale_a= 
+      inv_range*(log(tmp_clr.a())-log_minmass);
+    gHSVColor ohsv= gHSVColor(tmp_hsv.h(),tmp_hsv.s(),scale_v,scale_a);
+    return gColor(ohsv).clamp();
+  }
+};
+
 int StarSplatter::convert_image_log_hsv(rgbImage* image, 
-					const gColor* raw_image)
+					const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
   fprintf(stdout,"Bounds are min %g, max %g\n",log_rescale_min,log_rescale_max);
-  double inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
-  double log_minmass= log(log_rescale_min);
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      gColor tmp_clr= gColor(pixrunner->r()*exp_scale,
-			     pixrunner->g()*exp_scale,
-			     pixrunner->b()*exp_scale,
-			     pixrunner->a()*exp_scale);
-      pixrunner++;
-      if (tmp_clr.a() != 0.0) {
-	gHSVColor tmp_hsv= tmp_clr; // conversion happens in copy
-	double scale_v= (tmp_hsv.v()>0.0) ?
-	  inv_range*(log(tmp_hsv.v())-log_minmass) : 0.0;
-	double scale_a= 
-	  inv_range*(log(tmp_clr.a())-log_minmass);
-	gHSVColor ohsv= gHSVColor(tmp_hsv.h(),tmp_hsv.s(),scale_v,scale_a);
-	gColor oclr= gColor(ohsv).clamp();
-	image->setpix(iloop, ysize-(jloop+1), oclr);
-      }
-      else
-	image->setpix(iloop, ysize-(jloop+1),
-		      gColor(0.0,0.0,0.0,0.0));
-    }
+  SplatLogHSVConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
+  convert.log_minmass= log(log_rescale_min);
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
 int StarSplatter::convert_image_log_hsv_auto(rgbImage* image, 
-					     const gColor* raw_image)
+					     const SplatFramebuffer* raw_image)
 {
-  const gColor* pixrunner= raw_image;
-  gHSVColor* hsvImage= new gHSVColor[xsize*ysize];
-  gHSVColor* hsvrunner= hsvImage;
-  for (pixrunner= raw_image; pixrunner<raw_image+(xsize*ysize);
-       pixrunner++) {
-    *hsvrunner= *pixrunner; // conversion happens during assignment
-    hsvrunner->scale_value(exp_scale);
-    hsvrunner++;
-  }
-  
-  double minmass = 0.0;
-  double maxmass = 0.0;
-  int foundSome= 0;
-  hsvrunner= hsvImage;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      gHSVColor tmp_hsv= *hsvrunner++;
-      if (tmp_hsv.a() != 0.0) {
-	if (!foundSome) {
-	  minmass= maxmass= tmp_hsv.a();
-	  foundSome= 1;
-	}
-	if (tmp_hsv.v()>0.0 && tmp_hsv.v()<minmass) minmass= tmp_hsv.v();
-	if (tmp_hsv.v()>maxmass) maxmass= tmp_hsv.v();
-      }
-    }
-  }
-  if (!foundSome) {
+  SplatHSVScan scan;
+  scan.exp_scale= exp_scale;
+  scan.noopac= 0;
+  scan.minmass = 0.0;
+  scan.maxmass = 0.0;
+  scan.foundSome= 0;
+  ssplat_scan_tiles( raw_image, scan );
+  if (!scan.foundSome) {
     fprintf(stderr,"splat_all_stars: can't rescale black image!\n");
     return 0;
   }
   
-  fprintf(stdout,"hsv log autoscale bounds %g, %g\n", minmass, maxmass);
+  fprintf(stdout,"hsv log autoscale bounds %g, %g\n", 
+	  scan.minmass, scan.maxmass);
   
-  double log_maxmass= log(maxmass);
-  double log_minmass= log(minmass);
-  double inv_range=1.0/(log_maxmass-log_minmass);
-  hsvrunner= hsvImage;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      gHSVColor tmp_hsv= *hsvrunner++;
-      if (tmp_hsv.a() != 0.0) {
-	double scale_v= (tmp_hsv.v()>0.0) ?
-	  inv_range*(log(tmp_hsv.v())-log_minmass) : 0.0;
-	double scale_a= 
-	  inv_range*(log(tmp_hsv.a())-log_minmass);
-	gHSVColor ohsv= gHSVColor(tmp_hsv.h(),tmp_hsv.s(),
-				  scale_v,scale_a);
-	gColor oclr= gColor(ohsv);
-	image->setpix(iloop, ysize-(jloop+1), oclr);
+  double log_maxmass= log(scan.maxmass);
+  double log_minmass= log(scan.minmass);
+  SplatHSVAutoConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.noopac= 0;
+  convert.inv_range=1.0/(log_maxmass-log_minmass);
+  convert.log_minmass= log_minmass;
+  ssplat_convert_tiles( image, raw_image, convert );
+  return 1;
+}
+
+/* The late colormap types map either the red channel or alpha */
+struct SplatLateCmapConvert {
+  double exp_scale;
+  int use_alpha;
+  StarBunchCMap* cmap;
+  gColor operator()( const gColor& raw ) const
+  {
+    double val= ((use_alpha) ? raw.a() : raw.r())*exp_scale;
+    return cmap->map(val);
+  }
+};
+
+struct SplatLateCmapLogConvert {
+  double exp_scale;
+  int use_alpha;
+  StarBunchCMap* cmap;
+  double inv_range;
+  double log_minmass;
+  gColor operator()( const gColor& raw ) const
+  {
+    double val= ((use_alpha) ? raw.a() : raw.r())*exp_scale;
+    val= (val>0.0) ? inv_range*(log(val)-log_minmass) : 0.0;
+    return cmap->map(val);
+  }
+};
+
+struct SplatLateCmapScan {
+  double exp_scale;
+  int use_alpha;
+  double minmass;
+  double maxmass;
+  int foundSome;
+  void operator()( const gColor& raw )
+  {
+    double val= ((use_alpha) ? raw.a() : raw.r())*exp_scale;
+    if (val != 0.0) {
+      if (!foundSome) {
+	minmass= maxmass= val;
+	foundSome= 1;
       }
-      else 
-	image->setpix(iloop, ysize-(jloop+1),
-		      gColor(0.0,0.0,0.0,0.0));
+      if (val>0.0 && val<minmass) minmass= val;
+      if (val>maxmass) maxmass= val;
     }
   }
-  delete [] hsvImage;
-  return 1;
-}
+};
 
 int StarSplatter::convert_image_late_cmap_r(rgbImage* image, 
-					    const gColor* raw_image)
+					    const SplatFramebuffer* raw_image)
 {
   if (!late_cmap) {
     fprintf(stderr,"late_cmap has not been set!\n");
     return 0;
   }
-  const gColor* pixrunner= raw_image;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    double val= pixrunner->r()*exp_scale;
-    image->setpix( 0, ysize-(jloop+1), late_cmap->map(val) );
-    for ( ; pixrunner < raw_image + (xsize*(jloop+1)); pixrunner++) {
-      val= (*pixrunner++).r()*exp_scale;
-      image->setnextpix( late_cmap->map(val) );
-    }
-  }
+  SplatLateCmapConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.use_alpha= 0;
+  convert.cmap= late_cmap;
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
 int StarSplatter::convert_image_late_cmap_a(rgbImage* image, 
-					    const gColor* raw_image)
+					    const SplatFramebuffer* raw_image)
 {
   if (!late_cmap) {
     fprintf(stderr,"late_cmap has not been set!\n");
     return 0;
   }
-  const gColor* pixrunner= raw_image;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    double val= pixrunner->a()*exp_scale;
-    image->setpix( 0, ysize-(jloop+1), late_cmap->map(val) );
-    for ( ; pixrunner < raw_image + (xsize*(jloop+1)); pixrunner++) {
-      val= (*pixrunner++).a()*exp_scale;
-      image->setnextpix( late_cmap->map(val) );
-    }
-  }
+  SplatLateCmapConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.use_alpha= 1;
+  convert.cmap= late_cmap;
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
 int StarSplatter::convert_image_late_cmap_log_r(rgbImage* image, 
-						const gColor* raw_image)
+				  const SplatFramebuffer* raw_image)
 {
   if (!late_cmap) {
     fprintf(stderr,"late_cmap has not been set!\n");
     return 0;
   }
-  const gColor* pixrunner= raw_image;
   fprintf(stdout,"Bounds are min %g, max %g\n",
 	  log_rescale_min,log_rescale_max);
-  double inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
-  double log_minmass= log(log_rescale_min);
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      double val= (*pixrunner++).r()*exp_scale;
-      val= (val>0.0) ? inv_range*(log(val)-log_minmass) : 0.0;
-      gColor oclr= late_cmap->map(val);
-      image->setpix(iloop, ysize-(jloop+1), oclr);
-    }
+  SplatLateCmapLogConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.use_alpha= 0;
+  convert.cmap= late_cmap;
+  convert.inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
+  convert.log_minmass= log(log_rescale_min);
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
 int StarSplatter::convert_image_late_cmap_log_a(rgbImage* image, 
-						const gColor* raw_image)
+				  const SplatFramebuffer* raw_image)
 {
   if (!late_cmap) {
     fprintf(stderr,"late_cmap has not been set!\n");
     return 0;
   }
-  const gColor* pixrunner= raw_image;
   fprintf(stdout,"Bounds are min %g, max %g\n",
 	  log_rescale_min,log_rescale_max);
-  double inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
-  double log_minmass= log(log_rescale_min);
-  for (int jloop=0; jloop<ysize; jloop++) 
-    for (int iloop=0; iloop<xsize; iloop++) {
-      double val= (*pixrunner++).a()*exp_scale;
-      val= (val>0.0)?inv_range*(log(val)-log_minmass) : 0.0;
-      gColor oclr= late_cmap->map(val);
-      image->setpix(iloop, ysize-(jloop+1), oclr);
-    }
+  SplatLateCmapLogConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.use_alpha= 1;
+  convert.cmap= late_cmap;
+  convert.inv_range=1.0/(log(log_rescale_max) - log(log_rescale_min));
+  convert.log_minmass= log(log_rescale_min);
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
 int StarSplatter::convert_image_late_cmap_log_r_auto(rgbImage* image, 
-						     const gColor* raw_image)
+				  const SplatFramebuffer* raw_image)
 {
   if (!late_cmap) {
     fprintf(stderr,"late_cmap has not been set!\n");
     return 0;
   }
-  const gColor* pixrunner= raw_image;
-  double minmass = 0.0;
-  double maxmass = 0.0;
-  int foundSome= 0;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      double val= (*pixrunner++).r()*exp_scale;
-      if (val != 0.0) {
-	if (!foundSome) {
-	  minmass= maxmass= val;
-	  foundSome= 1;
-	}
-	if (val>0.0 && val<minmass) minmass= val;
-	if (val>maxmass) maxmass= val;
-      }
-    }
-  }
-  if (!foundSome) {
+  SplatLateCmapScan scan;
+  scan.exp_scale= exp_scale;
+  scan.use_alpha= 0;
+  scan.minmass = 0.0;
+  scan.maxmass = 0.0;
+  scan.foundSome= 0;
+  ssplat_scan_tiles( raw_image, scan );
+  if (!scan.foundSome) {
     fprintf(stderr,"splat_all_stars: can't rescale black image!\n");
     return 0;
   }
   
-  fprintf(stdout,"log autoscale bounds %g, %g\n", minmass, maxmass);
+  fprintf(stdout,"log autoscale bounds %g, %g\n", scan.minmass, scan.maxmass);
   
-  double log_maxmass= log(maxmass);
-  double log_minmass= log(minmass);
-  double inv_range=1.0/(log_maxmass-log_minmass);
-  pixrunner= raw_image;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      double val= (*pixrunner++).r()*exp_scale;
-      val= (val>0.0) ? inv_range*(log(val)-log_minmass) : 0.0;
-      gColor oclr= late_cmap->map(val);
-      image->setpix(iloop, ysize-(jloop+1), oclr);
-    }
-  }
+  double log_maxmass= log(scan.maxmass);
+  double log_minmass= log(scan.minmass);
+  SplatLateCmapLogConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.use_alpha= 0;
+  convert.cmap= late_cmap;
+  convert.inv_range=1.0/(log_maxmass-log_minmass);
+  convert.log_minmass= log_minmass;
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
 int StarSplatter::convert_image_late_cmap_log_a_auto(rgbImage* image, 
-						     const gColor* raw_image)
+				  const SplatFramebuffer* raw_image)
 {
   if (!late_cmap) {
     fprintf(stderr,"late_cmap has not been set!\n");
     return 0;
   }
-  const gColor* pixrunner= raw_image;
-  double minmass = 0.0;
-  double maxmass = 0.0;
-  int foundSome= 0;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      double val= (*pixrunner++).a()*exp_scale;
-      if (val != 0.0) {
-	if (!foundSome) {
-	  minmass= maxmass= val;
-	  foundSome= 1;
-	}
-	if (val>0.0 && val<minmass) minmass= val;
-	if (val>maxmass) maxmass= val;
-      }
-    }
-  }
-  if (!foundSome) {
+  SplatLateCmapScan scan;
+  scan.exp_scale= exp_scale;
+  scan.use_alpha= 1;
+  scan.minmass = 0.0;
+  scan.maxmass = 0.0;
+  scan.foundSome= 0;
+  ssplat_scan_tiles( raw_image, scan );
+  if (!scan.foundSome) {
     fprintf(stderr,"splat_all_stars: can't rescale black image!\n");
     return 0;
   }
   
-  fprintf(stdout,"log autoscale bounds %g, %g\n", minmass, maxmass);
+  fprintf(stdout,"log autoscale bounds %g, %g\n", scan.minmass, scan.maxmass);
   
-  double log_maxmass= log(maxmass);
-  double log_minmass= log(minmass);
-  double inv_range=1.0/(log_maxmass-log_minmass);
-  pixrunner= raw_image;
-  for (int jloop=0; jloop<ysize; jloop++) {
-    for (int iloop=0; iloop<xsize; iloop++) {
-      double val= (*pixrunner++).a()*exp_scale;
-      val= (val>0.0) ? inv_range*(log(val)-log_minmass) : 0.0;
-      gColor oclr= late_cmap->map(val);
-      image->setpix(iloop, ysize-(jloop+1), oclr);
-    }
-  }
+  double log_maxmass= log(scan.maxmass);
+  double log_minmass= log(scan.minmass);
+  SplatLateCmapLogConvert convert;
+  convert.exp_scale= exp_scale;
+  convert.use_alpha= 1;
+  convert.cmap= late_cmap;
+  convert.inv_range=1.0/(log_maxmass-log_minmass);
+  convert.log_minmass= log_minmass;
+  ssplat_convert_tiles( image, raw_image, convert );
   return 1;
 }
 
-int StarSplatter::convert_image( rgbImage* image, const gColor* raw_image )
+int StarSplatter::convert_image( rgbImage* image, 
+				 const SplatFramebuffer* raw_image )
 {
   // Copy the floating point image into the result image
   // Image gets flipped vertically in the process
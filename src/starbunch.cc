@@ -24,6 +24,9 @@
 
 #include "geometry.h"
 #include "starbunch.h"
+#include "starbunchoctree.h"
+#include "threadteam.h"
+#include "radixsort.h"
 
 //////////////////////////////////////////////////////////
 // Notes-
@@ -36,8 +39,14 @@
 // -We need the Python equivalent of the Tcl documentation.
 // -All of the scripts should produce 'pretty' pictures.
 // -is USE_LOG implemented for color map properties?
+// -sort_spatially() orders records by Morton (Z-order) code, with
+//  SPATIAL_SORT_BITS bits per axis of a cube around the bounding box.
+//  Keys and record indices are packed as for the renderer's depth
+//  sort, radix sorted, and the records gathered into a new table.
 //////////////////////////////////////////////////////////
 
+#define SPATIAL_SORT_BITS 10
+
 /* Must match StarBunch::AttributeID */
 static const char* attributeIDNames[]= { 
   "ColorAlg", 
@@ -183,7 +192,9 @@ StarBunch::StarBunch( const int nstars_in )
   num_stars= num_props= num_proptable_recs= 0;
   propTable= NULL;
   propNameTable= NULL;
+  tree= NULL;
   resize_property_table(nstars_in,0);
+  spatial_order_flag= 0;
 
   id_index= -1;                     // invalid index means it doesn't exist
   valid_index= -1;                  // invalid index means it doesn't exist
@@ -208,6 +219,7 @@ StarBunch::~StarBunch()
     delete [] propNameTable;
   }
   delete bbox;
+  delete tree;
 }
 
 StarBunch* StarBunch::clone_empty() const
@@ -262,6 +274,9 @@ void StarBunch::resize_property_table(const int newNStars, const int newNProps)
 	    "Resizing property table; recs=%d of %d -> %d, nprops %d -> %d\n",
 	    num_stars,num_proptable_recs,newNStars,num_props,newNProps);
 
+  discard_octree();
+  spatial_order_flag= 0;
+
   int newRecSize= sizeof(gPoint)+newNProps*PROPSIZE;
   if (newNProps<num_props) {
     // Shrink the property table and clear the property name list
@@ -396,6 +411,23 @@ void StarBunch::updateBoundBox()
   bbox= new gBoundBox(xmin,ymin,zmin,xmax,ymax,zmax);
 }
 
+const StarBunchOctree* StarBunch::octree()
+{
+  if (!tree) {
+    tree= new StarBunchOctree(this);
+    if (debugLevel())
+      fprintf(stderr,"Built octree of %d nodes over %d stars\n",
+	      tree->nnodes(), nstars());
+  }
+  return tree;
+}
+
+void StarBunch::discard_octree()
+{
+  delete tree;
+  tree= NULL;
+}
+
 void StarBunch::create_id_storage()
 {
   if (!has_ids()) 
@@ -429,6 +461,7 @@ void StarBunch::set_attr( const int whichAttr, const int val )
 {
   if (debugLevel())
     fprintf(stderr,"set_attr %s <- %d\n",attributeIDNames[whichAttr],val);
+  discard_octree();
   switch (whichAttr) {
   case COLOR_PROP1:
   case COLOR_PROP2:
@@ -455,6 +488,7 @@ void StarBunch::set_nstars( const int nstars_in )
 void StarBunch::set_propName( const int iProp, const char* name )
 {
   if (iProp>=0 && iProp<num_props) { 
+    discard_octree();
     if (iProp==per_part_densities_index) per_part_densities_index= -1;
     if (iProp==per_part_sqrt_exp_constants_index) 
       per_part_sqrt_exp_constants_index= -1;
@@ -482,6 +516,7 @@ const char* StarBunch::propName( const int iProp ) const
 void StarBunch::set_colormap1D(const gColor* colors, const int xdim,
 		      const double min, const double max)
 {
+  discard_octree();
   delete cmap1D;
   cmap1D= new StarBunchCMap(colors, xdim, 1, min, max, 0.0, 0.0);
 }
@@ -492,6 +527,7 @@ void StarBunch::set_colormap2D(const gColor* colors,
 			       const double minX, const double maxX,
 			       const double minY, const double maxY)
 {
+  discard_octree();
   delete cmap2D;
   cmap2D= new StarBunchCMap(colors, xdim, ydim, minX, maxX, minY, maxY);
 }
@@ -736,6 +772,8 @@ int StarBunch::sort_ascending_by_prop( const int iProp )
     return 0;
   }
   assert(StarBunch::bunchBeingSorted==NULL);
+  discard_octree();
+  spatial_order_flag= 0;
   StarBunch::bunchBeingSorted= this;
   StarBunch::sortingPropIndex= iProp;
   qsort(propTable,nstars(),propRecSize(),StarBunch_compareProp);
@@ -755,6 +793,117 @@ int StarBunch::sort_ascending_by_id()
   else return 0;
 }
 
+struct SpatialSortJob {
+  const StarBunch* sb;
+  long n;
+  int nchunks;
+  double lo[3];
+  double scale; // cells per unit length
+  unsigned long long* recs;
+  const char* src;
+  char* dst;
+  int rec_size;
+};
+
+// Spaces the low 10 bits of v two zero bits apart
+static inline unsigned int spatial_spread_bits( unsigned int v )
+{
+  v &= 0x3FF;
+  v= (v | (v<<16)) & 0x030000FF;
+  v= (v | (v<<8)) & 0x0300F00F;
+  v= (v | (v<<4)) & 0x030C30C3;
+  v= (v | (v<<2)) & 0x09249249;
+  return v;
+}
+
+static inline unsigned int spatial_cell( const double val, const double lo,
+					 const double scale )
+{
+  double cell= (val-lo)*scale;
+  if (!(cell>0.0)) return 0; // catches NaN as well
+  if (cell>=(double)(1<<SPATIAL_SORT_BITS)) 
+    return (1<<SPATIAL_SORT_BITS)-1;
+  return (unsigned int)cell;
+}
+
+static void spatial_sort_key_task( void* arg, const int chunk, 
+				   const int thread )
+{
+  SpatialSortJob* job= (SpatialSortJob*)arg;
+  long first= (chunk*job->n)/job->nchunks;
+  long last= ((chunk+1)*job->n)/job->nchunks;
+  for (long i=first; i<last; i++) {
+    gPoint pt= job->sb->coords(i);
+    unsigned int key= 
+      spatial_spread_bits(spatial_cell(pt.x(), job->lo[0], job->scale))
+      | (spatial_spread_bits(spatial_cell(pt.y(), job->lo[1], job->scale))<<1)
+      | (spatial_spread_bits(spatial_cell(pt.z(), job->lo[2], job->scale))<<2);
+    job->recs[i]= (((unsigned long long)key)<<32) | (unsigned long long)i;
+  }
+}
+
+static void spatial_sort_gather_task( void* arg, const int chunk,
+				      const int thread )
+{
+  SpatialSortJob* job= (SpatialSortJob*)arg;
+  long first= (chunk*job->n)/job->nchunks;
+  long last= ((chunk+1)*job->n)/job->nchunks;
+  for (long i=first; i<last; i++)
+    memcpy( job->dst + i*job->rec_size, 
+	    job->src + (job->recs[i] & 0xFFFFFFFFULL)*job->rec_size,
+	    job->rec_size );
+}
+
+int StarBunch::sort_spatially( const int nthreads )
+{
+  if (nstars()<2) {
+    spatial_order_flag= 1;
+    return 1;
+  }
+  gBoundBox box= boundBox();
+  double extent= box.xmax()-box.xmin();
+  if (box.ymax()-box.ymin() > extent) extent= box.ymax()-box.ymin();
+  if (box.zmax()-box.zmin() > extent) extent= box.zmax()-box.zmin();
+
+  SpatialSortJob job;
+  job.sb= this;
+  job.n= nstars();
+  job.lo[0]= box.xmin();
+  job.lo[1]= box.ymin();
+  job.lo[2]= box.zmin();
+  job.scale= (extent>0.0) ? (double)(1<<SPATIAL_SORT_BITS)/extent : 0.0;
+  job.recs= new unsigned long long[2*job.n];
+  job.rec_size= propRecSize();
+  char* newPropTable= new char[(long)num_proptable_recs*propRecSize()];
+  if (!newPropTable) {
+    fprintf(stderr,"Unable to allocate %ld bytes!\n",
+	    (long)num_proptable_recs*propRecSize());
+    exit(-1);
+  }
+  job.src= propTable;
+  job.dst= newPropTable;
+
+  ThreadTeam team( (nthreads>0) ? nthreads : 1 );
+  job.nchunks= 4*team.nthreads();
+  team.run( spatial_sort_key_task, &job, job.nchunks );
+  ssplat_radix_sort( job.recs, job.recs+job.n, job.n, 
+		     32, 3*SPATIAL_SORT_BITS, team );
+  team.run( spatial_sort_gather_task, &job, job.nchunks );
+  if (num_proptable_recs>num_stars) // keep the unused tail as it was
+    memcpy( newPropTable + (long)num_stars*propRecSize(),
+	    propTable + (long)num_stars*propRecSize(),
+	    (long)(num_proptable_recs-num_stars)*propRecSize() );
+  delete [] job.recs;
+
+  delete [] propTable;
+  propTable= newPropTable;
+  discard_octree(); // the particles are the same, but their indices differ
+  spatial_order_flag= 1;
+  if (debugLevel())
+    fprintf(stderr,"Sorted %d stars spatially\n",nstars());
+  return 1;
+}
+
 int StarBunch::allocate_next_free_prop_index(const char* name)
 {
   int retval= -1;
@@ -16,6 +16,7 @@
  *****************************************************************************/
 
 class StarBunch;
+class StarBunchOctree;
 
 class StarBunchCMap {
  public:
@@ -92,15 +93,17 @@ public:
   int nstars() const { return num_stars; }
   void set_nprops( const int nprops_in );
   int nprops() const { return num_props; }
-  void set_bunch_color( const gColor& clr_in ) { bunchClr= clr_in; }
+  void set_bunch_color( const gColor& clr_in ) 
+  { bunchClr= clr_in; if (tree) discard_octree(); }
   void set_time( const double time_in ) { time_val= time_in; }
   void set_z( const double z_in ) { z_val= z_in; }
   void set_a( const double a_in ) { a_val= a_in; }
-  void set_density( const double dens_in ) { densityval= dens_in; }
+  void set_density( const double dens_in ) 
+  { densityval= dens_in; if (tree) discard_octree(); }
   void set_exp_constant( const double exp_const_in ) 
-  { sqrt_exponent_constant= sqrt(exp_const_in); }
+  { sqrt_exponent_constant= sqrt(exp_const_in); if (tree) discard_octree(); }
   void set_scale_length( const double scale_length_in )
-  { sqrt_exponent_constant= 1.0/scale_length_in; }
+  { sqrt_exponent_constant= 1.0/scale_length_in; if (tree) discard_octree(); }
   gColor bunch_color() const { return bunchClr; }
   double time() const { return time_val; }
   double z() const { return z_val; }
@@ -128,6 +131,8 @@ public:
       delete bbox;
       bbox= NULL;
     }
+    if (tree) discard_octree();
+    spatial_order_flag= 0;
     *pointPtr(i)= pt;
   }
   gPoint coords( const int i ) const
@@ -137,7 +142,10 @@ public:
   int allocate_next_free_prop_index(const char* name);
   void deallocate_prop_index(const int iProp);
   void set_prop( const int iStar, const int iProp, const double value )
-  { *doublePropPtr(iStar,iProp)= value; }
+  { 
+    if (tree) discard_octree();
+    *doublePropPtr(iStar,iProp)= value; 
+  }
   double prop( const int iStar, const int iProp ) const
   { return *doublePropPtr(iStar,iProp); }
   void set_propName( const int iProp, const char* name );
@@ -147,6 +155,9 @@ public:
     if (!bbox) updateBoundBox();
     return *bbox;
   }
+  // A spatial index over the particles, built on first use and kept
+  // until the particles or the way they are drawn change
+  const StarBunchOctree* octree();
   gColor clr( const int i ) const
   {
     switch (bunch_attributes[COLOR_ALG]) {
@@ -210,6 +221,7 @@ public:
   void set_valid( const int i, const int validFlag )
   {
     if (!has_valids()) create_valid_storage();
+    if (tree) discard_octree();
     if (validFlag) {
       if (!valid(i)) invalid_count -= 1;
       *longPropPtr(i,valid_index)= 1;
@@ -265,6 +277,12 @@ public:
   void crop( const gPoint pt, const gVector dir );
   int sort_ascending_by_prop( const int iProp );
   int sort_ascending_by_id();
+  // Reorders the records along a space filling curve through the
+  // bounding box, so that particles close in space are close in memory.
+  // Record indices change, so interpolation must sort by id afresh.
+  int sort_spatially( const int nthreads=1 );
+  // Non-zero if the records are in spatial order and have not moved
+  int spatially_sorted() const { return spatial_order_flag; }
   int copy_stars( const StarBunch* src );
   int fill_invalid_from( StarBunch* src, int sorted=0, int src_sorted=0 );
   int get_prop_index_by_name(const char* name) const; // returns -1 on failure
@@ -294,6 +312,7 @@ public:
   void create_per_part_density_storage();
   void create_per_part_sqrt_exp_constant_storage();
   void updateBoundBox();
+  void discard_octree();
   char* propTable;
   int per_part_densities_index;
   int per_part_sqrt_exp_constants_index;
@@ -314,4 +333,6 @@ public:
   StarBunchCMap* cmap1D;
   StarBunchCMap* cmap2D;
   gBoundBox* bbox;
+  StarBunchOctree* tree;
+  int spatial_order_flag;
 };
@@ -0,0 +1,431 @@
+/****************************************************************************
+ * starbunchlod.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+#include "starsplatter.h"
+#include "starbunchoctree.h"
+#include "starbunchlod.h"
+
+/* Notes-
+ * The file is a header, the table of octree nodes, one aggregate
+ * record per node, and then every particle record in octree order.
+ * Each node's particles are the run of records from its first for its
+ * count.  Children always follow their parent in the node table, so
+ * sums over the tree can be made from the last node back to the first.
+ * Invalid particles and empty aggregates are kept, with zero density,
+ * so that the runs stay intact; extract() drops them.
+ *
+ * An aggregate's color properties are its particles' values weighted
+ * by density, averaged in the log if the colormap reads the log, so a
+ * drawn aggregate takes about the mean color of its particles.
+ */
+
+#define LOD_MAGIC "SSPLTLOD"
+// Version 1 files hold aggregates with twice the variance they should
+#define LOD_VERSION 2
+#define LOD_NAME_LENGTH 64
+
+struct StarBunchLODHeader {
+  char magic[8];
+  int version;
+  int nnodes;
+  long long nstars;
+  int color_alg;
+  int nprops; // color properties stored, 0 to 2
+  int use_log[2];
+  char prop_names[2][LOD_NAME_LENGTH];
+};
+
+struct StarBunchLODNode {
+  float box[6]; // xmin, ymin, zmin, xmax, ymax, zmax
+  int first; // particle records first to first+count-1
+  int count;
+  int first_child; // children are consecutive; -1 for a leaf
+  int nchildren;
+};
+
+struct StarBunchLODRecord {
+  float x;
+  float y;
+  float z;
+  float density;
+  float sqrt_exp_constant;
+  float prop[2];
+};
+
+static const char* lod_default_prop_names[2]= 
+  { "lod_color_prop1", "lod_color_prop2" };
+
+static double lod_prop_value( const StarBunch* sb, const int i,
+			      const int iProp, const int use_log )
+{
+  double val= sb->prop(i,iProp);
+  if (use_log) return (val>0.0) ? log10(val) : 0.0;
+  return val;
+}
+
+int ssplat_write_lod_file( StarBunch* sb, const char* fname )
+{
+  const StarBunchOctree* tree= sb->octree();
+  int nnodes= tree->nnodes();
+
+  StarBunchLODHeader header;
+  memset(&header,0,sizeof(header));
+  memcpy(header.magic, LOD_MAGIC, 8);
+  header.version= LOD_VERSION;
+  header.nnodes= nnodes;
+  header.nstars= sb->nstars();
+  header.color_alg= sb->attr(StarBunch::COLOR_ALG);
+  switch (header.color_alg) {
+  case StarBunch::CM_COLORMAP_1D: header.nprops= 1; break;
+  case StarBunch::CM_COLORMAP_2D: header.nprops= 2; break;
+  default: header.nprops= 0;
+  }
+  int iProps[2]= { sb->attr(StarBunch::COLOR_PROP1),
+		   sb->attr(StarBunch::COLOR_PROP2) };
+  header.use_log[0]= sb->attr(StarBunch::COLOR_PROP1_USE_LOG);
+  header.use_log[1]= sb->attr(StarBunch::COLOR_PROP2_USE_LOG);
+  for (int p=0; p<header.nprops; p++) {
+    if (iProps[p]<0 || iProps[p]>=sb->nprops()) {
+      fprintf(stderr,
+	      "ssplat_write_lod_file: color property %d does not exist!\n",
+	      iProps[p]);
+      return 0;
+    }
+    const char* name= sb->propName(iProps[p]);
+    if (!name) name= lod_default_prop_names[p];
+    strncpy(header.prop_names[p], name, LOD_NAME_LENGTH-1);
+  }
+
+  FILE* ofile= fopen(fname,"w");
+  if (!ofile) {
+    fprintf(stderr,"ssplat_write_lod_file: cannot open <%s> for writing!\n",
+	    fname);
+    return 0;
+  }
+  int ok= (fwrite(&header,sizeof(header),1,ofile)==1);
+
+  for (int i=0; i<nnodes && ok; i++) {
+    StarBunchLODNode node;
+    const gBoundBox& box= tree->node_box(i);
+    node.box[0]= box.xmin();
+    node.box[1]= box.ymin();
+    node.box[2]= box.zmin();
+    node.box[3]= box.xmax();
+    node.box[4]= box.ymax();
+    node.box[5]= box.zmax();
+    node.first= tree->node_first(i);
+    node.count= tree->node_count(i);
+    node.first_child= tree->node_first_child(i);
+    node.nchildren= tree->node_nchildren(i);
+    ok= (fwrite(&node,sizeof(node),1,ofile)==1);
+  }
+
+  // Density weighted sums of the color properties of each node
+  double* weights= new double[nnodes];
+  double* sums= new double[2*nnodes];
+  for (int i=nnodes-1; i>=0; i--) {
+    weights[i]= 0.0;
+    sums[2*i]= sums[2*i+1]= 0.0;
+    if (tree->node_first_child(i)<0) {
+      for (int k=tree->node_first(i); 
+	   k<tree->node_first(i)+tree->node_count(i); k++) {
+	int istar= tree->star(k);
+	if (!sb->valid(istar)) continue;
+	double w= sb->density(istar);
+	weights[i] += w;
+	for (int p=0; p<header.nprops; p++)
+	  sums[2*i+p] += w*lod_prop_value(sb,istar,iProps[p],
+					  header.use_log[p]);
+      }
+    }
+    else {
+      for (int c=tree->node_first_child(i);
+	   c<tree->node_first_child(i)+tree->node_nchildren(i); c++) {
+	weights[i] += weights[c];
+	sums[2*i] += sums[2*c];
+	sums[2*i+1] += sums[2*c+1];
+      }
+    }
+  }
+  for (int i=0; i<nnodes && ok; i++) {
+    StarBunchLODRecord rec;
+    StarBunchOctree::Aggregate agg;
+    memset(&rec,0,sizeof(rec));
+    if (tree->aggregate(i,agg)) {
+      rec.x= agg.center.x();
+      rec.y= agg.center.y();
+      rec.z= agg.center.z();
+      rec.density= agg.density;
+      rec.sqrt_exp_constant= agg.sqrt_exp_constant;
+      for (int p=0; p<header.nprops; p++) {
+	double mean= (weights[i]>0.0) ? sums[2*i+p]/weights[i] : 0.0;
+	rec.prop[p]= (header.use_log[p]) ? pow(10.0,mean) : mean;
+      }
+    }
+    ok= (fwrite(&rec,sizeof(rec),1,ofile)==1);
+  }
+  delete [] weights;
+  delete [] sums;
+
+  for (long k=0; k<header.nstars && ok; k++) {
+    StarBunchLODRecord rec;
+    int istar= tree->star(k);
+    gPoint pt= sb->coords(istar);
+    rec.x= pt.x();
+    rec.y= pt.y();
+    rec.z= pt.z();
+    rec.density= (sb->valid(istar)) ? sb->density(istar) : 0.0;
+    rec.sqrt_exp_constant= sb->sqrt_exp_constant(istar);
+    rec.prop[0]= rec.prop[1]= 0.0;
+    for (int p=0; p<header.nprops; p++)
+      rec.prop[p]= sb->prop(istar,iProps[p]);
+    ok= (fwrite(&rec,sizeof(rec),1,ofile)==1);
+  }
+
+  if (fclose(ofile)) ok= 0;
+  if (!ok) 
+    fprintf(stderr,"ssplat_write_lod_file: error writing <%s>!\n",fname);
+  return ok;
+}
+
+/* Checks that every node's particles lie in the file, and that each
+ * node but the root is the child of exactly one node before it, so
+ * that extract() reads only inside the map and visits each node at
+ * most once.
+ */
+static int lod_nodes_valid( const StarBunchLODNode* nodes, const int nnodes,
+			    const long long nstars )
+{
+  char* has_parent= new char[nnodes];
+  for (int i=0; i<nnodes; i++) has_parent[i]= 0;
+  int ok= 1;
+  for (int i=0; i<nnodes && ok; i++) {
+    const StarBunchLODNode& node= nodes[i];
+    if (node.first<0 || node.count<0 
+	|| (long long)node.first+node.count>nstars) ok= 0;
+    else if (node.first_child>=0) {
+      if (node.first_child<=i || node.nchildren<1
+	  || (long long)node.first_child+node.nchildren>nnodes) ok= 0;
+      else {
+	for (int c=node.first_child; c<node.first_child+node.nchildren; c++) {
+	  if (has_parent[c]) ok= 0;
+	  has_parent[c]= 1;
+	}
+      }
+    }
+  }
+  delete [] has_parent;
+  return ok;
+}
+
+StarBunchLODFile::StarBunchLODFile()
+{
+  map= NULL;
+  map_size= 0;
+  header= NULL;
+  nodes= NULL;
+  aggregates= NULL;
+  particles= NULL;
+}
+
+StarBunchLODFile::~StarBunchLODFile()
+{
+  close();
+}
+
+int StarBunchLODFile::open( const char* fname )
+{
+  close();
+  int fd= ::open(fname, O_RDONLY);
+  if (fd<0) {
+    fprintf(stderr,"StarBunchLODFile::open: cannot open <%s>!\n",fname);
+    return 0;
+  }
+  struct stat info;
+  if (fstat(fd,&info) || info.st_size<(off_t)sizeof(StarBunchLODHeader)) {
+    fprintf(stderr,"StarBunchLODFile::open: <%s> is too short!\n",fname);
+    ::close(fd);
+    return 0;
+  }
+  void* addr= mmap(NULL, info.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  ::close(fd);
+  if (addr==MAP_FAILED) {
+    fprintf(stderr,"StarBunchLODFile::open: cannot map <%s>!\n",fname);
+    return 0;
+  }
+  map= addr;
+  map_size= info.st_size;
+
+  header= (const StarBunchLODHeader*)map;
+  if (memcmp(header->magic, LOD_MAGIC, 8) 
+      || header->version!=LOD_VERSION) {
+    fprintf(stderr,
+	    "StarBunchLODFile::open: <%s> is not a version %d LOD file!\n",
+	    fname, LOD_VERSION);
+    close();
+    return 0;
+  }
+  long long expected= sizeof(StarBunchLODHeader)
+    + (long long)header->nnodes*sizeof(StarBunchLODNode)
+    + (header->nnodes+header->nstars)*sizeof(StarBunchLODRecord);
+  if (header->nnodes<1 || header->nstars<0 
+      || header->nprops<0 || header->nprops>2 || expected!=map_size) {
+    fprintf(stderr,"StarBunchLODFile::open: <%s> is corrupt!\n",fname);
+    close();
+    return 0;
+  }
+  nodes= (const StarBunchLODNode*)(header+1);
+  if (!lod_nodes_valid(nodes, header->nnodes, header->nstars)) {
+    fprintf(stderr,"StarBunchLODFile::open: <%s> has a corrupt octree!\n",
+	    fname);
+    close();
+    return 0;
+  }
+  aggregates= (const StarBunchLODRecord*)(nodes+header->nnodes);
+  particles= aggregates+header->nnodes;
+  return 1;
+}
+
+void StarBunchLODFile::close()
+{
+  if (map) munmap(map, map_size);
+  map= NULL;
+  map_size= 0;
+  header= NULL;
+  nodes= NULL;
+  aggregates= NULL;
+  particles= NULL;
+}
+
+long StarBunchLODFile::nstars() const
+{
+  return (header) ? (long)header->nstars : 0;
+}
+
+int StarBunchLODFile::nnodes() const
+{
+  return (header) ? header->nnodes : 0;
+}
+
+int StarBunchLODFile::extract( const StarSplatter* ren, 
+			       const double pixel_tol, StarBunch* sb ) const
+{
+  if (!map) {
+    fprintf(stderr,"StarBunchLODFile::extract: no file is open!\n");
+    return 0;
+  }
+  if (!ren->camera_set()) {
+    fprintf(stderr,"StarBunchLODFile::extract: the camera is not set!\n");
+    return 0;
+  }
+  if (header->nstars > 0x7FFFFFFFL) {
+    fprintf(stderr,"StarBunchLODFile::extract: too many particles!\n");
+    return 0;
+  }
+
+  StarSplatter::ViewTest test;
+  ren->get_view_test( test, pixel_tol );
+
+  // Walk the tree, listing the aggregates and particle runs to be drawn.
+  // Aggregated nodes are listed as -(node+1).
+  int nnodes= header->nnodes;
+  int* stack= new int[nnodes];
+  int* drawn= new int[nnodes];
+  int nstack= 0;
+  int ndrawn= 0;
+  long total= 0;
+  stack[nstack++]= 0;
+  while (nstack) {
+    int inode= stack[--nstack];
+    const StarBunchLODNode& node= nodes[inode];
+    if (node.count==0) continue;
+    gBoundBox box( node.box[0], node.box[1], node.box[2],
+		   node.box[3], node.box[4], node.box[5] );
+    int result= StarSplatter::view_test( test, box );
+    if (result==0) continue;
+    if (result==3) {
+      drawn[ndrawn++]= -(inode+1);
+      total += 1;
+    }
+    else if (result==2 || node.first_child<0) {
+      drawn[ndrawn++]= inode;
+      total += node.count;
+    }
+    else {
+      for (int c=node.first_child+node.nchildren-1; c>=node.first_child; c--)
+	stack[nstack++]= c;
+    }
+  }
+  delete [] stack;
+
+  int iProps[2]= { -1, -1 };
+  for (int p=0; p<header->nprops; p++) {
+    const char* name= (header->prop_names[p][0]) ? 
+      header->prop_names[p] : lod_default_prop_names[p];
+    iProps[p]= sb->allocate_next_free_prop_index(name);
+  }
+  sb->set_nstars(total);
+  sb->set_density(1.0);
+  sb->set_exp_constant(1.0);
+  int n= 0;
+  for (int d=0; d<ndrawn; d++) {
+    const StarBunchLODRecord* recs;
+    int count;
+    if (drawn[d]<0) {
+      recs= aggregates - (drawn[d]+1);
+      count= 1;
+    }
+    else {
+      recs= particles + nodes[drawn[d]].first;
+      count= nodes[drawn[d]].count;
+    }
+    for (int k=0; k<count; k++) {
+      const StarBunchLODRecord& rec= recs[k];
+      if (!(rec.density>0.0)) continue;
+      sb->set_coords(n, gPoint(rec.x, rec.y, rec.z));
+      sb->set_density(n, rec.density);
+      sb->set_exp_constant(n, rec.sqrt_exp_constant*rec.sqrt_exp_constant);
+      for (int p=0; p<header->nprops; p++) 
+	sb->set_prop(n, iProps[p], rec.prop[p]);
+      if (sb->has_valids()) sb->set_valid(n,1);
+      n++;
+    }
+  }
+  delete [] drawn;
+  sb->set_nstars(n);
+
+  sb->set_attr(StarBunch::COLOR_ALG, header->color_alg);
+  if (header->nprops>0) {
+    sb->set_attr(StarBunch::COLOR_PROP1, iProps[0]);
+    sb->set_attr(StarBunch::COLOR_PROP1_USE_LOG, header->use_log[0]);
+  }
+  if (header->nprops>1) {
+    sb->set_attr(StarBunch::COLOR_PROP2, iProps[1]);
+    sb->set_attr(StarBunch::COLOR_PROP2_USE_LOG, header->use_log[1]);
+  }
+  return 1;
+}
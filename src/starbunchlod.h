@@ -0,0 +1,65 @@
+/****************************************************************************
+ * starbunchlod.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_STARBUNCHLOD
+#define INCL_STARBUNCHLOD
+
+/* A level of detail file holds a bunch's octree, an aggregate particle
+ * for every node, and the particles themselves in octree order, so
+ * that the particles of each node are contiguous.  It is written once
+ * per snapshot.  A StarBunchLODFile memory maps such a file and
+ * extracts just the particles and aggregates needed for a view, so
+ * only the pages holding those are ever read.  Densities and scale
+ * lengths are stored as drawn, along with the properties the bunch is
+ * colored by.  Bunch colors and colormaps are not stored; they are set
+ * on the extracted bunch as after any load.  Files are in the native
+ * byte order.
+ */
+
+// This routine returns non-zero on success
+extern int ssplat_write_lod_file( StarBunch* sb, const char* fname );
+
+struct StarBunchLODHeader;
+struct StarBunchLODNode;
+struct StarBunchLODRecord;
+
+class StarBunchLODFile {
+ public:
+  StarBunchLODFile();
+  ~StarBunchLODFile();
+  int open( const char* fname ); // returns non-zero on success
+  void close();
+  int is_open() const { return (map!=NULL); }
+  long nstars() const;
+  int nnodes() const;
+  // Replaces the particles of sb with those needed to draw the file in
+  // the renderer's current view, drawing octree nodes which span fewer
+  // than pixel_tol pixels as their aggregates; 0.0 draws every visible
+  // particle.  Returns non-zero on success.
+  int extract( const StarSplatter* ren, const double pixel_tol,
+	       StarBunch* sb ) const;
+ private:
+  void* map;
+  long map_size;
+  const StarBunchLODHeader* header;
+  const StarBunchLODNode* nodes;
+  const StarBunchLODRecord* aggregates; // one per node
+  const StarBunchLODRecord* particles;
+};
+
+#endif // INCL_STARBUNCHLOD
@@ -0,0 +1,328 @@
+/****************************************************************************
+ * starbunchoctree.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "geometry.h"
+#include "starbunch.h"
+#include "starbunchoctree.h"
+
+/* Notes-
+ * Octants are cut at the middle of the parent's cell, not of its tight
+ * bounds, so cells stay cubes if the root does.  Coincident particles
+ * would divide forever, hence the depth limit.  Children are appended
+ * to the node table, so nodes are referred to by index while building.
+ * A parent's aggregate comes from its children's, using the parallel
+ * axis theorem for the spread.  Spreads are of squared distance in all
+ * three dimensions, so each screen axis sees a variance of a third of
+ * the spread.  A Gaussian exp(-k^2 r^2) has a variance of 1/(2 k^2)
+ * along each axis, so matching variances adds two thirds of the spread
+ * to 1/k^2.
+ */
+
+StarBunchOctree::StarBunchOctree( const StarBunch* sb )
+{
+  n_stars= sb->nstars();
+  nodes= NULL;
+  n_nodes= 0;
+  n_nodes_alloc= 0;
+  order= new int[n_stars];
+  scratch= new int[n_stars];
+  if (!order || !scratch) {
+    fprintf(stderr,"StarBunchOctree: Out of memory!\n");
+    exit(-1);
+  }
+  for (int i=0; i<n_stars; i++) order[i]= i;
+  if (n_stars>0) {
+    // boundBox() is not const, but it only caches the bounds
+    gBoundBox bbox= ((StarBunch*)sb)->boundBox();
+    float lo[3]= { bbox.xmin(), bbox.ymin(), bbox.zmin() };
+    float hi[3]= { bbox.xmax(), bbox.ymax(), bbox.zmax() };
+    float size= hi[0]-lo[0];
+    if (hi[1]-lo[1]>size) size= hi[1]-lo[1];
+    if (hi[2]-lo[2]>size) size= hi[2]-lo[2];
+    for (int axis=0; axis<3; axis++) hi[axis]= lo[axis]+size;
+    int root= new_nodes(1);
+    nodes[root].first= 0;
+    nodes[root].count= n_stars;
+    build( root, lo, hi, 0, sb );
+  }
+  delete [] scratch;
+  scratch= NULL;
+}
+
+StarBunchOctree::~StarBunchOctree()
+{
+  delete [] nodes;
+  delete [] order;
+}
+
+int StarBunchOctree::new_nodes( const int n )
+{
+  if (n_nodes+n > n_nodes_alloc) {
+    int new_alloc= (n_nodes_alloc>0) ? 2*n_nodes_alloc : 64;
+    while (new_alloc < n_nodes+n) new_alloc *= 2;
+    Node* new_table= new Node[new_alloc];
+    if (!new_table) {
+      fprintf(stderr,"StarBunchOctree: Out of memory!\n");
+      exit(-1);
+    }
+    for (int i=0; i<n_nodes; i++) new_table[i]= nodes[i];
+    delete [] nodes;
+    nodes= new_table;
+    n_nodes_alloc= new_alloc;
+  }
+  int first= n_nodes;
+  n_nodes += n;
+  return first;
+}
+
+void StarBunchOctree::build( const int inode, const float lo[3], 
+			     const float hi[3], const int depth,
+			     const StarBunch* sb )
+{
+  int first= nodes[inode].first;
+  int count= nodes[inode].count;
+  nodes[inode].first_child= -1;
+  nodes[inode].nchildren= 0;
+
+  if (count<=OCTREE_LEAF_SIZE || depth>=OCTREE_MAX_DEPTH) {
+    double base_sqrt_exp= sb->sqrt_exp_constant();
+    gPoint pt= sb->coords(order[first]);
+    float bmin[3]= { pt.x(), pt.y(), pt.z() };
+    float bmax[3]= { pt.x(), pt.y(), pt.z() };
+    double max_scale= 0.0;
+    for (int k=first; k<first+count; k++) {
+      pt= sb->coords(order[k]);
+      float p[3]= { pt.x(), pt.y(), pt.z() };
+      for (int axis=0; axis<3; axis++) {
+	if (p[axis]<bmin[axis]) bmin[axis]= p[axis];
+	if (p[axis]>bmax[axis]) bmax[axis]= p[axis];
+      }
+      double scale= base_sqrt_exp/sb->sqrt_exp_constant(order[k]);
+      if (scale>max_scale) max_scale= scale;
+    }
+    nodes[inode].box= gBoundBox(bmin[0],bmin[1],bmin[2],
+				bmax[0],bmax[1],bmax[2]);
+    nodes[inode].max_scale= max_scale;
+    aggregate_leaf( inode, sb );
+    return;
+  }
+
+  // Sort the node's particles into octants
+  float mid[3];
+  for (int axis=0; axis<3; axis++) mid[axis]= 0.5*(lo[axis]+hi[axis]);
+  int counts[8];
+  for (int oct=0; oct<8; oct++) counts[oct]= 0;
+  for (int k=first; k<first+count; k++) {
+    gPoint pt= sb->coords(order[k]);
+    int oct= ((pt.x()>=mid[0]) ? 1 : 0) | ((pt.y()>=mid[1]) ? 2 : 0)
+      | ((pt.z()>=mid[2]) ? 4 : 0);
+    scratch[k]= oct;
+    counts[oct]++;
+  }
+  int starts[8];
+  int nchildren= 0;
+  int running= first;
+  for (int oct=0; oct<8; oct++) {
+    starts[oct]= running;
+    running += counts[oct];
+    if (counts[oct]) nchildren++;
+  }
+  int* sorted= new int[count];
+  int next[8];
+  for (int oct=0; oct<8; oct++) next[oct]= starts[oct]-first;
+  for (int k=first; k<first+count; k++) sorted[next[scratch[k]]++]= order[k];
+  for (int k=0; k<count; k++) order[first+k]= sorted[k];
+  delete [] sorted;
+
+  int ichild= new_nodes(nchildren);
+  nodes[inode].first_child= ichild;
+  nodes[inode].nchildren= nchildren;
+  for (int oct=0; oct<8; oct++) {
+    if (!counts[oct]) continue;
+    float clo[3];
+    float chi[3];
+    for (int axis=0; axis<3; axis++) {
+      if (oct & (1<<axis)) {
+	clo[axis]= mid[axis];
+	chi[axis]= hi[axis];
+      }
+      else {
+	clo[axis]= lo[axis];
+	chi[axis]= mid[axis];
+      }
+    }
+    nodes[ichild].first= starts[oct];
+    nodes[ichild].count= counts[oct];
+    build( ichild, clo, chi, depth+1, sb );
+    ichild++;
+  }
+
+  // The node's bounds are those of its children
+  int c= nodes[inode].first_child;
+  gBoundBox box= nodes[c].box;
+  double max_scale= nodes[c].max_scale;
+  for (c++; c<nodes[inode].first_child+nchildren; c++) {
+    box.union_with( nodes[c].box );
+    if (nodes[c].max_scale>max_scale) max_scale= nodes[c].max_scale;
+  }
+  nodes[inode].box= box;
+  nodes[inode].max_scale= max_scale;
+  aggregate_children( inode );
+}
+
+void StarBunchOctree::aggregate_leaf( const int inode, const StarBunch* sb )
+{
+  Node& node= nodes[inode];
+  double weight= 0.0;
+  double sum[3]= { 0.0, 0.0, 0.0 };
+  double clr_sum[4]= { 0.0, 0.0, 0.0, 0.0 };
+  double inv_exp_sum= 0.0;
+  for (int k=node.first; k<node.first+node.count; k++) {
+    int i= order[k];
+    if (!sb->valid(i)) continue;
+    double w= sb->density(i);
+    gPoint pt= sb->coords(i);
+    gColor clr= sb->clr(i);
+    double sqrt_exp= sb->sqrt_exp_constant(i);
+    weight += w;
+    sum[0] += w*pt.x();
+    sum[1] += w*pt.y();
+    sum[2] += w*pt.z();
+    clr_sum[0] += w*clr.r();
+    clr_sum[1] += w*clr.g();
+    clr_sum[2] += w*clr.b();
+    clr_sum[3] += w*clr.a();
+    inv_exp_sum += w/(sqrt_exp*sqrt_exp);
+  }
+  node.weight= weight;
+  if (weight<=0.0) {
+    gPoint center= node.box.center();
+    node.centroid[0]= center.x();
+    node.centroid[1]= center.y();
+    node.centroid[2]= center.z();
+    node.spread= 0.0;
+    node.inv_exp_constant= 0.0;
+    for (int c=0; c<4; c++) node.clr[c]= 0.0;
+    return;
+  }
+  for (int axis=0; axis<3; axis++) node.centroid[axis]= sum[axis]/weight;
+  for (int c=0; c<4; c++) node.clr[c]= clr_sum[c]/weight;
+  node.inv_exp_constant= inv_exp_sum/weight;
+  double spread= 0.0;
+  for (int k=node.first; k<node.first+node.count; k++) {
+    int i= order[k];
+    if (!sb->valid(i)) continue;
+    gPoint pt= sb->coords(i);
+    double dx= pt.x()-node.centroid[0];
+    double dy= pt.y()-node.centroid[1];
+    double dz= pt.z()-node.centroid[2];
+    spread += sb->density(i)*(dx*dx + dy*dy + dz*dz);
+  }
+  node.spread= spread/weight;
+}
+
+void StarBunchOctree::aggregate_children( const int inode )
+{
+  Node& node= nodes[inode];
+  int first= node.first_child;
+  int last= first+node.nchildren;
+  double weight= 0.0;
+  double sum[3]= { 0.0, 0.0, 0.0 };
+  double clr_sum[4]= { 0.0, 0.0, 0.0, 0.0 };
+  double inv_exp_sum= 0.0;
+  for (int c=first; c<last; c++) {
+    double w= nodes[c].weight;
+    weight += w;
+    for (int axis=0; axis<3; axis++) sum[axis] += w*nodes[c].centroid[axis];
+    for (int ch=0; ch<4; ch++) clr_sum[ch] += w*nodes[c].clr[ch];
+    inv_exp_sum += w*nodes[c].inv_exp_constant;
+  }
+  node.weight= weight;
+  if (weight<=0.0) {
+    gPoint center= node.box.center();
+    node.centroid[0]= center.x();
+    node.centroid[1]= center.y();
+    node.centroid[2]= center.z();
+    node.spread= 0.0;
+    node.inv_exp_constant= 0.0;
+    for (int ch=0; ch<4; ch++) node.clr[ch]= 0.0;
+    return;
+  }
+  for (int axis=0; axis<3; axis++) node.centroid[axis]= sum[axis]/weight;
+  for (int ch=0; ch<4; ch++) node.clr[ch]= clr_sum[ch]/weight;
+  node.inv_exp_constant= inv_exp_sum/weight;
+  double spread= 0.0;
+  for (int c=first; c<last; c++) {
+    double dist2= 0.0;
+    for (int axis=0; axis<3; axis++) {
+      double d= nodes[c].centroid[axis]-node.centroid[axis];
+      dist2 += d*d;
+    }
+    spread += nodes[c].weight*(nodes[c].spread + dist2);
+  }
+  node.spread= spread/weight;
+}
+
+int StarBunchOctree::aggregate( const int inode, Aggregate& agg ) const
+{
+  const Node& node= nodes[inode];
+  if (node.weight<=0.0) return 0;
+  agg.center= gPoint( node.centroid[0], node.centroid[1], node.centroid[2] );
+  agg.density= node.weight;
+  agg.clr= gColor( node.clr[0], node.clr[1], node.clr[2], node.clr[3] );
+  // Per screen axis, the spread adds spread/3 to 1/(2 k^2)
+  double inv_exp= node.inv_exp_constant + (2.0/3.0)*node.spread;
+  agg.sqrt_exp_constant= 1.0/sqrt(inv_exp);
+  agg.nstars= node.count;
+  agg.first_star= order[node.first];
+  return 1;
+}
+
+long StarBunchOctree::select_node( const int inode, StarBunchOctreeTest test,
+				   void* arg, unsigned int* mask,
+				   int* lod_nodes, int* n_lod_nodes ) const
+{
+  const Node& node= nodes[inode];
+  int result= (*test)( arg, node.box, node.max_scale );
+  if (result==0) return 0;
+  if (result==3 && lod_nodes) {
+    lod_nodes[(*n_lod_nodes)++]= inode;
+    return 0;
+  }
+  if (result==1 && node.first_child>=0) {
+    long total= 0;
+    for (int c=node.first_child; c<node.first_child+node.nchildren; c++)
+      total += select_node( c, test, arg, mask, lod_nodes, n_lod_nodes );
+    return total;
+  }
+  for (int k=node.first; k<node.first+node.count; k++)
+    mask[order[k]>>5] |= 1u<<(order[k] & 31);
+  return node.count;
+}
+
+long StarBunchOctree::select( StarBunchOctreeTest test, void* arg,
+			      unsigned int* mask, int* lod_nodes,
+			      int* n_lod_nodes ) const
+{
+  if (lod_nodes) *n_lod_nodes= 0;
+  if (n_nodes==0) return 0;
+  return select_node( 0, test, arg, mask, lod_nodes, n_lod_nodes );
+}
@@ -0,0 +1,117 @@
+/****************************************************************************
+ * starbunchoctree.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_STARBUNCHOCTREE
+#define INCL_STARBUNCHOCTREE
+
+class StarBunch;
+
+/* Leaves hold at most this many particles, unless they are this deep */
+#define OCTREE_LEAF_SIZE 64
+#define OCTREE_MAX_DEPTH 24
+
+/* A test of a node's bounds, which may be padded by the largest scale
+ * length of the particles in the node, relative to the bunch's scale
+ * length.  Returns 0 if the node can be culled, 2 if all of it is of
+ * interest, 1 if its children must be tested in turn, and 3 if the 
+ * node is to be drawn whole, as its aggregate.
+ */
+typedef int (*StarBunchOctreeTest)( void* arg, const gBoundBox& box,
+				    const double max_scale );
+
+/* A StarBunchOctree divides a StarBunch's bounding box into octants
+ * until each leaf holds few particles, keeping for every node the tight
+ * bounds of its particles and the largest of their scale lengths.  The
+ * particles themselves are not moved; each node owns a run of the
+ * tree's index list.  Each node also carries an aggregate of its
+ * valid particles, a single particle standing in for all of them.  The
+ * tree reflects the bunch as it was when built, so the bunch discards
+ * it whenever its particles or their colors and densities change.
+ */
+class StarBunchOctree {
+ public:
+  /* The aggregate has the summed density and the density weighted mean
+   * position and color of the particles.  Its squared scale length is
+   * the weighted mean of theirs plus two thirds of the spread of their
+   * positions, so that its variance along each screen axis is that of
+   * the particles, as for a sum of Gaussians.
+   */
+  struct Aggregate {
+    gPoint center;
+    double density;
+    gColor clr;
+    double sqrt_exp_constant;
+    int nstars; // particles in the node
+    int first_star; // a particle of the node, for identification
+  };
+  StarBunchOctree( const StarBunch* sb );
+  ~StarBunchOctree();
+  int nnodes() const { return n_nodes; }
+  // Sets the bit for every particle in nodes which the test does not
+  // cull; bit i of the mask is bit i%32 of word i/32.  Returns the 
+  // number of bits set.  If lod_nodes is not NULL, nodes to be drawn
+  // whole are listed there, and n_lod_nodes is set to their number;
+  // there can be at most nnodes() of them.  Otherwise they are treated
+  // like nodes of interest.
+  long select( StarBunchOctreeTest test, void* arg, unsigned int* mask,
+	       int* lod_nodes=NULL, int* n_lod_nodes=NULL ) const;
+  // Returns 0 if the node aggregates no density
+  int aggregate( const int inode, Aggregate& agg ) const;
+  // The shape of the tree, for walking it outside select().  Node 0 is
+  // the root, and the particles of a node are star(k) for k from
+  // node_first() to node_first()+node_count()-1.
+  const gBoundBox& node_box( const int inode ) const 
+  { return nodes[inode].box; }
+  int node_first_child( const int inode ) const 
+  { return nodes[inode].first_child; }
+  int node_nchildren( const int inode ) const 
+  { return nodes[inode].nchildren; }
+  int node_first( const int inode ) const { return nodes[inode].first; }
+  int node_count( const int inode ) const { return nodes[inode].count; }
+  int star( const int k ) const { return order[k]; }
+ private:
+  struct Node {
+    gBoundBox box; // tight bounds of the node's particles
+    float max_scale; // relative to the bunch's scale length
+    double weight; // summed density of the valid particles
+    float centroid[3]; // the rest are means weighted by density
+    float spread; // squared distance from the centroid
+    float inv_exp_constant; // squared scale length
+    float clr[4];
+    int first; // the node's particles are order[first] on
+    int count;
+    int first_child; // children are consecutive; -1 for a leaf
+    int nchildren;
+  };
+  int new_nodes( const int n );
+  void build( const int inode, const float lo[3], const float hi[3],
+	      const int depth, const StarBunch* sb );
+  void aggregate_leaf( const int inode, const StarBunch* sb );
+  void aggregate_children( const int inode );
+  long select_node( const int inode, StarBunchOctreeTest test, void* arg,
+		    unsigned int* mask, int* lod_nodes, 
+		    int* n_lod_nodes ) const;
+  Node* nodes;
+  int n_nodes;
+  int n_nodes_alloc;
+  int* order;
+  int* scratch; // used while building
+  int n_stars;
+};
+
+#endif // INCL_STARBUNCHOCTREE
@@ -20,12 +20,29 @@
 #include <stdlib.h>
 #include <math.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#ifdef __SSE2__
+#include <xmmintrin.h>
+#include <emmintrin.h>
+#endif
 
 #include "starsplatter.h"
 #include "splatpainter.h"
 #include "gaussiansplatpainter.h"
 #include "splinesplatpainter.h"
 #include "circlesplatpainter.h"
+#include "threadteam.h"
+#include "radixsort.h"
+#include "splatbuffer.h"
+#include "splatpyramid.h"
+#include "splatopacity.h"
+#include "splatorder.h"
+#include "starbunchoctree.h"
+#include "splatbucket.h"
+#include "splatcomposite.h"
+#include "splatframebuffer.h"
 
 /* Notes-
  */
@@ -51,6 +68,7 @@ short StarSplatter::screen_minz= -32768;
 short StarSplatter::screen_maxz= 32767;
 
 int StarSplatter::initial_sbunch_table_size= 10;
+int StarSplatter::splat_tile_size= 64;
 double StarSplatter::default_gaussian_splat_cutoff= 0.01;
 
 StarSplatter::StarSplatter()
@@ -62,6 +80,7 @@ StarSplatter::StarSplatter()
   debug_flag= 0;
   exp_scale= 1.0;
   current_exposure_type= ET_LINEAR;
+  current_composite_type= CT_DEFAULT;
   log_rescale_min= default_log_rescale_min;
   log_rescale_max= default_log_rescale_max;
 
@@ -70,16 +89,39 @@ StarSplatter::StarSplatter()
   n_sbunches= 0;
   total_stars= 0;
   total_stars_after_clipping= 0;
-  splatbuf= NULL;
-  splatbuf_size= 0;
+  splatbuf= new SplatBuffer;
+  sortkeys= NULL;
+  sortkeys_size= 0;
   splat_cutoff= default_gaussian_splat_cutoff;
+  stamp_tol= 0.0;
+  pixel_integration_flag= 0;
+  pyr_radius= 0.0;
+  density_fb_flag= 0;
+  fb_format= FB_DEFAULT;
+  opac_limit= 1.0;
+  cull_thresh= 0.0;
+  cull_points_flag= 0;
+  temporal_sort_flag= 0;
+  octree_culling_flag= 0;
+  lod_thresh= 0.0;
+  spatial_sort_flag= 0;
+  order_history= new SplatOrderHistory;
+  stream_buckets= NULL;
+  stream_budget= 0;
   late_cmap= NULL;
   current_splat_painter= new GaussianSplatPainter(this);
+  n_threads= ThreadTeam::ncpus();
+  n_procs= 1;
+  exact_threading_flag= 0;
 }
 
 StarSplatter::~StarSplatter()
 {
   delete [] sbunch_table;
+  delete splatbuf;
+  delete [] sortkeys;
+  delete order_history;
+  delete stream_buckets;
 }
 
 StarSplatter::SplatType StarSplatter::splat_type() const
@@ -103,16 +145,10 @@ void StarSplatter::set_splat_type( SplatType t )
   }
 }
 
-void StarSplatter::dump( FILE* ofile )
+const char* StarSplatter::exposure_type_name( const ExposureType type )
 {
-  fprintf(ofile,"StarSplatter renderer: image xdim %d, ydim %d\n",xsize,ysize);
-  fprintf(ofile,"     %d particle sets registered; %d particles total\n",
-	  n_sbunches,total_stars);
-  if (cam_set_flag)
-    fprintf(ofile,"     camera is set\n");
-  else fprintf(ofile,"     camera is not set\n");
   const char* exp_type_string= "*unknown*";
-  switch (current_exposure_type) {
+  switch (type) {
   case ET_LINEAR: exp_type_string= "linear";
     break;
   case ET_LOG: exp_type_string= "log";
@@ -129,7 +165,7 @@ void StarSplatter::dump( FILE* ofile )
     break;
   case ET_NOOPAC_LOG_HSV_AUTO: exp_type_string= "noopac_log_hsv_auto";
     break;
-  case ET_LUPTON: exp_type_string= "noopac_log_auto";
+  case ET_LUPTON: exp_type_string= "lupton";
     break;
   case ET_LOG_HSV: exp_type_string= "log_hsv";
     break;
@@ -148,12 +184,80 @@ void StarSplatter::dump( FILE* ofile )
   case ET_LATE_CMAP_LOG_A_AUTO: exp_type_string= "late_cmap_log_a_auto";
     break;
   }
-  fprintf(ofile,"     exposure type is %s\n", exp_type_string);
+  return exp_type_string;
+}
+
+void StarSplatter::dump( FILE* ofile )
+{
+  fprintf(ofile,"StarSplatter renderer: image xdim %d, ydim %d\n",xsize,ysize);
+  fprintf(ofile,"     %d particle sets registered; %d particles total\n",
+	  n_sbunches,total_stars);
+  if (cam_set_flag)
+    fprintf(ofile,"     camera is set\n");
+  else fprintf(ofile,"     camera is not set\n");
+  fprintf(ofile,"     exposure type is %s\n", 
+	  exposure_type_name(current_exposure_type));
   fprintf(ofile,"     splat type is %s\n",current_splat_painter->typeName());
+  const char* comp_type_string= "*unknown*";
+  switch (current_composite_type) {
+  case CT_DEFAULT: comp_type_string= "default";
+    break;
+  case CT_BACK_TO_FRONT: comp_type_string= "back_to_front";
+    break;
+  case CT_ADDITIVE: comp_type_string= "additive";
+    break;
+  case CT_FRONT_TO_BACK: comp_type_string= "front_to_back";
+    break;
+  case CT_WEIGHTED_BLENDED: comp_type_string= "weighted_blended";
+    break;
+  }
+  const char* comp_mode_string= "back to front";
+  if (additive_compositing()) comp_mode_string= "additive";
+  else if (front_to_back_compositing()) comp_mode_string= "front to back";
+  else if (weighted_blended_compositing()) 
+    comp_mode_string= "weighted blended";
+  fprintf(ofile,"     composite type is %s (%s)\n", comp_type_string,
+	  comp_mode_string);
   fprintf(ofile,"     log exposure bounds %g, %g\n",
 	  log_rescale_min, log_rescale_max);
   fprintf(ofile,"     debug %s, splat_cutoff %f, exposure scale %f\n", 
 	  (debug()) ? "on" : "off", splat_cutoff, exp_scale);
+  fprintf(ofile,"     stamp tolerance %g%s\n", stamp_tol,
+	  (stamp_tol>0.0) ? "" : " (exact kernels)");
+  fprintf(ofile,"     pixel integration %s\n",
+	  pixel_integration_flag ? "on" : "off");
+  fprintf(ofile,"     pyramid radius %g%s\n", pyr_radius,
+	  (pyr_radius>0.0) ? "" : " (no pyramid)");
+  fprintf(ofile,"     density framebuffer %s\n",
+	  density_fb_flag ? "on" : "off");
+  const char* fb_format_string= "*unknown*";
+  switch (fb_format) {
+  case FB_DEFAULT: fb_format_string= "default";
+    break;
+  case FB_HALF: fb_format_string= "half";
+    break;
+  case FB_PLANAR: fb_format_string= "planar";
+    break;
+  }
+  fprintf(ofile,"     framebuffer format is %s\n", fb_format_string);
+  fprintf(ofile,"     opacity limit %g\n", opac_limit);
+  if (cull_thresh>0.0)
+    fprintf(ofile,"     culling splats below %g output levels%s\n", 
+	    cull_thresh, cull_points_flag ? ", as points" : "");
+  else fprintf(ofile,"     no contribution culling\n");
+  fprintf(ofile,"     temporal sort %s\n", temporal_sort_flag ? "on" : "off");
+  fprintf(ofile,"     octree culling %s\n", 
+	  octree_culling_flag ? "on" : "off");
+  if (lod_thresh>0.0)
+    fprintf(ofile,"     aggregating octree nodes below %g pixels\n", 
+	    lod_thresh);
+  else fprintf(ofile,"     no level of detail aggregation\n");
+  fprintf(ofile,"     spatial sort %s\n", spatial_sort_flag ? "on" : "off");
+  fprintf(ofile,"     splatting with %d thread%s%s\n",
+	  n_threads, (n_threads==1) ? "" : "s",
+	  exact_threading_flag ? ", exactly" : "");
+  fprintf(ofile,"     in %d process%s\n",
+	  n_procs, (n_procs==1) ? "" : "es");
   fprintf(ofile,"     world transformation follows:\n");
   const float* data= world_trans.floatrep();
   for (int i=0; i<16; i+=4)
@@ -184,113 +288,1626 @@ void StarSplatter::add_stars( StarBunch* sbunch_in )
   total_stars += sbunch_in->nstars();
 }
 
-void StarSplatter::transform_and_merge()
+double StarSplatter::pixel_divergence() const
 {
-  // Check splatbuf size
-  if (splatbuf_size < total_stars) {
-    delete [] splatbuf;
-    splatbuf_size= total_stars;
-    splatbuf= new Splat[splatbuf_size];
-    if (!splatbuf) {
-      fprintf(stderr,
-	  "StarSplatter: Out of memory allocating splat buffer (%d bytes)!\n",
-	      splatbuf_size);
-      exit(-1);
+  // divergence of rays through adjacent pixels
+  // Note that this assumes square pixels
+  return (xsize >= ysize) ? 
+    (DegtoRad*cam.fov())/ysize : (DegtoRad*cam.fov())/xsize; // small angle
+}
+
+/* Particles are transformed in fixed size blocks, none of which spans
+ * two bunches, by a single fused world and screen projection matrix.
+ * The first pass transforms each block four particles at a time, marks
+ * the particles which survive clipping in a bitmask, and counts them.
+ * A prefix sum over the counts gives each block its place in the splat
+ * buffer, and the second pass recomputes just the groups of four which
+ * hold survivors and writes them out.  Survivors thus land in the same
+ * order the serial loop over bunches and particles would give them.
+ */
+#define TRANSFORM_BLOCK_SIZE 4096
+#define TRANSFORM_MASK_WORDS (TRANSFORM_BLOCK_SIZE/32)
+
+struct SplatTransformBlock {
+  int bunch;
+  int first;
+  int last; // one past the end
+  unsigned int id_first; // particle id of first
+  long offset; // survivor count, then place in the splat buffer
+};
+
+struct SplatTransformJob {
+  StarBunch** sbunch_table;
+  SplatTransformBlock* blocks;
+  unsigned int* masks; // TRANSFORM_MASK_WORDS per block
+  float proj[16]; // fused projection, row major
+  gTransfm world_trans;
+  gPoint frompt;
+  double fixed_range; // replaces the per-splat range if >= 0.0
+  double pix_div;
+  float clip_xsize;
+  float clip_ysize;
+  float minz;
+  float maxz;
+  SplatBuffer* splats;
+  unsigned int* ids; // particle id of each splat, or NULL
+  int preselected; // masks hold the particles to consider on entry
+};
+
+/* Transforms four points by the fused matrix, leaving x, y, z and w of
+ * point k in out[4*k] through out[4*k+3].  Returns a 4 bit mask of the
+ * points which fall inside the view volume.  A point with negative w
+ * passes if its negation would, as in the original clipping test.
+ */
+static inline int transform_four( const SplatTransformJob* job,
+				  const gPoint pts[4], float out[16] )
+{
+#ifdef __SSE2__
+  const float* m= job->proj;
+  __m128 col0= _mm_setr_ps(m[0], m[4], m[8], m[12]);
+  __m128 col1= _mm_setr_ps(m[1], m[5], m[9], m[13]);
+  __m128 col2= _mm_setr_ps(m[2], m[6], m[10], m[14]);
+  __m128 col3= _mm_setr_ps(m[3], m[7], m[11], m[15]);
+  __m128 r[4];
+  for (int k=0; k<4; k++) {
+    __m128 v= _mm_mul_ps(col0, _mm_set1_ps(pts[k].x()));
+    v= _mm_add_ps(v, _mm_mul_ps(col1, _mm_set1_ps(pts[k].y())));
+    v= _mm_add_ps(v, _mm_mul_ps(col2, _mm_set1_ps(pts[k].z())));
+    v= _mm_add_ps(v, _mm_mul_ps(col3, _mm_set1_ps(pts[k].w())));
+    r[k]= v;
+    _mm_storeu_ps(out+4*k, v);
+  }
+  _MM_TRANSPOSE4_PS(r[0], r[1], r[2], r[3]);
+  __m128 sign= _mm_and_ps(r[3], _mm_set1_ps(-0.0f));
+  __m128 x= _mm_xor_ps(r[0], sign);
+  __m128 y= _mm_xor_ps(r[1], sign);
+  __m128 z= _mm_xor_ps(r[2], sign);
+  __m128 w= _mm_xor_ps(r[3], sign);
+  __m128 zero= _mm_setzero_ps();
+  __m128 in= _mm_cmpgt_ps(w, zero);
+  in= _mm_and_ps(in, _mm_cmpgt_ps(x, zero));
+  in= _mm_and_ps(in, _mm_cmplt_ps(x, _mm_mul_ps(_mm_set1_ps(job->clip_xsize),
+						w)));
+  in= _mm_and_ps(in, _mm_cmpgt_ps(y, zero));
+  in= _mm_and_ps(in, _mm_cmplt_ps(y, _mm_mul_ps(_mm_set1_ps(job->clip_ysize),
+						w)));
+  in= _mm_and_ps(in, _mm_cmpgt_ps(z, _mm_mul_ps(_mm_set1_ps(job->minz), w)));
+  in= _mm_and_ps(in, _mm_cmplt_ps(z, _mm_mul_ps(_mm_set1_ps(job->maxz), w)));
+  return _mm_movemask_ps(in);
+#else
+  const float* m= job->proj;
+  int result= 0;
+  for (int k=0; k<4; k++) {
+    float* o= out+4*k;
+    for (int row=0; row<4; row++) {
+      float v= m[4*row]*pts[k].x();
+      v += m[4*row+1]*pts[k].y();
+      v += m[4*row+2]*pts[k].z();
+      v += m[4*row+3]*pts[k].w();
+      o[row]= v;
     }
+    float x= o[0], y= o[1], z= o[2], w= o[3];
+    if (w<0.0f) { x= -x; y= -y; z= -z; w= -w; }
+    if ((w>0.0f) && (x>0.0f) && (x<job->clip_xsize*w)
+	&& (y>0.0f) && (y<job->clip_ysize*w)
+	&& (z>job->minz*w) && (z<job->maxz*w))
+      result |= (1<<k);
   }
+  return result;
+#endif
+}
 
-  // Get the camera transformation
+/* Fetches the group of four starting at particle first, padding past last
+ * with copies of the final particle.  Returns the mask of real points.
+ */
+static inline int fetch_four( const StarBunch* sb, const int first,
+			      const int last, gPoint pts[4] )
+{
+  int live= 0;
+  for (int k=0; k<4; k++) {
+    if (first+k<last) {
+      pts[k]= sb->coords(first+k);
+      live |= (1<<k);
+    }
+    else pts[k]= pts[k-1];
+  }
+  return live;
+}
+
+static void splat_transform_mark_task( void* arg, const int iblock,
+				       const int thread )
+{
+  SplatTransformJob* job= (SplatTransformJob*)arg;
+  SplatTransformBlock* block= job->blocks + iblock;
+  const StarBunch* sb= job->sbunch_table[block->bunch];
+  unsigned int* mask= job->masks + (long)iblock*TRANSFORM_MASK_WORDS;
+  int check_valid= sb->has_valids();
+  long count= 0;
+  unsigned int selected[TRANSFORM_MASK_WORDS];
+  for (int w=0; w<TRANSFORM_MASK_WORDS; w++) {
+    selected[w]= (job->preselected) ? mask[w] : 0xFFFFFFFFu;
+    mask[w]= 0;
+  }
+  for (int i=block->first; i<block->last; i += 4) {
+    int bit= i-block->first;
+    int wanted= (selected[bit>>5]>>(bit & 31)) & 0xF;
+    if (!wanted) continue;
+    gPoint pts[4];
+    float out[16];
+    int bits= fetch_four( sb, i, block->last, pts ) & wanted;
+    bits &= transform_four( job, pts, out );
+    if (check_valid)
+      for (int k=0; k<4; k++)
+	if ((bits & (1<<k)) && !sb->valid(i+k)) bits &= ~(1<<k);
+    if (bits) {
+      mask[bit>>5] |= ((unsigned int)bits)<<(bit & 31);
+      count += (bits & 1) + ((bits>>1) & 1) + ((bits>>2) & 1) + (bits>>3);
+    }
+  }
+  block->offset= count;
+}
+
+static void splat_transform_write_task( void* arg, const int iblock,
+					const int thread )
+{
+  SplatTransformJob* job= (SplatTransformJob*)arg;
+  SplatTransformBlock* block= job->blocks + iblock;
+  const StarBunch* sb= job->sbunch_table[block->bunch];
+  const unsigned int* mask= job->masks + (long)iblock*TRANSFORM_MASK_WORDS;
+  long next= block->offset;
+
+  // Per-bunch values, looked up once
+  int per_part_densities= sb->has_per_part_densities();
+  int per_part_exp_constants= sb->has_per_part_exp_constants();
+  double bunch_density= sb->density();
+  double bunch_sqrt_exp_constant= sb->sqrt_exp_constant();
+
+  for (int i=block->first; i<block->last; i += 4) {
+    int bit= i-block->first;
+    int bits= (mask[bit>>5]>>(bit & 31)) & 0xF;
+    if (!bits) continue;
+    gPoint pts[4];
+    float out[16];
+    (void)fetch_four( sb, i, block->last, pts );
+    (void)transform_four( job, pts, out );
+    for (int k=0; k<4; k++) {
+      if (!(bits & (1<<k))) continue;
+      gPoint projpt( out[4*k], out[4*k+1], out[4*k+2], out[4*k+3] );
+      projpt.homogenize();
+      double range= job->fixed_range;
+      if (range<0.0) 
+	range= ((job->world_trans*pts[k]) - job->frompt).length();
+      if (job->ids) job->ids[next]= block->id_first + (i+k-block->first);
+      job->splats->set( next++, projpt.x(), projpt.y(), projpt.z(),
+			(per_part_exp_constants ? 
+			 sb->sqrt_exp_constant(i+k) : 
+			 bunch_sqrt_exp_constant),
+			range*job->pix_div,
+			(per_part_densities ? 
+			 sb->density(i+k) : bunch_density),
+			sb->clr(i+k) );
+    }
+  }
+}
+
+/* Octree culling tests each node's bounds against the clipping test
+ * used for single particles.  That test passes a point if it or its
+ * negation satisfies seven linear inequalities in its homogeneous
+ * screen coordinates, so a box is culled only if some one inequality
+ * fails at all eight corners and some one inequality holds at all of
+ * them.  Particles are clipped by their centers alone, so the nodes
+ * need no padding for the reach of their splats.  The per-particle
+ * test still decides which particles survive, so the octree only
+ * saves work and never changes the image.
+ *
+ * Level of detail changes the image, by drawing each node whose box
+ * spans less than the threshold on screen as one splat standing for
+ * all of its particles.  The span is the box diagonal over its nearest
+ * possible distance from the eye, so a node around the eye is never
+ * aggregated.  The summed density and mean color preserve the node's
+ * energy, apart from the variation of range across it, which the
+ * threshold keeps small.
+ */
+void StarSplatter::get_view_test( ViewTest& test, 
+				  const double lod_pixels ) const
+{
+  Camera view_cam( cam ); // the projection is not a const method
+  gTransfm* cam_trans= view_cam.screen_projection_matrix( xsize, ysize,
+							  screen_minz, 
+							  screen_maxz );
+  gTransfm proj_trans= (*cam_trans)*world_trans;
+  delete cam_trans;
+  for (int i=0; i<16; i++) test.proj[i]= proj_trans.floatrep()[i];
+  test.clip_xsize= xsize-1;
+  test.clip_ysize= ysize-1;
+  test.minz= screen_minz;
+  test.maxz= screen_maxz;
+  test.lod_pixels= (lod_pixels>0.0) ? lod_pixels : 0.0;
+  test.world_trans= world_trans;
+  test.frompt= cam.frompt();
+  test.fixed_range= (cam.parallel_proj()) ?
+    ((cam.atpt() - cam.frompt()).length()) : -1.0;
+  test.pix_div= pixel_divergence();
+}
+
+int StarSplatter::view_test( const ViewTest& view, const gBoundBox& box )
+{
+  const ViewTest* test= &view;
+  double lo[3]= { box.xmin(), box.ymin(), box.zmin() };
+  double hi[3]= { box.xmax(), box.ymax(), box.zmax() };
+  // A little padding allows for rounding in the single particle test
+  double extent= 0.0;
+  for (int axis=0; axis<3; axis++) 
+    extent += (hi[axis]-lo[axis]) + fabs(lo[axis]) + fabs(hi[axis]);
+  double pad= 1.0e-4*extent;
+  for (int axis=0; axis<3; axis++) {
+    lo[axis] -= pad;
+    hi[axis] += pad;
+  }
+
+  // Bit k of each mask stays set while, at every corner, inequality k
+  // fails, holds, or fails for the negated corner
+  int all_fail= 0x7F;
+  int all_hold= 0x7F;
+  int neg_all_fail= 0x7F;
+  for (int corner=0; corner<8; corner++) {
+    double p[3];
+    for (int axis=0; axis<3; axis++) 
+      p[axis]= (corner & (1<<axis)) ? hi[axis] : lo[axis];
+    double h[4];
+    for (int row=0; row<4; row++)
+      h[row]= test->proj[4*row]*p[0] + test->proj[4*row+1]*p[1]
+	+ test->proj[4*row+2]*p[2] + test->proj[4*row+3];
+    double f[7]= { h[3], h[0], test->clip_xsize*h[3] - h[0],
+		   h[1], test->clip_ysize*h[3] - h[1],
+		   h[2] - test->minz*h[3], test->maxz*h[3] - h[2] };
+    for (int k=0; k<7; k++) {
+      if (f[k]>0.0) all_fail &= ~(1<<k);
+      else all_hold &= ~(1<<k);
+      if (f[k]<0.0) neg_all_fail &= ~(1<<k);
+    }
+  }
+  if (all_fail && neg_all_fail) return 0;
+  if (test->lod_pixels>0.0) {
+    gPoint wlo= test->world_trans*gPoint(lo[0],lo[1],lo[2]);
+    gPoint whi= test->world_trans*gPoint(hi[0],hi[1],hi[2]);
+    double diag= (whi-wlo).length();
+    double range= test->fixed_range;
+    if (range<0.0) {
+      gPoint wctr= test->world_trans*box.center();
+      range= (wctr - test->frompt).length() - 0.5*diag;
+    }
+    if (range>0.0 && diag < test->lod_pixels*range*test->pix_div)
+      return 3;
+    return 1; // smaller nodes below may still be aggregated
+  }
+  if (all_hold==0x7F) return 2; // every corner passes as it stands
+  return 1;
+}
+
+static int splat_frustum_test( void* arg, const gBoundBox& box,
+			       const double max_scale )
+{
+  return StarSplatter::view_test( *(const StarSplatter::ViewTest*)arg, box );
+}
+
+/* The second moment of a node's particles along each screen axis,
+ * averaged over the two axes, when seen along dir: the variance of
+ * their projected positions plus that of their kernels, 1/(2 k^2).
+ * An aggregate drawn for the node should have the same moment.
+ */
+static double splat_projected_moment( const StarBunch* sb, 
+				      const StarBunchOctree* tree,
+				      const int inode, const gTransfm& trans,
+				      const gVector& dir )
+{
+  int first= tree->node_first(inode);
+  int last= first+tree->node_count(inode);
+  double weight= 0.0;
+  double sum[3]= { 0.0, 0.0, 0.0 };
+  for (int k=first; k<last; k++) {
+    int i= tree->star(k);
+    if (!sb->valid(i)) continue;
+    double w= sb->density(i);
+    gPoint pt= trans*sb->coords(i);
+    weight += w;
+    sum[0] += w*pt.x();
+    sum[1] += w*pt.y();
+    sum[2] += w*pt.z();
+  }
+  if (weight<=0.0) return 0.0;
+  gPoint centroid( sum[0]/weight, sum[1]/weight, sum[2]/weight );
+  gVector unit_dir= dir;
+  unit_dir.normalize();
+  double moment= 0.0;
+  for (int k=first; k<last; k++) {
+    int i= tree->star(k);
+    if (!sb->valid(i)) continue;
+    gVector offset= (trans*sb->coords(i)) - centroid;
+    double along= offset*unit_dir;
+    double sqrt_exp= sb->sqrt_exp_constant(i);
+    moment += sb->density(i)*(0.5*(offset.lengthsqr() - along*along)
+			      + 0.5/(sqrt_exp*sqrt_exp));
+  }
+  return moment/weight;
+}
+
+void StarSplatter::transform_and_merge( StarBunch** table, 
+					const int ntable )
+{
+  int nstars_in= 0;
+  for (int i=0; i<ntable; i++) nstars_in += table[i]->nstars();
+
+  // Put particles which are close in space close in memory
+  if (spatial_sort_flag)
+    for (int i=0; i<ntable; i++)
+      if (!table[i]->spatially_sorted())
+	table[i]->sort_spatially(n_threads);
+
+  // Check splatbuf size
+  splatbuf->reserve(nstars_in);
+
+  // Get the camera transformation, and fuse it with the world transform
   gTransfm* cam_trans= cam.screen_projection_matrix( xsize, ysize,
 						     screen_minz, 
 						     screen_maxz );
-  Splat* srunner= splatbuf;
-  double clip_xsize= xsize-1;
-  double clip_ysize= ysize-1;
-  for (int i=0; i<n_sbunches; i++) {
-    for (int particle_index=0; particle_index<sbunch_table[i]->nstars();
-	 particle_index++) {
-      if (!sbunch_table[i]->valid(particle_index)) continue;
-      gPoint orientpt= world_trans*(sbunch_table[i]->coords(particle_index));
-      gPoint projpt= *cam_trans*orientpt;
-      if (((projpt.w()>0.0)
-	   &&((projpt.x()>0.0) && (projpt.x()<clip_xsize*projpt.w())
-	      &&(projpt.y()>0.0) && (projpt.y()<clip_ysize*projpt.w())
-	      &&(projpt.z()>screen_minz*projpt.w()) 
-	      &&(projpt.z()<screen_maxz*projpt.w())))
-	  ||((projpt.w()<0.0)
-	     &&(((projpt.x()<0.0) && (projpt.x()>clip_xsize*projpt.w())
-		 &&(projpt.y()<0.0) && (projpt.y()>clip_ysize*projpt.w())
-		 &&(projpt.z()<screen_minz*projpt.w()) 
-		 &&(projpt.z()>screen_maxz*projpt.w()))))) {
+  gTransfm proj_trans= (*cam_trans)*world_trans;
+  delete cam_trans;
+
+  SplatTransformJob job;
+  job.sbunch_table= table;
+  for (int i=0; i<16; i++) job.proj[i]= proj_trans.floatrep()[i];
+  job.world_trans= world_trans;
+  job.frompt= cam.frompt();
+  job.fixed_range= (cam.parallel_proj()) ?
+    ((cam.atpt() - cam.frompt()).length()) : -1.0;
+  job.pix_div= pixel_divergence();
+  job.clip_xsize= xsize-1;
+  job.clip_ysize= ysize-1;
+  job.minz= screen_minz;
+  job.maxz= screen_maxz;
+  job.splats= splatbuf;
+  job.ids= (use_temporal_sort()) ? order_history->ids(nstars_in) : NULL;
+  job.preselected= 0;
+
+  int nblocks= 0;
+  for (int i=0; i<ntable; i++) 
+    nblocks += (table[i]->nstars()+TRANSFORM_BLOCK_SIZE-1)
+      /TRANSFORM_BLOCK_SIZE;
+  job.blocks= new SplatTransformBlock[nblocks];
+  job.masks= new unsigned int[(long)nblocks*TRANSFORM_MASK_WORDS];
+  int iblock= 0;
+  unsigned int id_base= 0;
+  for (int i=0; i<ntable; i++) {
+    for (int first=0; first<table[i]->nstars(); 
+	 first += TRANSFORM_BLOCK_SIZE) {
+      job.blocks[iblock].bunch= i;
+      job.blocks[iblock].first= first;
+      job.blocks[iblock].last= 
+	(first+TRANSFORM_BLOCK_SIZE < table[i]->nstars()) ?
+	first+TRANSFORM_BLOCK_SIZE : table[i]->nstars();
+      job.blocks[iblock].id_first= id_base + first;
+      iblock++;
+    }
+    id_base += table[i]->nstars();
+  }
+
+  int** lod_nodes= NULL;
+  int* n_lod_nodes= NULL;
+  if (octree_culling_flag || lod_thresh>0.0) {
+    // A bunch's blocks are consecutive, so its masks form one bit array
+    for (long w=0; w<(long)nblocks*TRANSFORM_MASK_WORDS; w++) 
+      job.masks[w]= 0;
+    ViewTest test;
+    get_view_test( test, lod_thresh );
+    if (lod_thresh>0.0) {
+      lod_nodes= new int*[ntable];
+      n_lod_nodes= new int[ntable];
+    }
+    long nselected= 0;
+    long first_word= 0;
+    for (int i=0; i<ntable; i++) {
+      const StarBunchOctree* tree= table[i]->octree();
+      if (lod_nodes) lod_nodes[i]= new int[tree->nnodes()];
+      nselected += tree->select( splat_frustum_test, &test, 
+				 job.masks+first_word,
+				 (lod_nodes ? lod_nodes[i] : NULL),
+				 (lod_nodes ? n_lod_nodes+i : NULL) );
+      first_word += (long)TRANSFORM_MASK_WORDS
+	*((table[i]->nstars()+TRANSFORM_BLOCK_SIZE-1)
+	  /TRANSFORM_BLOCK_SIZE);
+    }
+
+    // Drop the blocks with nothing selected
+    int nkept= 0;
+    for (iblock=0; iblock<nblocks; iblock++) {
+      unsigned int* mask= job.masks + (long)iblock*TRANSFORM_MASK_WORDS;
+      unsigned int any= 0;
+      for (int w=0; w<TRANSFORM_MASK_WORDS; w++) any |= mask[w];
+      if (!any) continue;
+      if (nkept!=iblock) {
+	job.blocks[nkept]= job.blocks[iblock];
+	unsigned int* kept_mask= job.masks + (long)nkept*TRANSFORM_MASK_WORDS;
+	for (int w=0; w<TRANSFORM_MASK_WORDS; w++) kept_mask[w]= mask[w];
+      }
+      nkept++;
+    }
+    nblocks= nkept;
+    job.preselected= 1;
+    if (debug()) fprintf(stderr,
+			 "%ld of %d stars in %d blocks pass octree culling\n",
+			 nselected, nstars_in, nblocks);
+  }
+
+  ThreadTeam team(n_threads);
+  team.run( splat_transform_mark_task, &job, nblocks );
+  long nsplats= 0;
+  for (iblock=0; iblock<nblocks; iblock++) {
+    long count= job.blocks[iblock].offset;
+    job.blocks[iblock].offset= nsplats;
+    nsplats += count;
+  }
+  team.run( splat_transform_write_task, &job, nblocks );
+
+  if (lod_nodes) {
+    // Append the aggregates which survive clipping
+    long naggregated= 0;
+    long nagg_splats= 0;
+    double moment_min= HUGE_VAL;
+    double moment_max= 0.0;
+    double moment_sum= 0.0;
+    double moment_weight= 0.0;
+    id_base= 0;
+    for (int i=0; i<ntable; i++) {
+      const StarBunchOctree* tree= table[i]->octree();
+      for (int j=0; j<n_lod_nodes[i]; j++) {
+	StarBunchOctree::Aggregate agg;
+	if (!tree->aggregate( lod_nodes[i][j], agg )) continue;
+	gPoint pts[4]= { agg.center, agg.center, agg.center, agg.center };
+	float out[16];
+	if (!(transform_four( &job, pts, out ) & 1)) continue;
+	gPoint projpt( out[0], out[1], out[2], out[3] );
 	projpt.homogenize();
-	srunner->loc= projpt;
-	srunner->range= (orientpt - cam.frompt()).length();
-	srunner->bunch_index= i;
-	srunner->density= sbunch_table[i]->density( particle_index );
-	srunner->sqrt_exp_constant= 
-	  sbunch_table[i]->sqrt_exp_constant(particle_index);
-	srunner->clr= sbunch_table[i]->clr(particle_index);
-	srunner++;
+	double range= job.fixed_range;
+	if (range<0.0) 
+	  range= ((job.world_trans*agg.center) - job.frompt).length();
+	if (job.ids) job.ids[nsplats]= id_base + agg.first_star;
+	splatbuf->set( nsplats++, projpt.x(), projpt.y(), projpt.z(),
+		       agg.sqrt_exp_constant, range*job.pix_div,
+		       agg.density, agg.clr );
+	naggregated += agg.nstars;
+	nagg_splats++;
+	if (debug()) {
+	  // Check that the aggregate keeps its particles' projected
+	  // second moment
+	  gPoint wctr= job.world_trans*agg.center;
+	  gVector dir= (job.fixed_range<0.0) ? 
+	    (wctr - job.frompt) : (cam.atpt() - cam.frompt());
+	  double moment= splat_projected_moment( table[i], tree, 
+						 lod_nodes[i][j],
+						 job.world_trans, dir );
+	  if (moment>0.0) {
+	    double ratio= 0.5/(agg.sqrt_exp_constant*agg.sqrt_exp_constant
+			       *moment);
+	    if (ratio<moment_min) moment_min= ratio;
+	    if (ratio>moment_max) moment_max= ratio;
+	    moment_sum += agg.density*ratio;
+	    moment_weight += agg.density;
+	  }
+	}
       }
+      id_base += table[i]->nstars();
+      delete [] lod_nodes[i];
+    }
+    delete [] lod_nodes;
+    delete [] n_lod_nodes;
+    if (debug()) {
+      fprintf(stderr,"%ld stars drawn as %ld aggregate splats\n",
+	      naggregated, nagg_splats);
+      // Flattened nodes seen edge on or face on vary about 1.0
+      if (moment_max>0.0)
+	fprintf(stderr,
+		"aggregates keep %f to %f (mean %f) of the projected %s\n",
+		moment_min, moment_max, moment_sum/moment_weight,
+		"second moment");
     }
   }
-  total_stars_after_clipping= srunner - splatbuf;
+
+  splatbuf->set_size(nsplats);
+  total_stars_after_clipping= nsplats;
   if (debug()) fprintf(stderr,
 		       "%d of %d stars remain after clipping\n",
-		       total_stars_after_clipping, total_stars);
+		       total_stars_after_clipping, nstars_in);
 
   // Clean up
-  delete cam_trans;
+  delete [] job.masks;
+  delete [] job.blocks;
+}
+
+/* Contribution culling drops splats which cannot change an 8-bit
+ * output pixel by as much as the cull threshold.  The painter bounds
+ * the kernel weight any one pixel gets, and the exposure type gives
+ * the most output levels a unit of raw pixel value can be worth.  The
+ * first pass marks the culled splats and counts the survivors of each
+ * chunk, the survivors' indices are then written out in order, and
+ * the splat buffer is permuted down to just the survivors.  Culled
+ * splats which are to become points are deposited on a start image.
+ */
+struct SplatCullJob {
+  SplatPainter* painter;
+  const SplatBuffer* splats;
+  long n;
+  int nchunks;
+  double min_peak; // raw pixel value below which a splat is culled
+  unsigned char* culled; // n
+  long* chunk_kept; // nchunks; counts, then offsets
+  double* chunk_energy; // nchunks
+  double* chunk_culled_energy; // nchunks
+  unsigned long long* recs;
+};
+
+static void splat_cull_mark_task( void* arg, const int chunk,
+				  const int thread )
+{
+  SplatCullJob* job= (SplatCullJob*)arg;
+  long first= (chunk*job->n)/job->nchunks;
+  long last= ((chunk+1)*job->n)/job->nchunks;
+  long kept= 0;
+  double energy= 0.0;
+  double culled_energy= 0.0;
+  for (long i=first; i<last; i++) {
+    StarSplatter::Splat splat;
+    job->splats->get( i, splat );
+    double brightest= splat.clr.r();
+    if (splat.clr.g()>brightest) brightest= splat.clr.g();
+    if (splat.clr.b()>brightest) brightest= splat.clr.b();
+    if (splat.clr.a()>brightest) brightest= splat.clr.a();
+    brightest *= splat.density;
+    double splat_energy= 
+      brightest/((double)splat.sep_fac*(double)splat.sep_fac);
+    energy += splat_energy;
+    if (brightest*job->painter->peak_weight(&splat) < job->min_peak) {
+      job->culled[i]= 1;
+      culled_energy += splat_energy;
+    }
+    else {
+      job->culled[i]= 0;
+      kept++;
+    }
+  }
+  job->chunk_kept[chunk]= kept;
+  job->chunk_energy[chunk]= energy;
+  job->chunk_culled_energy[chunk]= culled_energy;
 }
 
-int StarSplatter::splat_depth_compare( const void* s1, const void* s2 )
+static void splat_cull_gather_task( void* arg, const int chunk,
+				    const int thread )
 {
-  double z1= ((Splat*)s1)->loc.z();
-  double z2= ((Splat*)s2)->loc.z();
-  if (z1<z2) return -1;
-  else if (z1>z2) return 1;
-  else return 0;
+  SplatCullJob* job= (SplatCullJob*)arg;
+  long first= (chunk*job->n)/job->nchunks;
+  long last= ((chunk+1)*job->n)/job->nchunks;
+  long next= job->chunk_kept[chunk];
+  for (long i=first; i<last; i++)
+    if (!job->culled[i]) job->recs[next++]= (unsigned long long)i;
 }
 
-void StarSplatter::sort()
+double StarSplatter::cull_levels_per_unit() const
 {
-  // Sort the splat buffer
-  qsort(splatbuf, total_stars_after_clipping, sizeof(Splat),
-	splat_depth_compare);
+  switch (current_exposure_type) {
+  case ET_LINEAR: 
+    return 255.0*exp_scale;
+  case ET_LOG:
+  case ET_NOOPAC_LOG:
+    // The log mapping is steepest at the lower bound
+    if (log_rescale_min<=0.0 || log_rescale_max<=log_rescale_min) 
+      return 0.0;
+    return 255.0*exp_scale
+      /(log_rescale_min*(log(log_rescale_max)-log(log_rescale_min)));
+  default:
+    return 0.0; // automatic or nonlinear rescaling
+  }
+}
+
+SplatFramebuffer* StarSplatter::cull_faint()
+{
+  double levels_per_unit= cull_levels_per_unit();
+  long n= total_stars_after_clipping;
+  if (cull_thresh<=0.0 || levels_per_unit<=0.0 || n<1) return NULL;
+  reserve_sortkeys(n);
+
+  ThreadTeam team(n_threads);
+  SplatCullJob job;
+  job.painter= current_splat_painter;
+  job.splats= splatbuf;
+  job.n= n;
+  job.nchunks= team.nthreads();
+  job.min_peak= cull_thresh/levels_per_unit;
+  job.culled= new unsigned char[n];
+  job.chunk_kept= new long[job.nchunks];
+  job.chunk_energy= new double[job.nchunks];
+  job.chunk_culled_energy= new double[job.nchunks];
+  job.recs= sortkeys;
+  team.run( splat_cull_mark_task, &job, job.nchunks );
+  long kept= 0;
+  double energy= 0.0;
+  double culled_energy= 0.0;
+  for (int chunk=0; chunk<job.nchunks; chunk++) {
+    long count= job.chunk_kept[chunk];
+    job.chunk_kept[chunk]= kept;
+    kept += count;
+    energy += job.chunk_energy[chunk];
+    culled_energy += job.chunk_culled_energy[chunk];
+  }
+
+  // Points carry energy, so they only make sense when it is summed
+  SplatFramebuffer* start_image= NULL;
+  long npoints= 0;
+  if (cull_points_flag && additive_compositing() && kept<n) {
+    start_image= new SplatFramebuffer( xsize, ysize, pixel_format() );
+    if (!start_image->valid()) {
+      fprintf(stderr,"cull_faint: no memory to keep splats as points!\n");
+      delete start_image;
+      start_image= NULL;
+    }
+  }
+  if (start_image) {
+    for (long i=0; i<n; i++) {
+      if (!job.culled[i]) continue;
+      Splat splat;
+      splatbuf->get( i, splat );
+      // Splats centered off the image have nowhere to go
+      if (splat.x<0.0 || splat.x>=xsize || splat.y<0.0 || splat.y>=ysize)
+	continue;
+      gColor clr= splat.clr;
+      clr.mult_noclamp( splat.density
+			/((double)splat.sep_fac*(double)splat.sep_fac) );
+      clr.clamp_alpha();
+      start_image->touch_pixel( (int)splat.x, (int)splat.y );
+      start_image->add_pixel( ((int)splat.y)*xsize + (int)splat.x, clr );
+      npoints++;
+    }
+  }
+
+  if (kept<n) {
+    team.run( splat_cull_gather_task, &job, job.nchunks );
+    splatbuf->set_size(kept);
+    splatbuf->permute( sortkeys, team );
+    if (use_temporal_sort()) {
+      // Survivors keep their order, so the ids can be packed in place
+      unsigned int* ids= order_history->ids(n);
+      for (long i=0; i<kept; i++) ids[i]= ids[sortkeys[i] & 0xffffffffULL];
+    }
+    total_stars_after_clipping= kept;
+  }
+
+  if (debug())
+    fprintf(stderr,
+	    "culled %ld of %ld splats below %g levels (%ld as points), "
+	    "%g%% of the energy\n",
+	    n-kept, n, cull_thresh, npoints, 
+	    (energy>0.0) ? 100.0*culled_energy/energy : 0.0);
+
+  delete [] job.chunk_culled_energy;
+  delete [] job.chunk_energy;
+  delete [] job.chunk_kept;
+  delete [] job.culled;
+  return start_image;
+}
+
+/* The depth sort packs each splat's depth key and buffer index into a
+ * single 64 bit record, radix sorts the records, and then permutes the
+ * splat buffer in one pass per field.  The radix sort is stable, so
+ * splats at equal depth keep their transformed order.  For nearest-
+ * first order the sorted records are simply reversed, so that ties
+ * are also met in the reverse of the back-to-front order.
+ *
+ * With the temporal sort, the records start out in the previous
+ * frame's order instead, and an insertion sort on the whole record
+ * finishes the job in near-linear time if the order has changed only
+ * a little.  The result is then exactly what the full sort would give.
+ * If the insertion sort has to move records more than this many places
+ * per splat on average, the camera has moved too far and the full sort
+ * takes over; moving that many costs about as much as the full sort.
+ */
+#define TEMPORAL_SORT_MAX_MOVES 32
+struct SplatSortJob {
+  const SplatBuffer* splats;
+  unsigned long long* recs;
+  long n;
+  int nchunks;
+};
+
+static void splat_sort_key_task( void* arg, const int chunk, 
+				 const int thread )
+{
+  SplatSortJob* job= (SplatSortJob*)arg;
+  long first= (chunk*job->n)/job->nchunks;
+  long last= ((chunk+1)*job->n)/job->nchunks;
+  for (long i=first; i<last; i++)
+    job->recs[i]= 
+      (((unsigned long long)ssplat_float_sort_key(job->splats->z(i)))<<32)
+      | (unsigned long long)i;
+}
+
+void StarSplatter::reserve_sortkeys( const long n )
+{
+  if (sortkeys_size < n) {
+    delete [] sortkeys;
+    sortkeys_size= n;
+    sortkeys= new unsigned long long[2*sortkeys_size];
+    if (!sortkeys) {
+      fprintf(stderr,
+	      "StarSplatter: Out of memory allocating sort buffers!\n");
+      exit(-1);
+    }
+  }
+}
+
+void StarSplatter::sort( const int nearest_first )
+{
+  long n= total_stars_after_clipping;
+  if (n>1) {
+    reserve_sortkeys(n);
+    
+    ThreadTeam team(n_threads);
+    int sorted= 0;
+    if (use_temporal_sort()
+	&& order_history->seed( splatbuf, n, total_stars, sortkeys )) {
+      sorted= ssplat_insertion_sort( sortkeys, n, 
+				     TEMPORAL_SORT_MAX_MOVES*n );
+      order_history->report( sorted );
+      if (debug() && !sorted) 
+	fprintf(stderr,"Order changed too much for the temporal sort\n");
+    }
+    if (!sorted) {
+      SplatSortJob job;
+      job.splats= splatbuf;
+      job.recs= sortkeys;
+      job.n= n;
+      job.nchunks= team.nthreads();
+      team.run( splat_sort_key_task, &job, job.nchunks );
+      ssplat_radix_sort( sortkeys, sortkeys+sortkeys_size, n, 32, 32, team );
+    }
+    if (use_temporal_sort())
+      order_history->remember( sortkeys, n, total_stars );
+    if (nearest_first) {
+      for (long i=0; i<n/2; i++) {
+	unsigned long long tmp= sortkeys[i];
+	sortkeys[i]= sortkeys[n-1-i];
+	sortkeys[n-1-i]= tmp;
+      }
+    }
+    splatbuf->permute( sortkeys, team );
+  }
   if (debug()) fprintf(stderr,"Sort complete\n");
 }
 
+int StarSplatter::additive_compositing() const
+{
+  switch (current_composite_type) {
+  case CT_BACK_TO_FRONT: return 0;
+  case CT_FRONT_TO_BACK: return 0;
+  case CT_WEIGHTED_BLENDED: return 0;
+  case CT_ADDITIVE: return 1;
+  default:
+    switch (current_exposure_type) {
+    case ET_NOOPAC_LINEAR:
+    case ET_NOOPAC_LOG:
+    case ET_NOOPAC_LOG_AUTO:
+    case ET_NOOPAC_LOG_HSV:
+    case ET_NOOPAC_LOG_HSV_AUTO:
+      return 1;
+    default:
+      return 0;
+    }
+  }
+}
+
+int StarSplatter::front_to_back_compositing() const
+{
+  return (current_composite_type==CT_FRONT_TO_BACK);
+}
+
+int StarSplatter::weighted_blended_compositing() const
+{
+  return (current_composite_type==CT_WEIGHTED_BLENDED);
+}
+
+int StarSplatter::pixel_format() const
+{
+  // The swap compositor shares gColor images between processes
+  if (n_procs>1) return SPF_RGBA;
+  if (density_fb_flag && !weighted_blended_compositing()) {
+    switch (current_exposure_type) {
+    case ET_LATE_CMAP_A:
+    case ET_LATE_CMAP_LOG_A:
+    case ET_LATE_CMAP_LOG_A_AUTO:
+      return SPF_DENSITY;
+    default:
+      break;
+    }
+  }
+  switch (fb_format) {
+  case FB_HALF: 
+    // Running sums would lose small additions to the 11 bit mantissa,
+    // and soon pass the largest half
+    if (additive_compositing() || weighted_blended_compositing())
+      return SPF_RGBA;
+    return SPF_HALF;
+  case FB_PLANAR: return SPF_PLANAR;
+  default: return SPF_RGBA;
+  }
+}
+
 void StarSplatter::point_splat_all_stars( rgbImage* image )
 {
-  for (Splat* srunner= splatbuf;
-       srunner< splatbuf + total_stars_after_clipping;
-       srunner++) {
-    image->setpix( (int)(srunner->loc.x()), 
-		   ysize-((int)(srunner->loc.y())+1),
-		   srunner->clr );
+  for (long i=0; i<total_stars_after_clipping; i++) {
+    image->setpix( (int)(splatbuf->x(i)), 
+		   ysize-((int)(splatbuf->y(i))+1),
+		   splatbuf->clr(i) );
   }
 }
 
-int StarSplatter::splat_all_stars( rgbImage* image )
+/* Tile binning for multithreaded splatting.  The image is cut into
+ * square tiles, and each depth-sorted splat is entered in the bin of
+ * every tile its footprint overlaps.  Each tile is then painted by a
+ * single thread, in depth order, with painting clipped to the tile, so
+ * every pixel sees exactly the sequence of add_under() operations the
+ * serial loop would perform.  Binning is done in two passes over
+ * contiguous chunks of the splat buffer, which keeps each bin sorted.
+ * The counting pass also estimates each tile's cost as the area of the
+ * footprints falling on it, and the tiles are scheduled on that basis.
+ */
+
+/* The cost of painting a splat is taken to be its footprint area in
+ * pixels, plus this much for the per-splat overhead.
+ */
+#define SPLAT_COST_OVERHEAD 8.0
+
+/* The cost of clearing and compositing one pixel of a depth slab's
+ * framebuffer, in the same units.
+ */
+#define SPLAT_SLAB_PIXEL_COST 2.0
+
+struct SplatTileJob {
+  SplatPainter* painter;
+  const SplatBuffer* splats;
+  int nsplats;
+  SplatFramebuffer* image;
+  SplatOpacityMap* opacity; // or NULL
+  int xsize;
+  int ysize;
+  int tile_size;
+  int ntiles_x;
+  int ntiles_y;
+  int nchunks;
+  long* chunk_offsets; // nchunks*ntiles; counts, then fill positions
+  double* chunk_costs; // nchunks*ntiles
+  long* tile_start; // ntiles+1; entries may number more than 2^31
+  int* bin_entries;
+};
+
+static void splat_tile_bin_task( void* arg, const int chunk, 
+				 const int thread, const int fill )
 {
-  // Note that this routine assumes square pixels
+  SplatTileJob* job= (SplatTileJob*)arg;
+  int ntiles= job->ntiles_x*job->ntiles_y;
+  long* offsets= job->chunk_offsets + chunk*ntiles;
+  double* costs= job->chunk_costs + chunk*ntiles;
+  int first= (int)(((long)chunk*job->nsplats)/job->nchunks);
+  int last= (int)(((long)(chunk+1)*job->nsplats)/job->nchunks);
+  for (int i=first; i<last; i++) {
+    StarSplatter::Splat splat;
+    job->splats->get( i, splat );
+    SplatPixelRect rect;
+    job->painter->footprint( &splat, rect );
+    if (rect.imin>rect.imax || rect.jmin>rect.jmax) continue;
+    int txmin= rect.imin/job->tile_size;
+    int txmax= rect.imax/job->tile_size;
+    int tymin= rect.jmin/job->tile_size;
+    int tymax= rect.jmax/job->tile_size;
+    for (int ty=tymin; ty<=tymax; ty++) {
+      int tjmin= ty*job->tile_size;
+      int tjmax= tjmin + job->tile_size - 1;
+      int height= ((rect.jmax<tjmax) ? rect.jmax : tjmax)
+	- ((rect.jmin>tjmin) ? rect.jmin : tjmin) + 1;
+      for (int tx=txmin; tx<=txmax; tx++) {
+	int tile= ty*job->ntiles_x + tx;
+	if (fill) job->bin_entries[offsets[tile]++]= i;
+	else {
+	  int timin= tx*job->tile_size;
+	  int timax= timin + job->tile_size - 1;
+	  int width= ((rect.imax<timax) ? rect.imax : timax)
+	    - ((rect.imin>timin) ? rect.imin : timin) + 1;
+	  offsets[tile]++;
+	  costs[tile] += (double)width*(double)height + SPLAT_COST_OVERHEAD;
+	}
+      }
+    }
+  }
+}
+
+static void splat_tile_count_task( void* arg, const int chunk, 
+				   const int thread )
+{
+  splat_tile_bin_task( arg, chunk, thread, 0 );
+}
 
-  gColor* pixrunner;
+static void splat_tile_fill_task( void* arg, const int chunk, 
+				  const int thread )
+{
+  splat_tile_bin_task( arg, chunk, thread, 1 );
+}
 
-  // Create and clear the temporary image 
-  // (default constructor is transparent black)
-  gColor* tmp_image= new gColor[ xsize*ysize ]; // stored as floats
-  if (!tmp_image) {
+static void splat_tile_paint_task( void* arg, const int task, 
+				   const int thread )
+{
+  SplatTileJob* job= (SplatTileJob*)arg;
+  int tile= task;
+  SplatPixelRect clip;
+  clip.imin= (tile % job->ntiles_x)*job->tile_size;
+  clip.imax= clip.imin + job->tile_size - 1;
+  if (clip.imax>=job->xsize) clip.imax= job->xsize-1;
+  clip.jmin= (tile / job->ntiles_x)*job->tile_size;
+  clip.jmax= clip.jmin + job->tile_size - 1;
+  if (clip.jmax>=job->ysize) clip.jmax= job->ysize-1;
+
+  SplatFrame frame;
+  job->image->get_frame( frame );
+  frame.opacity= job->opacity;
+
+  // Statistics are not kept in this mode
+  StarSplatter::Splat batch[SPLAT_BATCH_SIZE];
+  int* entry= job->bin_entries + job->tile_start[tile];
+  int* last= job->bin_entries + job->tile_start[tile+1];
+  while (entry<last) {
+    int n= 0;
+    while (entry<last && n<SPLAT_BATCH_SIZE) 
+      job->splats->get( *entry++, batch[n++] );
+    job->painter->paint_batch( batch, n, clip, frame, NULL, NULL );
+  }
+}
+
+int StarSplatter::splat_by_tiles( SplatFramebuffer* tmp_image, 
+				  SplatOpacityMap* opacity, 
+				  const int slabs_ok )
+{
+  ThreadTeam team(n_threads);
+  SplatTileJob job;
+  job.painter= current_splat_painter;
+  job.splats= splatbuf;
+  job.nsplats= total_stars_after_clipping;
+  job.image= tmp_image;
+  job.opacity= opacity;
+  job.xsize= xsize;
+  job.ysize= ysize;
+  job.tile_size= splat_tile_size;
+  job.ntiles_x= (xsize+splat_tile_size-1)/splat_tile_size;
+  job.ntiles_y= (ysize+splat_tile_size-1)/splat_tile_size;
+  job.nchunks= team.nthreads();
+  int ntiles= job.ntiles_x*job.ntiles_y;
+
+  job.chunk_offsets= new long[job.nchunks*ntiles];
+  job.chunk_costs= new double[job.nchunks*ntiles];
+  for (int i=0; i<job.nchunks*ntiles; i++) {
+    job.chunk_offsets[i]= 0;
+    job.chunk_costs[i]= 0.0;
+  }
+  team.run( splat_tile_count_task, &job, job.nchunks );
+
+  job.tile_start= new long[ntiles+1];
+  double* tile_costs= new double[ntiles];
+  long running= 0;
+  for (int tile=0; tile<ntiles; tile++) {
+    job.tile_start[tile]= running;
+    tile_costs[tile]= 0.0;
+    for (int chunk=0; chunk<job.nchunks; chunk++) {
+      long count= job.chunk_offsets[chunk*ntiles + tile];
+      job.chunk_offsets[chunk*ntiles + tile]= running;
+      running += count;
+      tile_costs[tile] += job.chunk_costs[chunk*ntiles + tile];
+    }
+  }
+  job.tile_start[ntiles]= running;
+
+  if (slabs_ok && team.nthreads()>1) {
+    // Compare the time the tiles would take, given their imbalance and
+    // the overhead of every bin entry, with that of depth slabs
+    int nthr= team.nthreads();
+    double total= 0.0;
+    double largest= 0.0;
+    for (int tile=0; tile<ntiles; tile++) {
+      total += tile_costs[tile];
+      if (tile_costs[tile]>largest) largest= tile_costs[tile];
+    }
+    double tiles_time= (largest > total/nthr) ? largest : total/nthr;
+    double area= total - SPLAT_COST_OVERHEAD*running;
+    double slabs_time= (area + SPLAT_COST_OVERHEAD*job.nsplats)/nthr
+      + SPLAT_SLAB_PIXEL_COST*(double)xsize*ysize*(nthr-1)/nthr;
+    if (slabs_time<tiles_time) {
+      delete [] tile_costs;
+      delete [] job.tile_start;
+      delete [] job.chunk_costs;
+      delete [] job.chunk_offsets;
+      return 0;
+    }
+  }
+
+  job.bin_entries= new int[running];
+  team.run( splat_tile_fill_task, &job, job.nchunks );
+
+  team.run_costed( splat_tile_paint_task, &job, ntiles, tile_costs );
+
+  if (debug()) 
+    fprintf(stderr,"splatted %d particles as %ld tile entries on %d threads\n",
+	    total_stars_after_clipping, running, team.nthreads());
+
+  delete [] job.bin_entries;
+  delete [] tile_costs;
+  delete [] job.tile_start;
+  delete [] job.chunk_costs;
+  delete [] job.chunk_offsets;
+  return 1;
+}
+
+/* Paints one splat on a coarser level of a pyramid */
+static void splat_pyramid_paint( SplatPainter* painter, 
+				 SplatPyramid* pyramid, const int level,
+				 const StarSplatter::Splat& splat,
+				 double* krnl_integral, int* pixels_touched )
+{
+  StarSplatter::Splat coarse;
+  pyramid->coarsen( splat, level, coarse );
+  const SplatFrame& frame= pyramid->frame( level );
+  SplatPixelRect whole_level;
+  whole_level.imin= 0;
+  whole_level.imax= frame.xsize-1;
+  whole_level.jmin= 0;
+  whole_level.jmax= frame.ysize-1;
+  painter->paint_batch( &coarse, 1, whole_level, frame, 
+			krnl_integral, pixels_touched );
+}
+
+/* Estimates the cost of painting each splat, in parallel over chunks of
+ * the splat buffer, for cutting the buffer into ranges of about equal
+ * cost.  Splats to be painted on a coarser pyramid level cost less.
+ */
+struct SplatCostJob {
+  SplatPainter* painter;
+  const SplatBuffer* splats;
+  long nsplats;
+  int nchunks;
+  double* chunk_costs; // nchunks
+  float* splat_costs; // nsplats
+  const SplatPyramid* pyramid; // or NULL
+};
+
+static void splat_cost_task( void* arg, const int chunk, const int thread )
+{
+  SplatCostJob* job= (SplatCostJob*)arg;
+  long first= (chunk*job->nsplats)/job->nchunks;
+  long last= ((chunk+1)*job->nsplats)/job->nchunks;
+  double total= 0.0;
+  for (long i=first; i<last; i++) {
+    StarSplatter::Splat splat;
+    job->splats->get( i, splat );
+    SplatPixelRect rect;
+    job->painter->footprint( &splat, rect );
+    double cost= 0.0;
+    if (rect.imin<=rect.imax && rect.jmin<=rect.jmax)
+      cost= (double)(rect.imax-rect.imin+1)*(double)(rect.jmax-rect.jmin+1);
+    if (job->pyramid) {
+      // Each pyramid level has a quarter of the pixels of the one below
+      int level= job->pyramid->level_for( splat, 
+					  job->painter->reach(&splat) );
+      cost /= (double)(1<<(2*level));
+    }
+    cost += SPLAT_COST_OVERHEAD;
+    job->splat_costs[i]= (float)cost;
+    total += cost;
+  }
+  job->chunk_costs[chunk]= total;
+}
+
+/* Returns the nranges+1 starts of the ranges, and sets range_costs to
+ * a new array of their costs.  nranges is reduced if there are fewer
+ * splats than that.
+ */
+static long* splat_cut_by_cost( ThreadTeam& team, SplatPainter* painter,
+				const SplatBuffer* splats, const long nsplats,
+				const SplatPyramid* pyramid, int& nranges,
+				double*& range_costs )
+{
+  SplatCostJob job;
+  job.painter= painter;
+  job.splats= splats;
+  job.nsplats= nsplats;
+  job.nchunks= team.nthreads();
+  job.pyramid= pyramid;
+  job.chunk_costs= new double[job.nchunks];
+  job.splat_costs= new float[nsplats];
+  team.run( splat_cost_task, &job, job.nchunks );
+  double total= 0.0;
+  for (int chunk=0; chunk<job.nchunks; chunk++) 
+    total += job.chunk_costs[chunk];
+
+  if (nranges>nsplats) nranges= (nsplats>0) ? nsplats : 1;
+  long* start= new long[nranges+1];
+  range_costs= new double[nranges];
+  int range= 0;
+  double running= 0.0;
+  start[0]= 0;
+  range_costs[0]= 0.0;
+  for (long i=0; i<nsplats; i++) {
+    if (running >= (range+1)*total/nranges && range<nranges-1) {
+      start[++range]= i;
+      range_costs[range]= 0.0;
+    }
+    running += job.splat_costs[i];
+    range_costs[range] += job.splat_costs[i];
+  }
+  while (range<nranges-1) {
+    start[++range]= nsplats;
+    range_costs[range]= 0.0;
+  }
+  start[nranges]= nsplats;
+
+  delete [] job.splat_costs;
+  delete [] job.chunk_costs;
+  return start;
+}
+
+/* With additive compositing splat order does not matter, so the splat
+ * buffer is cut into ranges of about equal estimated cost, and each
+ * thread paints the ranges it takes over the whole image into a
+ * framebuffer of its own.  There are several ranges per thread, and
+ * they are scheduled by work stealing.  The framebuffers are then
+ * summed into the first, in parallel over bands of rows, skipping
+ * the tiles a thread never painted.  Weighted blending works the same
+ * way, with a revealage buffer per thread as well; revealage buffers
+ * are multiplied rather than summed.
+ */
+struct SplatAdditiveJob {
+  SplatPainter* painter;
+  const SplatBuffer* splats;
+  long nsplats;
+  int ntasks;
+  long* task_start; // ntasks+1
+  int nimages;
+  SplatFramebuffer** images; // one per thread
+  float** reveals; // one per thread, or NULL
+  SplatPyramid** pyramids; // one per thread, or NULL
+  int format; // of the images
+  int xsize;
+  int ysize;
+  int nbands;
+};
+
+static void splat_additive_paint_task( void* arg, const int task,
+				       const int thread )
+{
+  SplatAdditiveJob* job= (SplatAdditiveJob*)arg;
+  SplatPixelRect whole_image;
+  whole_image.imin= 0;
+  whole_image.imax= job->xsize-1;
+  whole_image.jmin= 0;
+  whole_image.jmax= job->ysize-1;
+
+  // Each framebuffer is created by the thread that fills it
+  if (!job->images[thread]) 
+    job->images[thread]= new SplatFramebuffer( job->xsize, job->ysize,
+					       job->format );
+  if (job->reveals && !job->reveals[thread]) {
+    long npix= (long)job->xsize*job->ysize;
+    job->reveals[thread]= new float[npix];
+    for (long p=0; p<npix; p++) job->reveals[thread][p]= 1.0f;
+  }
+
+  SplatFrame frame;
+  job->images[thread]->get_frame( frame );
+  frame.reveal= job->reveals ? job->reveals[thread] : NULL;
+  SplatPyramid* pyramid= job->pyramids ? job->pyramids[thread] : NULL;
+
+  // Statistics are not kept in this mode
+  StarSplatter::Splat batch[SPLAT_BATCH_SIZE];
+  long last= job->task_start[task+1];
+  for (long i=job->task_start[task]; i<last; ) {
+    int n= 0;
+    while (i<last && n<SPLAT_BATCH_SIZE) {
+      job->splats->get( i++, batch[n] );
+      if (pyramid) {
+	int level= pyramid->level_for( batch[n], 
+				       job->painter->reach(batch+n) );
+	if (level) {
+	  splat_pyramid_paint( job->painter, pyramid, level, batch[n],
+			       NULL, NULL );
+	  continue;
+	}
+      }
+      n++;
+    }
+    if (n) job->painter->paint_batch( batch, n, whole_image, frame, 
+				      NULL, NULL );
+  }
+}
+
+static void splat_additive_collapse_task( void* arg, const int thread,
+					  const int thread_in_team )
+{
+  SplatAdditiveJob* job= (SplatAdditiveJob*)arg;
+  if (job->images[thread]) 
+    job->pyramids[thread]->collapse( job->images[thread] );
+}
+
+static void splat_additive_reduce_task( void* arg, const int band,
+					const int thread )
+{
+  SplatAdditiveJob* job= (SplatAdditiveJob*)arg;
+  int jfirst= (int)((long)band*job->ysize/job->nbands);
+  int jlast= (int)((long)(band+1)*job->ysize/job->nbands);
+  SplatFramebuffer* result= job->images[0];
+  for (int i=1; i<job->nimages; i++) {
+    const SplatFramebuffer* other= job->images[i];
+    if (!other) continue; // this thread took no ranges
+    for (int j=jfirst; j<jlast; j++) {
+      for (int imin=0; imin<job->xsize; imin += FRAMEBUFFER_TILE_SIZE) {
+	// Untouched pixels add nothing, and reveal nothing either
+	if (!other->touched( other->tile_of(imin,j) )) continue;
+	int imax= imin + FRAMEBUFFER_TILE_SIZE;
+	if (imax>job->xsize) imax= job->xsize;
+	long first= (long)j*job->xsize + imin;
+	long last= (long)j*job->xsize + imax;
+	result->touch_pixel( imin, j );
+	result->composite( other, first, last-first, SC_ADD, 0 );
+	if (job->reveals) {
+	  float* reveal= job->reveals[0];
+	  const float* other_reveal= job->reveals[i];
+	  for (long p=first; p<last; p++) reveal[p] *= other_reveal[p];
+	}
+      }
+    }
+  }
+}
+
+void StarSplatter::splat_additive( SplatFramebuffer* tmp_image, 
+				   float* tmp_reveal )
+{
+  ThreadTeam team(n_threads);
+  SplatAdditiveJob job;
+  job.painter= current_splat_painter;
+  job.splats= splatbuf;
+  job.nsplats= total_stars_after_clipping;
+  job.xsize= xsize;
+  job.ysize= ysize;
+  job.nbands= 4*team.nthreads();
+  if (job.nbands>ysize) job.nbands= ysize;
+  job.nimages= team.nthreads();
+  job.images= new SplatFramebuffer*[job.nimages];
+  job.images[0]= tmp_image;
+  job.format= tmp_image->format();
+  for (int i=1; i<job.nimages; i++) job.images[i]= NULL;
+  job.reveals= NULL;
+  if (tmp_reveal) {
+    job.reveals= new float*[job.nimages];
+    job.reveals[0]= tmp_reveal;
+    for (int i=1; i<job.nimages; i++) job.reveals[i]= NULL;
+  }
+  // Levels can be summed, but not revealage products
+  job.pyramids= NULL;
+  if (pyr_radius>0.0 && !tmp_reveal) {
+    job.pyramids= new SplatPyramid*[job.nimages];
+    for (int i=0; i<job.nimages; i++) 
+      job.pyramids[i]= new SplatPyramid(xsize, ysize, pyr_radius, 
+					job.format);
+  }
+
+  // Cut the splats into ranges of equal estimated cost
+  job.ntasks= 8*team.nthreads();
+  double* task_costs;
+  job.task_start= splat_cut_by_cost( team, current_splat_painter, splatbuf,
+				     job.nsplats, 
+				     (job.pyramids) ? job.pyramids[0] : NULL,
+				     job.ntasks, task_costs );
+
+  team.run_costed( splat_additive_paint_task, &job, job.ntasks, task_costs );
+  if (job.pyramids) 
+    team.run( splat_additive_collapse_task, &job, job.nimages );
+  team.run( splat_additive_reduce_task, &job, job.nbands );
+
+  if (debug()) 
+    fprintf(stderr,"splatted %d particles additively on %d threads\n",
+	    total_stars_after_clipping, team.nthreads());
+
+  for (int i=1; i<job.nimages; i++) delete job.images[i];
+  delete [] job.images;
+  if (job.reveals) {
+    for (int i=1; i<job.nimages; i++) delete [] job.reveals[i];
+    delete [] job.reveals;
+  }
+  if (job.pyramids) {
+    for (int i=0; i<job.nimages; i++) delete job.pyramids[i];
+    delete [] job.pyramids;
+  }
+  delete [] task_costs;
+  delete [] job.task_start;
+}
+
+/* Depth slabs cut the sorted splats into one range of about equal
+ * estimated cost per thread, and each thread paints its range over the
+ * whole image into a framebuffer of its own; the first range is painted
+ * into the image itself.  The over operator is associative, so
+ * combining the framebuffers in order, in parallel over bands of rows,
+ * gives the serial result apart from rounding.  This beats tile binning
+ * when the splats crowd into a few tiles or large splats fall in many
+ * bins, at the cost of the extra framebuffers.  In front-to-back mode
+ * each slab gets an opacity map of its own, and pixels which the
+ * combined slabs bring to the limit are recorded in the image's map.
+ * An opacity limit below 1.0 would stop painting within each slab
+ * rather than across them, so slabs are not used then.
+ */
+struct SplatSlabJob {
+  SplatPainter* painter;
+  const SplatBuffer* splats;
+  int nslabs;
+  long* slab_start; // nslabs+1
+  SplatFramebuffer** images; // one per slab
+  SplatOpacityMap* opacity; // the image's, or NULL
+  int format; // of the images
+  int xsize;
+  int ysize;
+  int nbands;
+};
+
+static void splat_slab_paint_task( void* arg, const int slab,
+				   const int thread )
+{
+  SplatSlabJob* job= (SplatSlabJob*)arg;
+  SplatPixelRect whole_image;
+  whole_image.imin= 0;
+  whole_image.imax= job->xsize-1;
+  whole_image.jmin= 0;
+  whole_image.jmax= job->ysize-1;
+
+  // Each framebuffer is created by the thread that fills it
+  if (!job->images[slab]) 
+    job->images[slab]= new SplatFramebuffer( job->xsize, job->ysize,
+					     job->format );
+  SplatFrame frame;
+  job->images[slab]->get_frame( frame );
+  frame.opacity= job->opacity;
+  if (job->opacity && slab) 
+    frame.opacity= new SplatOpacityMap( job->xsize, job->ysize, 
+					job->opacity->limit() );
+
+  // Statistics are not kept in this mode
+  StarSplatter::Splat batch[SPLAT_BATCH_SIZE];
+  long last= job->slab_start[slab+1];
+  for (long i=job->slab_start[slab]; i<last; ) {
+    int n= 0;
+    while (i<last && n<SPLAT_BATCH_SIZE) job->splats->get( i++, batch[n++] );
+    job->painter->paint_batch( batch, n, whole_image, frame, NULL, NULL );
+  }
+  if (frame.opacity!=job->opacity) delete frame.opacity;
+}
+
+static void splat_slab_reduce_task( void* arg, const int band,
+				    const int thread )
+{
+  SplatSlabJob* job= (SplatSlabJob*)arg;
+  int jfirst= (int)((long)band*job->ysize/job->nbands);
+  int jlast= (int)((long)(band+1)*job->ysize/job->nbands);
+  SplatFramebuffer* result= job->images[0];
+  float before[FRAMEBUFFER_TILE_SIZE];
+  for (int j=jfirst; j<jlast; j++) {
+    for (int imin=0; imin<job->xsize; imin += FRAMEBUFFER_TILE_SIZE) {
+      // Untouched pixels are transparent, so compositing them is a no-op
+      int tile= result->tile_of( imin, j );
+      int ntouching= 0;
+      for (int slab=1; slab<job->nslabs; slab++)
+	if (job->images[slab]->touched(tile)) ntouching++;
+      if (!ntouching) continue;
+      int imax= imin + FRAMEBUFFER_TILE_SIZE;
+      if (imax>job->xsize) imax= job->xsize;
+      long first= (long)j*job->xsize + imin;
+      long last= (long)j*job->xsize + imax;
+      result->touch_pixel( imin, j );
+      if (job->opacity) {
+	// Later slabs lie behind
+	float limit= job->opacity->limit();
+	for (long p=first; p<last; p++) before[p-first]= result->pixel(p).a();
+	for (int slab=1; slab<job->nslabs; slab++) {
+	  if (!job->images[slab]->touched(tile)) continue;
+	  result->composite( job->images[slab], first, last-first, 
+			     SC_OVER, 0 );
+	}
+	for (long p=first; p<last; p++) {
+	  if (before[p-first]<limit && result->pixel(p).a()>=limit)
+	    job->opacity->saturate( (int)(p % job->xsize), j );
+	}
+      }
+      else {
+	// Later slabs lie in front
+	for (int slab=1; slab<job->nslabs; slab++) {
+	  if (!job->images[slab]->touched(tile)) continue;
+	  result->composite( job->images[slab], first, last-first, 
+			     SC_OVER, 1 );
+	}
+      }
+    }
+  }
+}
+
+void StarSplatter::splat_by_slabs( SplatFramebuffer* tmp_image, 
+				   SplatOpacityMap* opacity )
+{
+  ThreadTeam team(n_threads);
+  SplatSlabJob job;
+  job.painter= current_splat_painter;
+  job.splats= splatbuf;
+  job.opacity= (front_to_back_compositing()) ? opacity : NULL;
+  job.xsize= xsize;
+  job.ysize= ysize;
+  job.nbands= 4*team.nthreads();
+  if (job.nbands>ysize) job.nbands= ysize;
+  job.nslabs= team.nthreads();
+  double* slab_costs;
+  job.slab_start= splat_cut_by_cost( team, current_splat_painter, splatbuf,
+				     total_stars_after_clipping, NULL,
+				     job.nslabs, slab_costs );
+  job.images= new SplatFramebuffer*[job.nslabs];
+  job.images[0]= tmp_image;
+  job.format= tmp_image->format();
+  for (int i=1; i<job.nslabs; i++) job.images[i]= NULL;
+
+  team.run_costed( splat_slab_paint_task, &job, job.nslabs, slab_costs );
+  team.run( splat_slab_reduce_task, &job, job.nbands );
+
+  if (debug()) 
+    fprintf(stderr,"splatted %d particles in %d depth slabs\n",
+	    total_stars_after_clipping, job.nslabs);
+
+  for (int i=1; i<job.nslabs; i++) delete job.images[i];
+  delete [] job.images;
+  delete [] slab_costs;
+  delete [] job.slab_start;
+}
+
+/* Weighted blending leaves the weighted sum of the splat colors in
+ * each pixel, with the sum of the weights in alpha, and the product of
+ * the splat transparencies in reveal.  The result is the weighted mean
+ * color, premultiplied by the coverage the transparencies give.
+ * Untouched pixels have no coverage, and so stay transparent black.
+ */
+static void splat_resolve_weighted( SplatFramebuffer* buffer, 
+				    const float* reveal )
+{
+  for (int tile=0; tile<buffer->ntiles(); tile++) {
+    if (!buffer->touched(tile)) continue;
+    SplatPixelRect rect;
+    buffer->tile_rect( tile, rect );
+    for (int j=rect.jmin; j<=rect.jmax; j++) {
+      long last= (long)j*buffer->xsize() + rect.imax;
+      for (long p=(long)j*buffer->xsize() + rect.imin; p<=last; p++) {
+	gColor sum= buffer->pixel(p);
+	float coverage= 1.0f - reveal[p];
+	float weight_sum= sum.a();
+	if (weight_sum<1.0e-5f) weight_sum= 1.0e-5f;
+	float scale= coverage/weight_sum;
+	buffer->set_pixel( p, gColor( scale*sum.r(), scale*sum.g(), 
+				      scale*sum.b(), coverage ) );
+      }
+    }
+  }
+}
+
+int StarSplatter::splat_all_stars( rgbImage* image, 
+				   SplatFramebuffer* start_image )
+{
+  // Create the temporary image, which starts transparent black
+  SplatFramebuffer* tmp_image= start_image;
+  if (!tmp_image) 
+    tmp_image= new SplatFramebuffer( xsize, ysize, pixel_format() );
+  if (!tmp_image->valid()) {
     fprintf(stderr,
 	"splat_all_stars: Unable to allocate temporary image (%ld bytes)!\n",
-	    xsize*ysize*sizeof(gColor));
+	    xsize*ysize*SplatFramebuffer::bytes_per_pixel(pixel_format()));
+    delete tmp_image;
     return 0;
   }
 
-  // divergence of rays through adjacent pixels
-  double pix_div= 
-    (xsize >= ysize) ? 
-    (DegtoRad*cam.fov())/ysize : (DegtoRad*cam.fov())/xsize; // small angle
+  // To measure the cost of half precision, keep a full precision copy
+  // of the starting image for painting again
+  SplatFramebuffer* ref_image= NULL;
+  if (debug_flag && tmp_image->format()==SPF_HALF) {
+    ref_image= new SplatFramebuffer( xsize, ysize );
+    if (!ref_image->valid()) {
+      delete ref_image;
+      ref_image= NULL;
+    }
+    else {
+      for (int tile=0; tile<tmp_image->ntiles(); tile++) {
+	if (!tmp_image->touched(tile)) continue;
+	SplatPixelRect rect;
+	tmp_image->tile_rect( tile, rect );
+	ref_image->touch( rect );
+	for (int j=rect.jmin; j<=rect.jmax; j++)
+	  ref_image->composite( tmp_image, (long)j*xsize + rect.imin,
+				rect.imax-rect.imin+1, SC_ADD, 0 );
+      }
+    }
+  }
+
+  SplatOpacityMap* opacity= NULL;
+  if (front_to_back_compositing()) 
+    opacity= new SplatOpacityMap(xsize, ysize, opac_limit);
+  float* tmp_reveal= NULL;
+  if (weighted_blended_compositing()) {
+    tmp_reveal= new float[ xsize*ysize ];
+    for (long p=0; p<(long)xsize*ysize; p++) tmp_reveal[p]= 1.0f;
+  }
+
+  paint_splats( tmp_image, opacity, tmp_reveal );
+  delete opacity;
+
+  int ok= finish_image( image, tmp_image, tmp_reveal );
+  if (ref_image) {
+    if (ok) report_precision( image, ref_image );
+    else delete ref_image;
+  }
+  return ok;
+}
+
+void StarSplatter::report_precision( const rgbImage* image, 
+				     SplatFramebuffer* ref_image )
+{
+  // Half precision applies only to back-to-front and front-to-back
+  // compositing, so there is no revealage to paint.  Debugging is off
+  // for the repeat, so that the painting statistics are not printed
+  // twice.
+  SplatOpacityMap* opacity= NULL;
+  if (front_to_back_compositing()) 
+    opacity= new SplatOpacityMap(xsize, ysize, opac_limit);
+  int debug_level= debug_flag;
+  debug_flag= 0;
+  paint_splats( ref_image, opacity, NULL );
+  delete opacity;
+  rgbImage* ref= new rgbImage( xsize, ysize );
+  ref->clear();
+  int ok= finish_image( ref, ref_image, NULL );
+  debug_flag= debug_level;
+  if (!ok) {
+    fprintf(stderr,
+	    "report_precision: unable to render the full precision image!\n");
+    delete ref;
+    return;
+  }
+
+  int maxdiff[4]= { 0, 0, 0, 0 };
+  long ndiff= 0;
+  for (int j=0; j<ysize; j++)
+    for (int i=0; i<xsize; i++) {
+      int diff[4];
+      diff[0]= abs(image->pix_r(i,j) - ref->pix_r(i,j));
+      diff[1]= abs(image->pix_g(i,j) - ref->pix_g(i,j));
+      diff[2]= abs(image->pix_b(i,j) - ref->pix_b(i,j));
+      diff[3]= abs(image->pix_a(i,j) - ref->pix_a(i,j));
+      if (diff[0] || diff[1] || diff[2] || diff[3]) ndiff++;
+      for (int c=0; c<4; c++) 
+	if (diff[c]>maxdiff[c]) maxdiff[c]= diff[c];
+    }
+  delete ref;
+  fprintf(stderr,"half precision framebuffer, %s exposure: %ld of %ld\n",
+	  exposure_type_name(current_exposure_type), ndiff, 
+	  (long)xsize*ysize);
+  fprintf(stderr,
+	  "pixels differ from full precision, by up to %d %d %d %d levels\n",
+	  maxdiff[0], maxdiff[1], maxdiff[2], maxdiff[3]);
+}
+
+void StarSplatter::paint_splats( SplatFramebuffer* tmp_image, 
+				 SplatOpacityMap* opacity, float* tmp_reveal )
+{
+  // Note that this routine assumes square pixels
 
   double energy_measure_min= 0.0;
   double energy_measure_max= 0.0;
@@ -299,45 +1916,124 @@ int StarSplatter::splat_all_stars( rgbImage* image )
   int pix_hit_max= 0;
   int pix_hit_sum= 0;
 
-  for (Splat* srunner= splatbuf; 
-       srunner< splatbuf + total_stars_after_clipping; 
-       srunner++) {
-      
-    double energy_measure;
-    int pixels_touched= 0;
-    double r= (cam.parallel_proj()) ? 
-      ((cam.atpt() - cam.frompt()).length()) : srunner->range;
+  int additive= additive_compositing();
+  int front_to_back= front_to_back_compositing();
+  current_splat_painter->set_additive( additive );
+  current_splat_painter->set_front_to_back( front_to_back );
+  {
+    ThreadTeam team(n_threads);
+    current_splat_painter->prepare( splatbuf, team );
+  }
 
-    double sep_fac= r*pix_div;
-    
-    double krnl_integral= 0.0; // different scaling from table case
+  // Per-particle statistics need whole splats, so debugging is serial
+  if (n_threads>1 && !debug_flag) {
+    if (additive || tmp_reveal) splat_additive( tmp_image, tmp_reveal );
+    else {
+      // Tile binning decides whether depth slabs would do better
+      int slabs_ok= (!exact_threading_flag 
+		     && (!opacity || opacity->limit()>=1.0));
+      if (!splat_by_tiles( tmp_image, opacity, slabs_ok ))
+	splat_by_slabs( tmp_image, opacity );
+    }
+  }
+  else {
+    SplatPixelRect whole_image;
+    whole_image.imin= 0;
+    whole_image.imax= xsize-1;
+    whole_image.jmin= 0;
+    whole_image.jmax= ysize-1;
+    SplatFrame frame;
+    tmp_image->get_frame( frame );
+    frame.opacity= opacity;
+    frame.reveal= tmp_reveal;
+    SplatPyramid* pyramid= NULL;
+    if (additive && pyr_radius>0.0) 
+      pyramid= new SplatPyramid(xsize, ysize, pyr_radius, 
+				tmp_image->format());
 
-    current_splat_painter->paint( srunner, sep_fac, tmp_image, 
-				  krnl_integral, pixels_touched );
+    Splat batch[SPLAT_BATCH_SIZE];
+    double batch_integral[SPLAT_BATCH_SIZE]; // scaled unlike the table case
+    int batch_pixels[SPLAT_BATCH_SIZE];
+    for (long ibatch=0; ibatch<total_stars_after_clipping; 
+	 ibatch += SPLAT_BATCH_SIZE) {
+      int n= SPLAT_BATCH_SIZE;
+      if (ibatch+n > total_stars_after_clipping) 
+	n= (int)(total_stars_after_clipping-ibatch);
+      for (int i=0; i<n; i++) splatbuf->get( ibatch+i, batch[i] );
 
-    if (debug_flag) {
-      // update energy statistics
-      energy_measure= krnl_integral*sep_fac*sep_fac;
+      int nfine= n;
+      if (pyramid) {
+	// Move the splats for coarser levels to the end of the batch;
+	// order does not matter since compositing is additive
+	nfine= 0;
+	for (int i=0; i<n; i++) {
+	  if (!pyramid->level_for( batch[i], 
+				   current_splat_painter->reach(batch+i) )) {
+	    if (i!=nfine) {
+	      Splat tmp= batch[nfine];
+	      batch[nfine]= batch[i];
+	      batch[i]= tmp;
+	    }
+	    nfine++;
+	  }
+	}
+	for (int i=nfine; i<n; i++) {
+	  double reach= current_splat_painter->reach(batch+i);
+	  int level= pyramid->level_for( batch[i], reach );
+	  if (debug_flag) {
+	    splat_pyramid_paint( current_splat_painter, pyramid, level, 
+				 batch[i], batch_integral+i, batch_pixels+i );
+	    // Energy is measured in the pixels of the coarser level
+	    pyramid->coarsen( batch[i], level, batch[i] );
+	  }
+	  else splat_pyramid_paint( current_splat_painter, pyramid, level, 
+				    batch[i], NULL, NULL );
+	}
+      }
 
-      if (srunner==splatbuf) {
-	energy_measure_min= energy_measure;
-	energy_measure_max= energy_measure;
-	pix_hit_min= pixels_touched;
-	pix_hit_max= pixels_touched;
+      if (!debug_flag) {
+	if (nfine) 
+	  current_splat_painter->paint_batch( batch, nfine, whole_image, frame,
+					      NULL, NULL );
+	continue;
       }
-      else {
-	if (energy_measure<energy_measure_min) 
+
+      if (nfine)
+	current_splat_painter->paint_batch( batch, nfine, whole_image, frame,
+					    batch_integral, batch_pixels );
+
+      for (int i=0; i<n; i++) {
+	// update energy statistics
+	long isplat= ibatch+i;
+	double sep_fac= batch[i].sep_fac;
+	double energy_measure= batch_integral[i]*sep_fac*sep_fac;
+	int pixels_touched= batch_pixels[i];
+
+	if (isplat==0) {
 	  energy_measure_min= energy_measure;
-	if (energy_measure>energy_measure_max) 
 	  energy_measure_max= energy_measure;
-	if (pixels_touched<pix_hit_min) pix_hit_min= pixels_touched;
-	if (pixels_touched>pix_hit_max) pix_hit_max= pixels_touched;
+	  pix_hit_min= pixels_touched;
+	  pix_hit_max= pixels_touched;
+	}
+	else {
+	  if (energy_measure<energy_measure_min) 
+	    energy_measure_min= energy_measure;
+	  if (energy_measure>energy_measure_max) 
+	    energy_measure_max= energy_measure;
+	  if (pixels_touched<pix_hit_min) pix_hit_min= pixels_touched;
+	  if (pixels_touched>pix_hit_max) pix_hit_max= pixels_touched;
+	}
+	energy_measure_ave += energy_measure;
+	pix_hit_sum += pixels_touched;
+	if (!((isplat+1)%10000)) 
+	  fprintf(stderr,"%ld splats done; this splat %d pixels\n",
+		  isplat+1, pixels_touched);
       }
-      energy_measure_ave += energy_measure;
-      pix_hit_sum += pixels_touched;
-      if (!(((int)(srunner-splatbuf)+1)%10000)) 
-	fprintf(stderr,"%d splats done; this splat %d pixels\n",
-		(int)(srunner-splatbuf)+1, pixels_touched);
+    }
+
+    if (pyramid) {
+      pyramid->collapse( tmp_image );
+      delete pyramid;
     }
   }
 
@@ -351,6 +2047,23 @@ int StarSplatter::splat_all_stars( rgbImage* image )
     	    (((double)pix_hit_sum)/((double)total_stars_after_clipping)));
     fprintf(stderr,"energy measure %f to %f, average %f, vs. 1.0 ideal\n",
 	    energy_measure_min, energy_measure_max, energy_measure_ave);
+  }
+}
+
+int StarSplatter::finish_image( rgbImage* image, SplatFramebuffer* tmp_image,
+				float* tmp_reveal )
+{
+  if (tmp_reveal) {
+    splat_resolve_weighted( tmp_image, tmp_reveal );
+    delete [] tmp_reveal;
+  }
+
+  if (debug_flag) {
+    fprintf(stderr,"painted %d of %d framebuffer tiles\n",
+	    tmp_image->ntouched(), tmp_image->ntiles());
+    // Reading the untouched pixels commits no memory for them
+    long npix= (long)xsize*ysize;
+    gColor pix= tmp_image->pixel(0);
 
     // Generate exposure histogram info
     double rmin, rmax, rave;
@@ -358,24 +2071,24 @@ int StarSplatter::splat_all_stars( rgbImage* image )
     double bmin, bmax, bave;
     double amin, amax, aave;
 
-    rmin= rmax= rave= tmp_image->r();
-    gmin= gmax= gave= tmp_image->g();
-    bmin= bmax= bave= tmp_image->b();
-    amin= amax= aave= tmp_image->a();
-    for (pixrunner= tmp_image+1; pixrunner < tmp_image+xsize*ysize;
-	 pixrunner++) {
-      if (pixrunner->r()<rmin) rmin= pixrunner->r();
-      if (pixrunner->r()>rmax) rmax= pixrunner->r();
-      rave += pixrunner->r();
-      if (pixrunner->g()<gmin) gmin= pixrunner->g();
-      if (pixrunner->g()>gmax) gmax= pixrunner->g();
-      gave += pixrunner->g();
-      if (pixrunner->b()<bmin) bmin= pixrunner->b();
-      if (pixrunner->b()>bmax) bmax= pixrunner->b();
-      bave += pixrunner->b();
-      if (pixrunner->a()<amin) amin= pixrunner->a();
-      if (pixrunner->a()>amax) amax= pixrunner->a();
-      aave += pixrunner->a();
+    rmin= rmax= rave= pix.r();
+    gmin= gmax= gave= pix.g();
+    bmin= bmax= bave= pix.b();
+    amin= amax= aave= pix.a();
+    for (long p=1; p<npix; p++) {
+      pix= tmp_image->pixel(p);
+      if (pix.r()<rmin) rmin= pix.r();
+      if (pix.r()>rmax) rmax= pix.r();
+      rave += pix.r();
+      if (pix.g()<gmin) gmin= pix.g();
+      if (pix.g()>gmax) gmax= pix.g();
+      gave += pix.g();
+      if (pix.b()<bmin) bmin= pix.b();
+      if (pix.b()>bmax) bmax= pix.b();
+      bave += pix.b();
+      if (pix.a()<amin) amin= pix.a();
+      if (pix.a()>amax) amax= pix.a();
+      aave += pix.a();
     }
     rave /= (double)(xsize*ysize);
     gave /= (double)(xsize*ysize);
@@ -391,17 +2104,16 @@ int StarSplatter::splat_all_stars( rgbImage* image )
     for (int i=0; i<100; i++) 
       histo[i][0]= histo[i][1]= histo[i][2]= histo[i][3]= 0;
 
-    pixrunner= tmp_image;
-    for (pixrunner= tmp_image; pixrunner-tmp_image < xsize*ysize; 
-	 pixrunner++) {
+    for (long p=0; p<npix; p++) {
+      pix= tmp_image->pixel(p);
       if (rmax>rmin)
-	histo[(int)(99*((pixrunner->r()-rmin)/(rmax-rmin))+0.5)][0]++;
+	histo[(int)(99*((pix.r()-rmin)/(rmax-rmin))+0.5)][0]++;
       if (gmax>gmin)
-	histo[(int)(99*((pixrunner->g()-gmin)/(gmax-gmin))+0.5)][1]++;
+	histo[(int)(99*((pix.g()-gmin)/(gmax-gmin))+0.5)][1]++;
       if (bmax>bmin)
-	histo[(int)(99*((pixrunner->b()-bmin)/(bmax-bmin))+0.5)][2]++;
+	histo[(int)(99*((pix.b()-bmin)/(bmax-bmin))+0.5)][2]++;
       if (amax>amin)
-	histo[(int)(99*((pixrunner->a()-amin)/(amax-amin))+0.5)][3]++;
+	histo[(int)(99*((pix.a()-amin)/(amax-amin))+0.5)][3]++;
     }
 
     fprintf(stderr,"Binned counts within these ranges:\n");
@@ -416,16 +2128,124 @@ int StarSplatter::splat_all_stars( rgbImage* image )
   // Copy the double precision image into the result image
   // Image gets flipped vertically in the process
   if (!convert_image(image, tmp_image)) {
-    delete [] tmp_image;
+    delete tmp_image;
     return 0;
   }
 
   // Clean up
-  delete [] tmp_image;
+  delete tmp_image;
 
   return 1;
 }
 
+/* Painting in several processes gives each its own memory traffic,
+ * which can scale better than threads sharing one image.  Each rank
+ * moves its depth range of the sorted splats to the start of its copy
+ * of the splat buffer before painting.  Processes are used rather than
+ * threads so each has its own copy of the renderer's scratch state, 
+ * and the parent waits on all of them at once so that a rank which
+ * dies cannot leave the others waiting on it.
+ */
+int StarSplatter::paint_rank( SplatSwapCompositor* swap, const int rank )
+{
+  long n= total_stars_after_clipping;
+  long first= (n*rank)/swap->nranks();
+  long last= (n*(rank+1))/swap->nranks();
+  unsigned int rec[SplatBuffer::RECORD_WORDS];
+  for (long i=first; i<last; i++) {
+    splatbuf->get_record( i, rec );
+    splatbuf->set_record( i-first, rec );
+  }
+  splatbuf->set_size( last-first );
+  total_stars_after_clipping= (int)(last-first);
+  n_threads= n_threads/swap->nranks();
+  if (n_threads<1) n_threads= 1;
+
+  SplatOpacityMap* opacity= NULL;
+  if (front_to_back_compositing()) 
+    opacity= new SplatOpacityMap(xsize, ysize, opac_limit);
+  SplatFramebuffer rank_image( xsize, ysize, swap->pixels(rank) );
+  paint_splats( &rank_image, opacity, swap->reveal(rank) );
+  delete opacity;
+  return swap->exchange( rank );
+}
+
+int StarSplatter::splat_by_processes( rgbImage* image, 
+				      SplatFramebuffer* start_image )
+{
+  int nranks= 1;
+  while (2*nranks<=n_procs) nranks *= 2;
+  long npix= (long)xsize*ysize;
+  SplatCompositeOp op= SC_OVER;
+  if (additive_compositing()) op= SC_ADD;
+  else if (weighted_blended_compositing()) op= SC_BLEND;
+  SplatSwapCompositor swap( nranks, npix, op, !front_to_back_compositing(),
+			    weighted_blended_compositing() );
+  if (!swap.valid()) return splat_all_stars( image, start_image );
+
+  // Buffered output would otherwise be written by every rank
+  fflush(stdout);
+  fflush(stderr);
+  pid_t* pids= new pid_t[nranks];
+  int nforked= 0;
+  for (int rank=0; rank<nranks; rank++) {
+    pid_t pid= fork();
+    if (pid==0) _exit( paint_rank( &swap, rank ) ? 0 : 1 );
+    if (pid<0) {
+      perror("StarSplatter::splat_by_processes: fork failed");
+      swap.fail();
+      break;
+    }
+    pids[nforked++]= pid;
+  }
+  int ok= (nforked==nranks);
+  int nwaiting= nforked;
+  while (nwaiting) {
+    int reaped= 0;
+    for (int i=0; i<nforked; i++) {
+      if (!pids[i]) continue;
+      int status;
+      pid_t pid= waitpid( pids[i], &status, WNOHANG );
+      if (pid==0) continue;
+      if (pid<0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+	if (ok) fprintf(stderr,
+			"StarSplatter::splat_by_processes: rank %d failed!\n",
+			i);
+	ok= 0;
+	swap.fail();
+      }
+      pids[i]= 0;
+      nwaiting--;
+      reaped++;
+    }
+    if (!reaped) usleep(1000);
+  }
+  delete [] pids;
+  if (!ok) {
+    delete start_image;
+    return 0;
+  }
+
+  SplatFramebuffer* tmp_image= start_image;
+  if (!tmp_image) tmp_image= new SplatFramebuffer( xsize, ysize );
+  if (!tmp_image->valid()) {
+    fprintf(stderr,
+	    "StarSplatter::splat_by_processes: no memory for the image!\n");
+    delete tmp_image;
+    return 0;
+  }
+  float* tmp_reveal= NULL;
+  if (weighted_blended_compositing()) {
+    tmp_reveal= new float[ npix ];
+    for (long p=0; p<npix; p++) tmp_reveal[p]= 1.0f;
+  }
+  swap.gather( tmp_image->pixels(), tmp_reveal );
+  tmp_image->touch_all();
+  if (debug_flag) 
+    fprintf(stderr,"composited %d ranks by binary swap\n", nranks);
+  return finish_image( image, tmp_image, tmp_reveal );
+}
+
 rgbImage* StarSplatter::render()
 {
   if (!xsize || !ysize) {
@@ -441,13 +2261,19 @@ rgbImage* StarSplatter::render()
   result->clear();
 
   // Transform particles, and merge into splatbuf
-  transform_and_merge();
+  transform_and_merge( sbunch_table, n_sbunches );
 
-  // Depth sort the splatbuf
-  sort();
+  // Drop splats too faint to see, perhaps keeping them as points
+  SplatFramebuffer* start_image= cull_faint();
+
+  // Depth sort the splatbuf, unless order will not matter
+  if (!additive_compositing() && !weighted_blended_compositing()) 
+    sort( front_to_back_compositing() );
 
   // Splat the splatbuf
-  if (!splat_all_stars( result )) {
+  int ok= (n_procs>1) ? splat_by_processes( result, start_image )
+    : splat_all_stars( result, start_image );
+  if (!ok) {
     // splatting failed for some reason
     delete result;
     return NULL;
@@ -456,6 +2282,149 @@ rgbImage* StarSplatter::render()
   return result;
 }
 
+/* Streaming spills each chunk's splats into STREAM_BUCKETS buckets by
+ * screen depth.  Buckets are painted in compositing order, and one too
+ * big for the memory budget is split in turn, up to STREAM_MAX_SPLITS
+ * times; past that its splats are too close in depth for their order
+ * to matter much, and it is painted in pieces.  Each painted splat
+ * costs its place in the splat buffer, the sort records and scratch,
+ * about STREAM_BYTES_PER_SPLAT bytes in all.
+ */
+#define STREAM_BUCKETS 64
+#define STREAM_MAX_SPLITS 3
+#define STREAM_BYTES_PER_SPLAT 64
+#define STREAM_MIN_SPLATS 4096
+
+void StarSplatter::begin_stream( const long memory_budget )
+{
+  delete stream_buckets;
+  stream_buckets= new SplatBucketSet( STREAM_BUCKETS, screen_minz, 
+				      screen_maxz );
+  stream_budget= memory_budget;
+}
+
+int StarSplatter::stream_stars( StarBunch* sbunch_in )
+{
+  if (!stream_buckets) {
+    fprintf(stderr,"StarSplatter::stream_stars: no stream begun!\n");
+    return 0;
+  }
+  if (!xsize || !ysize) {
+    fprintf(stderr,"StarSplatter::stream_stars: image dims not set!\n");
+    return 0;
+  }
+  if (!cam_set_flag) {
+    fprintf(stderr,"StarSplatter::stream_stars: camera not set!\n");
+    return 0;
+  }
+  transform_and_merge( &sbunch_in, 1 );
+  if (!stream_buckets->add( splatbuf, total_stars_after_clipping )) {
+    delete stream_buckets;
+    stream_buckets= NULL;
+    return 0;
+  }
+  if (debug()) fprintf(stderr,"%ld splats streamed so far\n",
+		       stream_buckets->size());
+  return 1;
+}
+
+int StarSplatter::paint_buckets( SplatBucketSet* buckets, 
+				 const long max_splats, 
+				 SplatFramebuffer* tmp_image,
+				 SplatOpacityMap* opacity, float* tmp_reveal,
+				 const int depth )
+{
+  int nearest_first= front_to_back_compositing();
+  for (int k=0; k<buckets->nbuckets(); k++) {
+    int b= (nearest_first) ? buckets->nbuckets()-(k+1) : k;
+    long n= buckets->bucket_size(b);
+    if (!n) continue;
+    if (n>max_splats && depth<STREAM_MAX_SPLITS) {
+      SplatBucketSet* parts= buckets->split( b, STREAM_BUCKETS );
+      if (!parts) return 0;
+      int ok= paint_buckets( parts, max_splats, tmp_image, opacity, 
+			     tmp_reveal, depth+1 );
+      delete parts;
+      if (!ok) return 0;
+      continue;
+    }
+    for (long first=0; first<n; first += max_splats) {
+      long count= (n-first < max_splats) ? n-first : max_splats;
+      splatbuf->reserve(count);
+      if (!buckets->load( b, first, count, splatbuf )) return 0;
+      splatbuf->set_size(count);
+      total_stars_after_clipping= count;
+      SplatFramebuffer* points= cull_faint();
+      if (points) {
+	// Only additive compositing deposits points, so just add them
+	for (int tile=0; tile<points->ntiles(); tile++) {
+	  if (!points->touched(tile)) continue;
+	  SplatPixelRect rect;
+	  points->tile_rect( tile, rect );
+	  tmp_image->touch( rect );
+	  for (int j=rect.jmin; j<=rect.jmax; j++)
+	    tmp_image->composite( points, (long)j*xsize + rect.imin,
+				  rect.imax - rect.imin + 1, SC_ADD, 0 );
+	}
+	delete points;
+      }
+      if (!additive_compositing() && !weighted_blended_compositing()) 
+	sort( nearest_first );
+      paint_splats( tmp_image, opacity, tmp_reveal );
+    }
+    buckets->discard(b);
+  }
+  return 1;
+}
+
+rgbImage* StarSplatter::finish_stream()
+{
+  if (!stream_buckets) {
+    fprintf(stderr,"StarSplatter::finish_stream: no stream begun!\n");
+    return NULL;
+  }
+  long max_splats= stream_budget/STREAM_BYTES_PER_SPLAT;
+  if (max_splats<STREAM_MIN_SPLATS) max_splats= STREAM_MIN_SPLATS;
+  if (debug()) fprintf(stderr,"painting %ld streamed splats, %ld at most "
+		       "at a time\n", stream_buckets->size(), max_splats);
+
+  rgbImage* result= new rgbImage( xsize, ysize );
+  result->clear();
+  SplatFramebuffer* tmp_image= new SplatFramebuffer( xsize, ysize, 
+						     pixel_format() );
+  if (!tmp_image->valid()) {
+    fprintf(stderr,"StarSplatter::finish_stream: no memory for the image!\n");
+    delete tmp_image;
+    delete result;
+    return NULL;
+  }
+  SplatOpacityMap* opacity= NULL;
+  if (front_to_back_compositing()) 
+    opacity= new SplatOpacityMap(xsize, ysize, opac_limit);
+  float* tmp_reveal= NULL;
+  if (weighted_blended_compositing()) {
+    tmp_reveal= new float[ xsize*ysize ];
+    for (long p=0; p<(long)xsize*ysize; p++) tmp_reveal[p]= 1.0f;
+  }
+
+  int ok= paint_buckets( stream_buckets, max_splats, tmp_image, opacity,
+			 tmp_reveal, 0 );
+  delete stream_buckets;
+  stream_buckets= NULL;
+  delete opacity;
+  if (!ok) {
+    delete tmp_image;
+    delete [] tmp_reveal;
+    delete result;
+    return NULL;
+  }
+  if (!finish_image( result, tmp_image, tmp_reveal )) {
+    delete result;
+    return NULL;
+  }
+  return result;
+}
+
 rgbImage* StarSplatter::render_points()
 {
   if (!xsize || !ysize) {
@@ -471,10 +2440,10 @@ rgbImage* StarSplatter::render_points()
   result->clear();
 
   // Transform particles, and merge into splatbuf
-  transform_and_merge();
+  transform_and_merge( sbunch_table, n_sbunches );
 
   // Depth sort the splatbuf
-  sort();
+  sort( 0 );
 
   // Splat the splatbuf
   point_splat_all_stars( result );
@@ -48,6 +48,12 @@ extern int ssplat_load_gadget ( FILE* infile, StarBunch** sbunch_tbl,
 				const int tbl_size, int* bunches_read );
 
 class SplatPainter;
+class SplatBuffer;
+class SplatOpacityMap;
+class SplatOrderHistory;
+class SplatBucketSet;
+class SplatSwapCompositor;
+class SplatFramebuffer;
 
 class StarSplatter {
 public:
@@ -63,15 +69,40 @@ public:
 		      ET_LATE_CMAP_LOG_R, ET_LATE_CMAP_LOG_A,
 		      ET_LATE_CMAP_LOG_R_AUTO, ET_LATE_CMAP_LOG_A_AUTO };
   enum SplatType { SPLAT_GAUSSIAN, SPLAT_SPLINE, SPLAT_GLYPH_CIRCLE };
-  struct Splat {
-    gPoint loc;
+  // CT_DEFAULT is additive for the ET_NOOPAC_* exposure types, and 
+  // back-to-front for the rest.  Additive compositing skips the sort.
+  // CT_FRONT_TO_BACK gives the same image as CT_BACK_TO_FRONT, but
+  // can skip painting behind pixels which are already opaque.
+  // CT_WEIGHTED_BLENDED approximates the sorted result by weighting
+  // splat colors by depth; like additive compositing it needs no sort.
+  enum CompositeType { CT_DEFAULT, CT_BACK_TO_FRONT, CT_ADDITIVE,
+		       CT_FRONT_TO_BACK, CT_WEIGHTED_BLENDED };
+  // FB_DEFAULT framebuffers hold four floats per pixel.  FB_HALF holds
+  // them at half precision, which halves the framebuffer's memory and
+  // traffic at some cost in accuracy; FB_PLANAR holds a plane of floats
+  // per channel, and gives the same image as FB_DEFAULT.
+  enum FramebufferFormat { FB_DEFAULT, FB_HALF, FB_PLANAR };
+  // The current view, for classifying boxes of particles by view_test()
+  struct ViewTest {
+    double proj[16];
+    double clip_xsize;
+    double clip_ysize;
+    double minz;
+    double maxz;
+    double lod_pixels; // largest span of an aggregated box, or 0.0
+    gTransfm world_trans;
+    gPoint frompt;
+    double fixed_range;
+    double pix_div;
+  };
+  struct Splat { // one splat, as unpacked from the SplatBuffer
+    float x;
+    float y;
+    float z;
+    float sqrt_exp_constant;
+    float sep_fac; // kernel units per pixel
+    float density;
     gColor clr;
-    double range;
-    double density;
-    double sqrt_exp_constant;
-    int bunch_index;
-    char filler[64-(sizeof(gPoint)+sizeof(gColor)
-		    +3*sizeof(double)+sizeof(int))];
   };
   void set_image_dims( const int xsize_in, const int ysize_in )
   { xsize= xsize_in; ysize= ysize_in; }
@@ -82,7 +113,21 @@ public:
   void clear_stars();
   void add_stars( StarBunch* sbunch_in ); // Note bunch is not copied!
   rgbImage* render(); // returns null on failure
+  void get_view_test( ViewTest& test, const double lod_pixels ) const;
+  // Classifies a box in model coordinates: 0 if no particle in it can
+  // be seen, 3 if it spans fewer than the test's lod_pixels on screen,
+  // 2 if every particle in it can be seen, and 1 otherwise
+  static int view_test( const ViewTest& test, const gBoundBox& box );
   rgbImage* render_points();
+  // Streaming renders more particles than fit in memory at once.  Each
+  // chunk passed to stream_stars() is transformed and clipped at once,
+  // and its splats are spilled to temporary files by depth, so that
+  // the bunch can then be refilled with the next chunk.  finish_stream()
+  // paints the spilled splats one depth range at a time, holding about
+  // memory_budget bytes of splats at most.
+  void begin_stream( const long memory_budget );
+  int stream_stars( StarBunch* sbunch_in ); // returns 0 on failure
+  rgbImage* finish_stream(); // returns null on failure
   int image_xsize() const { return xsize; }
   int image_ysize() const { return ysize; }
   double splat_cutoff_frac() const { return splat_cutoff; }
@@ -113,14 +158,124 @@ public:
   void set_exposure_scale( const double scale_in ) { exp_scale= scale_in; }
   SplatType splat_type() const;
   void set_splat_type(SplatType t);
+  CompositeType composite_type() const { return current_composite_type; }
+  void set_composite_type( const CompositeType type )
+  { current_composite_type= type; }
+  // Painters may approximate kernels by cached stamps, with about 
+  // this much error relative to the kernel peak; 0.0 disables stamps.
+  double stamp_tolerance() const { return stamp_tol; }
+  void set_stamp_tolerance( const double tol_in ) 
+  { stamp_tol= (tol_in>0.0) ? tol_in : 0.0; }
+  // If set, the Gaussian kernel is integrated over each pixel's area
+  // rather than sampled at the pixel center.
+  int pixel_integration() const { return pixel_integration_flag; }
+  void set_pixel_integration( const int flag ) 
+  { pixel_integration_flag= flag; }
+  // With additive compositing, splats reaching more than twice this
+  // many pixels are painted at lower resolution, on the level of an
+  // image pyramid where they reach one to two times as far; 0.0 
+  // disables the pyramid.  The energy of each such splat changes by
+  // up to about 6/radius percent, most near the image edges, so a
+  // radius of 8 keeps it within 0.75%.  Log exposures magnify the
+  // smoothing of the faint outskirts of the splats.
+  double pyramid_radius() const { return pyr_radius; }
+  void set_pyramid_radius( const double radius_in )
+  { pyr_radius= (radius_in>0.0) ? radius_in : 0.0; }
+  // If set, exposure types which look only at alpha (the late colormap
+  // types reading alpha) paint a single density channel rather than
+  // four colors, which takes a quarter of the memory and gives the same
+  // image.  Weighted blended compositing, and painting in more than one
+  // process, always paint colors.
+  int density_framebuffer() const { return density_fb_flag; }
+  void set_density_framebuffer( const int flag ) { density_fb_flag= flag; }
+  // The format of the framebuffer, where the density framebuffer does
+  // not apply.  Painting in more than one process uses FB_DEFAULT, as
+  // do additive compositing and weighted blending in place of FB_HALF,
+  // since their running sums need full precision.  Half precision
+  // pixels keep 11 significant bits, saturate at 65504, and lose
+  // precision below about 6e-5, which log exposures magnify in faint
+  // pixels.  With debugging on, half precision renders of the splat
+  // buffer are repeated at full precision, and the differences
+  // reported in output levels for the current exposure type.
+  FramebufferFormat framebuffer_format() const { return fb_format; }
+  void set_framebuffer_format( const FramebufferFormat format_in )
+  { fb_format= format_in; }
+  // With front-to-back compositing, pixels whose opacity reaches this
+  // limit receive no more paint.  1.0 gives the back-to-front image;
+  // lower limits trade accuracy for speed.
+  double opacity_limit() const { return opac_limit; }
+  void set_opacity_limit( const double limit_in )
+  { opac_limit= (limit_in>1.0) ? 1.0 : ((limit_in>0.0) ? limit_in : 0.0); }
+  // Splats whose peak contribution to any output channel, under the
+  // current exposure, is below this many 8-bit levels are culled before
+  // painting; 0.0 disables culling.  There is no culling for exposure
+  // types which rescale the image automatically.
+  double cull_threshold() const { return cull_thresh; }
+  void set_cull_threshold( const double levels_in )
+  { cull_thresh= (levels_in>0.0) ? levels_in : 0.0; }
+  // With additive compositing, culled splats may instead be deposited
+  // whole on the pixel holding their centers, preserving their energy.
+  int cull_to_points() const { return cull_points_flag; }
+  void set_cull_to_points( const int flag ) { cull_points_flag= flag; }
+  // If set, each depth sort starts from the order of the frame before,
+  // which is much faster when the view changes little between frames.
+  int temporal_sort() const { return temporal_sort_flag; }
+  void set_temporal_sort( const int flag ) { temporal_sort_flag= flag; }
+  // If set, each bunch gets an octree, and particles in octree nodes
+  // wholly outside the view are skipped without being transformed.
+  int octree_culling() const { return octree_culling_flag; }
+  void set_octree_culling( const int flag ) { octree_culling_flag= flag; }
+  // Octree nodes spanning fewer than this many pixels are drawn as a
+  // single splat aggregating their particles; 0.0 disables aggregation.
+  double lod_threshold() const { return lod_thresh; }
+  void set_lod_threshold( const double pixels_in )
+  { lod_thresh= (pixels_in>0.0) ? pixels_in : 0.0; }
+  // If set, bunches not already in spatial order are sorted spatially
+  // before rendering, which changes the order of their records.
+  int spatial_sort() const { return spatial_sort_flag; }
+  void set_spatial_sort( const int flag ) { spatial_sort_flag= flag; }
+  int thread_count() const { return n_threads; }
+  // Threads paint back-to-front and front-to-back images by screen
+  // tiles, which gives exactly the serial image.  Where tiles would
+  // balance poorly they may instead paint depth slabs which are then
+  // composited, giving the serial image only up to float rounding,
+  // which can change an output level.  Exact threading always uses
+  // tiles.
+  int exact_threading() const { return exact_threading_flag; }
+  void set_exact_threading( const int flag ) { exact_threading_flag= flag; }
+  // With more than one process, the sorted splats are cut into that
+  // many depth ranges, rounded down to a power of two, and each range
+  // is painted by a forked process into an image in shared memory.
+  // The images are combined by binary swap compositing, and the 
+  // threads are shared among the processes.
+  int process_count() const { return n_procs; }
+  void set_process_count( const int n_in ) { n_procs= (n_in>0) ? n_in : 1; }
+  // How far a splat at screen depth z lies from the near clipping 
+  // plane toward the far one, from 0.0 to 1.0
+  static double depth_fraction( const float z )
+  { return ((double)screen_maxz - z)/((double)screen_maxz - screen_minz); }
+  void set_thread_count( const int n_in ) { n_threads= (n_in>0) ? n_in : 1; }
 private:
   int debug_flag;
   ExposureType current_exposure_type;
+  CompositeType current_composite_type;
   double log_rescale_min;
   double log_rescale_max;
   int xsize;
   int ysize;
   double splat_cutoff;
+  double stamp_tol;
+  int pixel_integration_flag;
+  double pyr_radius;
+  int density_fb_flag;
+  FramebufferFormat fb_format;
+  double opac_limit;
+  double cull_thresh;
+  int cull_points_flag;
+  int temporal_sort_flag;
+  int octree_culling_flag;
+  double lod_thresh;
+  int spatial_sort_flag;
   double exp_scale;
   Camera cam;
   int cam_set_flag;
@@ -130,41 +285,99 @@ private:
   int n_sbunches;
   int total_stars;
   int total_stars_after_clipping;
-  Splat* splatbuf;
-  int splatbuf_size;
+  SplatBuffer* splatbuf;
+  unsigned long long* sortkeys; // records, then radix sort scratch
+  long sortkeys_size;
+  SplatOrderHistory* order_history;
+  SplatBucketSet* stream_buckets; // non-NULL while streaming
+  long stream_budget;
   SplatPainter* current_splat_painter;
   StarBunchCMap* late_cmap;
+  int n_threads;
+  int n_procs;
+  int exact_threading_flag;
   static short screen_minz;
   static short screen_maxz;
   static int initial_sbunch_table_size;
+  static int splat_tile_size;
   static double default_gaussian_splat_cutoff;
   static double default_log_rescale_min;
   static double default_log_rescale_max;
-  void transform_and_merge();
-  void sort();
-  int convert_image( rgbImage* image, const gColor* raw_image );
-  int splat_all_stars( rgbImage* image ); // returns 0 on failure
+  double pixel_divergence() const;
+  int use_temporal_sort() const 
+  { return temporal_sort_flag && !stream_buckets; }
+  void transform_and_merge( StarBunch** table, const int ntable );
+  void reserve_sortkeys( const long n );
+  double cull_levels_per_unit() const;
+  SplatFramebuffer* cull_faint();
+  void sort( const int nearest_first );
+  int additive_compositing() const;
+  int front_to_back_compositing() const;
+  int weighted_blended_compositing() const;
+  // The SplatPixelFormat of new framebuffers
+  int pixel_format() const;
+  int convert_image( rgbImage* image, const SplatFramebuffer* raw_image );
+  // Returns 0 on failure.  If start_image is not NULL, the splats are
+  // painted over it, and it is deleted.
+  int splat_all_stars( rgbImage* image, SplatFramebuffer* start_image );
+  void paint_splats( SplatFramebuffer* tmp_image, SplatOpacityMap* opacity,
+		     float* tmp_reveal );
+  // Resolves and converts tmp_image into image, deleting it and
+  // tmp_reveal; returns 0 on failure
+  int finish_image( rgbImage* image, SplatFramebuffer* tmp_image, 
+		    float* tmp_reveal );
+  // Paints ref_image again at full precision, converts it, and reports
+  // how far image differs from the result; deletes ref_image
+  void report_precision( const rgbImage* image, SplatFramebuffer* ref_image );
+  static const char* exposure_type_name( const ExposureType type );
+  // Like splat_all_stars(), but painting in n_procs processes
+  int splat_by_processes( rgbImage* image, SplatFramebuffer* start_image );
+  int paint_rank( SplatSwapCompositor* swap, const int rank );
+  int paint_buckets( SplatBucketSet* buckets, const long max_splats,
+		     SplatFramebuffer* tmp_image, SplatOpacityMap* opacity,
+		     float* tmp_reveal, const int depth );
+  // Returns 0, having painted nothing, if slabs_ok and depth slabs
+  // would be faster
+  int splat_by_tiles( SplatFramebuffer* tmp_image, SplatOpacityMap* opacity,
+		      const int slabs_ok );
+  void splat_by_slabs( SplatFramebuffer* tmp_image, 
+		       SplatOpacityMap* opacity );
+  void splat_additive( SplatFramebuffer* tmp_image, float* tmp_reveal );
   void point_splat_all_stars( rgbImage* image ); 
-  int convert_image_linear(rgbImage* image, const gColor* raw_image);
-  int convert_image_log(rgbImage* image, const gColor* raw_image);
-  int convert_image_log_auto(rgbImage* image, const gColor* raw_image);
-  int convert_image_noopac_linear(rgbImage* image, const gColor* raw_image);
-  int convert_image_noopac_log(rgbImage* image, const gColor* raw_image);
-  int convert_image_noopac_log_auto(rgbImage* image, const gColor* raw_image);
-  int convert_image_noopac_log_hsv(rgbImage* image, const gColor* raw_image);
+  // The converters treat tiles raw_image has not touched as transparent
+  // black, without reading them
+  int convert_image_linear(rgbImage* image, 
+			   const SplatFramebuffer* raw_image);
+  int convert_image_log(rgbImage* image, const SplatFramebuffer* raw_image);
+  int convert_image_log_auto(rgbImage* image, 
+			     const SplatFramebuffer* raw_image);
+  int convert_image_noopac_linear(rgbImage* image, 
+				  const SplatFramebuffer* raw_image);
+  int convert_image_noopac_log(rgbImage* image, 
+			       const SplatFramebuffer* raw_image);
+  int convert_image_noopac_log_auto(rgbImage* image, 
+				    const SplatFramebuffer* raw_image);
+  int convert_image_noopac_log_hsv(rgbImage* image, 
+				   const SplatFramebuffer* raw_image);
   int convert_image_noopac_log_hsv_auto(rgbImage* image, 
-					const gColor* raw_image);
-  int convert_image_lupton(rgbImage* image, const gColor* raw_image);
-  int convert_image_log_hsv(rgbImage* image, const gColor* raw_image);
-  int convert_image_log_hsv_auto(rgbImage* image, const gColor* raw_image);
-  int convert_image_late_cmap_r(rgbImage* image, const gColor* raw_image);
-  int convert_image_late_cmap_a(rgbImage* image, const gColor* raw_image);
-  int convert_image_late_cmap_log_r(rgbImage* image, const gColor* raw_image);
-  int convert_image_late_cmap_log_a(rgbImage* image, const gColor* raw_image);
+					const SplatFramebuffer* raw_image);
+  int convert_image_lupton(rgbImage* image, 
+			   const SplatFramebuffer* raw_image);
+  int convert_image_log_hsv(rgbImage* image, 
+			    const SplatFramebuffer* raw_image);
+  int convert_image_log_hsv_auto(rgbImage* image, 
+				 const SplatFramebuffer* raw_image);
+  int convert_image_late_cmap_r(rgbImage* image, 
+				const SplatFramebuffer* raw_image);
+  int convert_image_late_cmap_a(rgbImage* image, 
+				const SplatFramebuffer* raw_image);
+  int convert_image_late_cmap_log_r(rgbImage* image, 
+				    const SplatFramebuffer* raw_image);
+  int convert_image_late_cmap_log_a(rgbImage* image, 
+				    const SplatFramebuffer* raw_image);
   int convert_image_late_cmap_log_r_auto(rgbImage* image, 
-					 const gColor* raw_image);
+					 const SplatFramebuffer* raw_image);
   int convert_image_late_cmap_log_a_auto(rgbImage* image, 
-					 const gColor* raw_image);
-  static int splat_depth_compare( const void* s1, const void* s2 ); //for qsort
+					 const SplatFramebuffer* raw_image);
 };
 
@@ -12,6 +12,7 @@ manipulate rendering geometry and rendered images."
 #include <map>
 #include <utility>
 #include "starsplatter.h"
+#include "starbunchlod.h"
 %}
 
 %include "typemaps.i"
@@ -688,6 +689,8 @@ public:
   void crop( const gPoint pt, const gVector dir );
   int  sort_ascending_by_prop( const int iProp );
   int  sort_ascending_by_id();
+  int  sort_spatially( const int nthreads=1 );
+  int  spatially_sorted();
   int allocate_next_free_prop_index(const char* name);
   void deallocate_prop_index(const int iProp);
   // returns non-zero on success- turn it into an exception
@@ -889,6 +892,9 @@ public:
 		      ET_LATE_CMAP_LOG_R, ET_LATE_CMAP_LOG_A,
 		      ET_LATE_CMAP_LOG_R_AUTO, ET_LATE_CMAP_LOG_A_AUTO };
   enum SplatType { SPLAT_GAUSSIAN, SPLAT_SPLINE, SPLAT_GLYPH_CIRCLE };
+  enum CompositeType { CT_DEFAULT, CT_BACK_TO_FRONT, CT_ADDITIVE,
+		       CT_FRONT_TO_BACK, CT_WEIGHTED_BLENDED };
+  enum FramebufferFormat { FB_DEFAULT, FB_HALF, FB_PLANAR };
   void set_image_dims( const int xsize_in, const int ysize_in );
   void set_camera( const Camera& cam_in );
   void set_transform( const gTransfm& trans_in );
@@ -918,6 +924,23 @@ public:
     }
   }
   rgbImage* render_points(); // returns null on failure
+  void begin_stream( const long memory_budget );
+  %exception stream_stars {
+    $action
+    if (!result) {
+      PyErr_SetString(PyExc_RuntimeError,"stream_stars failed");
+      return NULL;
+    }
+  }
+  int stream_stars( StarBunch* sbunch_in ); // returns 0 on failure
+  %exception finish_stream {
+    $action
+    if (!result) {
+      PyErr_SetString(PyExc_RuntimeError,"finish_stream failed");
+      return NULL;
+    }
+  }
+  rgbImage* finish_stream(); // returns null on failure
   int image_xsize();
   int image_ysize();
   double splat_cutoff_frac();
@@ -939,6 +962,38 @@ public:
   void set_exposure_scale( const double scale_in );
   SplatType splat_type();
   void set_splat_type( SplatType splatType );
+  CompositeType composite_type();
+  void set_composite_type( const CompositeType type );
+  double stamp_tolerance();
+  void set_stamp_tolerance( const double tol_in );
+  int pixel_integration();
+  void set_pixel_integration( const int flag );
+  double pyramid_radius();
+  void set_pyramid_radius( const double radius_in );
+  int density_framebuffer();
+  void set_density_framebuffer( const int flag );
+  FramebufferFormat framebuffer_format();
+  void set_framebuffer_format( const FramebufferFormat format_in );
+  double opacity_limit();
+  void set_opacity_limit( const double limit_in );
+  double cull_threshold();
+  void set_cull_threshold( const double levels_in );
+  int cull_to_points();
+  void set_cull_to_points( const int flag );
+  int temporal_sort();
+  void set_temporal_sort( const int flag );
+  int octree_culling();
+  void set_octree_culling( const int flag );
+  double lod_threshold();
+  void set_lod_threshold( const double pixels_in );
+  int spatial_sort();
+  void set_spatial_sort( const int flag );
+  int thread_count();
+  int exact_threading();
+  void set_exact_threading( const int flag );
+  void set_thread_count( const int n_in );
+  int process_count();
+  void set_process_count( const int n_in );
 };
 
 %extend StarSplatter {
@@ -948,3 +1003,42 @@ public:
     fflush(f);
  }
 }
+
+// This routine returns non-zero on success- turn it into an exception
+%rename(write_lod_file) ssplat_write_lod_file; // it will be in module namespace
+%exception ssplat_write_lod_file {
+  $action
+  if (!result) {
+    PyErr_SetString(PyExc_IOError,"write_lod_file failed");
+    return NULL;
+  }
+}
+
+extern int ssplat_write_lod_file( StarBunch* sb, const char* fname );
+
+class StarBunchLODFile {
+ public:
+  StarBunchLODFile();
+  ~StarBunchLODFile();
+  %exception open {
+    $action
+    if (!result) {
+      PyErr_SetString(PyExc_IOError,"StarBunchLODFile open failed");
+      return NULL;
+    }
+  }
+  int open( const char* fname ); // returns non-zero on success
+  void close();
+  int is_open();
+  long nstars();
+  int nnodes();
+  %exception extract {
+    $action
+    if (!result) {
+      PyErr_SetString(PyExc_RuntimeError,"StarBunchLODFile extract failed");
+      return NULL;
+    }
+  }
+  int extract( const StarSplatter* ren, const double pixel_tol,
+	       StarBunch* sb ); // returns non-zero on success
+};
@@ -0,0 +1,254 @@
+/****************************************************************************
+ * threadteam.cc
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "threadteam.h"
+
+/* Notes-
+ * run_costed() seeds one queue per thread by the longest-processing-
+ * time rule: tasks are taken in order of decreasing cost, and each goes
+ * to the queue with the least total cost so far.  A thread works
+ * through its own queue from the expensive end.  When its queue is
+ * empty it steals from the cheap end of the queue with the most cost
+ * remaining, so a thread held up by one huge task loses its small ones
+ * to idle threads.  Each queue is guarded by its own mutex; tasks are
+ * coarse enough that the locking cost does not matter.
+ */
+
+struct ThreadTeamShared {
+  ThreadTeamTaskFunc func;
+  void* arg;
+  int ntasks;
+  volatile int next_task;
+};
+
+struct ThreadTeamMember {
+  void* shared;
+  int thread;
+};
+
+static void* thread_team_worker( void* member_in )
+{
+  ThreadTeamMember* member= (ThreadTeamMember*)member_in;
+  ThreadTeamShared* shared= (ThreadTeamShared*)member->shared;
+  int task;
+  while ((task= __sync_fetch_and_add(&(shared->next_task),1))
+	 < shared->ntasks)
+    (*shared->func)(shared->arg, task, member->thread);
+  return NULL;
+}
+
+ThreadTeam::ThreadTeam( const int nthreads_in )
+{
+  n_threads= (nthreads_in>0) ? nthreads_in : 1;
+}
+
+ThreadTeam::~ThreadTeam()
+{
+  // Nothing to clean up
+}
+
+int ThreadTeam::ncpus()
+{
+  long n= sysconf(_SC_NPROCESSORS_ONLN);
+  return (n>0) ? (int)n : 1;
+}
+
+void ThreadTeam::launch( void* (*worker)(void*), void* shared,
+			 const int nworkers )
+{
+  ThreadTeamMember* members= new ThreadTeamMember[nworkers];
+  pthread_t* threads= new pthread_t[nworkers];
+  int nstarted= 1;
+  for (int i=0; i<nworkers; i++) {
+    members[i].shared= shared;
+    members[i].thread= i;
+  }
+  for (int i=1; i<nworkers; i++) {
+    if (pthread_create(threads+i, NULL, worker, members+i)) {
+      fprintf(stderr,
+	      "ThreadTeam: unable to start thread %d; continuing with %d\n",
+	      i, nstarted);
+      break;
+    }
+    nstarted++;
+  }
+
+  // The calling thread is member 0
+  (*worker)(members);
+
+  for (int i=1; i<nstarted; i++) pthread_join(threads[i], NULL);
+  delete [] threads;
+  delete [] members;
+}
+
+void ThreadTeam::run( ThreadTeamTaskFunc func, void* arg, const int ntasks )
+{
+  int nworkers= (ntasks<n_threads) ? ntasks : n_threads;
+  if (nworkers<=1) {
+    for (int task=0; task<ntasks; task++) (*func)(arg, task, 0);
+    return;
+  }
+
+  ThreadTeamShared shared;
+  shared.func= func;
+  shared.arg= arg;
+  shared.ntasks= ntasks;
+  shared.next_task= 0;
+  launch( thread_team_worker, &shared, nworkers );
+}
+
+struct ThreadTeamQueue {
+  pthread_mutex_t lock;
+  volatile int head; // next task the owner runs
+  volatile int tail; // one past the task a thief would take
+  volatile double remaining; // cost of the tasks from head to tail
+};
+
+struct ThreadTeamStealShared {
+  ThreadTeamTaskFunc func;
+  void* arg;
+  const double* costs;
+  int nqueues;
+  ThreadTeamQueue* queues;
+  int* tasks; // each queue's tasks lie between its head and tail
+};
+
+static int thread_team_pop( ThreadTeamStealShared* shared, const int q,
+			    const int from_tail )
+{
+  ThreadTeamQueue* queue= shared->queues+q;
+  int task= -1;
+  pthread_mutex_lock(&(queue->lock));
+  if (queue->head<queue->tail) {
+    if (from_tail) task= shared->tasks[--(queue->tail)];
+    else task= shared->tasks[(queue->head)++];
+    queue->remaining -= shared->costs[task];
+  }
+  pthread_mutex_unlock(&(queue->lock));
+  return task;
+}
+
+static void* thread_team_steal_worker( void* member_in )
+{
+  ThreadTeamMember* member= (ThreadTeamMember*)member_in;
+  ThreadTeamStealShared* shared= (ThreadTeamStealShared*)member->shared;
+  int task;
+  while ((task= thread_team_pop(shared, member->thread, 0)) >= 0)
+    (*shared->func)(shared->arg, task, member->thread);
+
+  while (1) {
+    // Pick the victim with the most work left; the estimate is only a
+    // hint, so it is read without locking.
+    int victim= -1;
+    double most= 0.0;
+    for (int q=0; q<shared->nqueues; q++) {
+      ThreadTeamQueue* queue= shared->queues+q;
+      if (queue->head<queue->tail 
+	  && (victim<0 || queue->remaining>most)) {
+	victim= q;
+	most= queue->remaining;
+      }
+    }
+    if (victim<0) break;
+    if ((task= thread_team_pop(shared, victim, 1)) >= 0)
+      (*shared->func)(shared->arg, task, member->thread);
+  }
+  return NULL;
+}
+
+struct ThreadTeamCostRec {
+  double cost;
+  int task;
+};
+
+static int thread_team_cost_compare( const void* p1, const void* p2 )
+{
+  // Sorts into descending order of cost, then ascending task number
+  const ThreadTeamCostRec* r1= (const ThreadTeamCostRec*)p1;
+  const ThreadTeamCostRec* r2= (const ThreadTeamCostRec*)p2;
+  if (r1->cost>r2->cost) return -1;
+  else if (r1->cost<r2->cost) return 1;
+  else return (r1->task - r2->task);
+}
+
+void ThreadTeam::run_costed( ThreadTeamTaskFunc func, void* arg,
+			     const int ntasks, const double* costs )
+{
+  int nworkers= (ntasks<n_threads) ? ntasks : n_threads;
+  ThreadTeamCostRec* recs= new ThreadTeamCostRec[ntasks];
+  for (int task=0; task<ntasks; task++) {
+    recs[task].cost= costs[task];
+    recs[task].task= task;
+  }
+  qsort(recs, ntasks, sizeof(ThreadTeamCostRec), thread_team_cost_compare);
+
+  if (nworkers<=1) {
+    for (int i=0; i<ntasks; i++) (*func)(arg, recs[i].task, 0);
+    delete [] recs;
+    return;
+  }
+
+  // Longest processing time seeding
+  int* owner= new int[ntasks];
+  int* counts= new int[nworkers];
+  double* loads= new double[nworkers];
+  for (int q=0; q<nworkers; q++) {
+    counts[q]= 0;
+    loads[q]= 0.0;
+  }
+  for (int i=0; i<ntasks; i++) {
+    int best= 0;
+    for (int q=1; q<nworkers; q++) if (loads[q]<loads[best]) best= q;
+    owner[i]= best;
+    counts[best]++;
+    loads[best] += recs[i].cost;
+  }
+
+  ThreadTeamStealShared shared;
+  shared.func= func;
+  shared.arg= arg;
+  shared.costs= costs;
+  shared.nqueues= nworkers;
+  shared.queues= new ThreadTeamQueue[nworkers];
+  shared.tasks= new int[ntasks];
+  int running= 0;
+  for (int q=0; q<nworkers; q++) {
+    pthread_mutex_init(&(shared.queues[q].lock), NULL);
+    shared.queues[q].head= shared.queues[q].tail= running;
+    shared.queues[q].remaining= loads[q];
+    running += counts[q];
+  }
+  // Each queue's tasks stay in decreasing order of cost
+  for (int i=0; i<ntasks; i++) 
+    shared.tasks[(shared.queues[owner[i]].tail)++]= recs[i].task;
+
+  launch( thread_team_steal_worker, &shared, nworkers );
+
+  for (int q=0; q<nworkers; q++) 
+    pthread_mutex_destroy(&(shared.queues[q].lock));
+  delete [] shared.tasks;
+  delete [] shared.queues;
+  delete [] loads;
+  delete [] counts;
+  delete [] owner;
+  delete [] recs;
+}
@@ -0,0 +1,46 @@
+/****************************************************************************
+ * threadteam.h
+ * Author agent
+ * Copyright 2026, Pittsburgh Supercomputing Center, Carnegie Mellon University
+ *
+ * Permission use, copy, and modify this software and its documentation
+ * without fee for personal use or use within your organization is hereby
+ * granted, provided that the above copyright notice is preserved in all
+ * copies and that that copyright and this permission notice appear in
+ * supporting documentation.  Permission to redistribute this software to
+ * other organizations or individuals is not granted;  that must be
+ * negotiated with the PSC.  Neither the PSC nor Carnegie Mellon
+ * University make any representations about the suitability of this
+ * software for any purpose.  It is provided "as is" without express or
+ * implied warranty.
+ *****************************************************************************/
+
+// Avoid double definitions
+#ifndef INCL_THREADTEAM
+#define INCL_THREADTEAM
+
+/* A ThreadTeam runs a batch of independent tasks on a fixed number of
+ * POSIX threads.  The calling thread works as one member of the team,
+ * and run() returns only when every task is complete.  Tasks are handed
+ * out in index order, so callers should number expensive tasks first.
+ * run_costed() takes an estimated cost for each task instead, and 
+ * balances the load by work stealing.
+ */
+typedef void (*ThreadTeamTaskFunc)( void* arg, const int task,
+				    const int thread );
+
+class ThreadTeam {
+ public:
+  ThreadTeam( const int nthreads_in );
+  ~ThreadTeam();
+  int nthreads() const { return n_threads; }
+  void run( ThreadTeamTaskFunc func, void* arg, const int ntasks );
+  void run_costed( ThreadTeamTaskFunc func, void* arg, const int ntasks,
+		   const double* costs );
+  static int ncpus(); // number of processors currently online
+ private:
+  int n_threads;
+  void launch( void* (*worker)(void*), void* shared, const int nworkers );
+};
+
+#endif // INCL_THREADTEAM